@@ -0,0 +1,432 @@
+// bench - time per frame of every pattern, on the host.
+//
+// Build and run from the project directory:
+//   g++ -std=gnu++17 -O2 -I host/include -I include host/bench.cpp -o bench
+//   ./bench [frames] [pattern... | ops | noise8 | random | particles | auth | vm]
+//
+// `ops` times the PixelOps framebuffer kernels over one strip-length frame,
+// next to the same work done through the strip's per-pixel accessors.
+// `noise8` times the noise field over 1000 pixels, next to a random() per pixel.
+// `vm` runs the custom pattern with two kernels compiled by tools/patternc and
+// reports each frame's time against the 16 ms output frame budget; the
+// pattern table's "custom" row runs the first of them.
+// `particles` steps and renders full particle pools of several sizes, topping
+// them up every frame, and reports particles handled per second.
+// `auth` times the per-loop authentication check with clients waiting to
+// authenticate: the pending-map scan the loop used to run on every pass,
+// next to the deadline check it runs now, and a whole loop() pass for scale.
+// `random` times per-pixel draws like fire's and apocalypse's with random()
+// and with FastRandom. The host random() is a plain software generator, so the
+// "device path" rows stand in for the device's: a volatile load in place of
+// the RNG register read, then the modulo by a variable bound. They do not
+// include the wait ESP-IDF's esp_random() adds between reads (16 APB cycles,
+// ~48 CPU cycles at 240 MHz), so they are a lower bound for the device.
+//
+// Each pattern is created the way the render loop creates it and updated with
+// a zero interval, so every call renders and shows a frame; the timebase moves
+// one step per frame. Host times are
+// not device times, but the ratios between builds are a fair guide: build
+// again with e.g. -DFRAME_CACHE_BUDGET=0 to compare a change.
+
+#include "../src/main.cpp"
+
+#include <chrono>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+  // patternc output for:
+  //   frame:
+  //   speed = t * 0.25
+  //   pixel:
+  //   v = sin(x * 3 + speed) * 0.5 + 0.5
+  //   r = r * v
+  //   g = g * v
+  //   b = b * v
+  const uint8_t WAVE_KERNEL[] = {
+        0x50, 0x56, 0x01, 0x03, 0x03, 0x0f, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00,
+        0x03, 0x00, 0x00, 0x80, 0x00, 0x00, 0x02, 0x0f, 0x00, 0x00, 0x05, 0x0f,
+        0x06, 0x0f, 0x01, 0x07, 0x0f, 0x00, 0x02, 0x0f, 0x01, 0x00, 0x05, 0x0f,
+        0x04, 0x0f, 0x03, 0x0f, 0x0f, 0x07, 0x0c, 0x0f, 0x0f, 0x00, 0x02, 0x0e,
+        0x02, 0x00, 0x05, 0x0f, 0x0f, 0x0e, 0x02, 0x0e, 0x02, 0x00, 0x03, 0x0f,
+        0x0f, 0x0e, 0x01, 0x08, 0x0f, 0x00, 0x05, 0x0f, 0x00, 0x08, 0x01, 0x00,
+        0x0f, 0x00, 0x05, 0x0f, 0x01, 0x08, 0x01, 0x01, 0x0f, 0x00, 0x05, 0x0f,
+        0x02, 0x08, 0x01, 0x02, 0x0f, 0x00};
+
+  // patternc output for:
+  //   frame:
+  //   a = t * 0.05
+  //   c = t * 0.031
+  //   pixel:
+  //   p = sin(x * 2 + a) + sin(x * 5 - c) + cos(x * 3 + a * 2) + sin(abs(frac(x * 4 + c) - 0.5))
+  //   v = frac(p * 0.25 + 0.5)
+  //   w = min(max(v * 2, 0), 1)
+  //   r = r * w
+  //   g = g * (1 - w)
+  //   b = b * v
+  const uint8_t PLASMA_KERNEL[] = {
+        0x50, 0x56, 0x01, 0x0a, 0x06, 0x2f, 0xcd, 0x0c, 0x00, 0x00, 0xf0, 0x07,
+        0x00, 0x00, 0x00, 0x00, 0x02, 0x00, 0x00, 0x00, 0x05, 0x00, 0x00, 0x00,
+        0x03, 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x80, 0x00, 0x00, 0x00, 0x40,
+        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x02, 0x0f,
+        0x00, 0x00, 0x05, 0x0f, 0x06, 0x0f, 0x01, 0x07, 0x0f, 0x00, 0x02, 0x0f,
+        0x01, 0x00, 0x05, 0x0f, 0x06, 0x0f, 0x01, 0x08, 0x0f, 0x00, 0x02, 0x0f,
+        0x02, 0x00, 0x05, 0x0f, 0x04, 0x0f, 0x03, 0x0f, 0x0f, 0x07, 0x0c, 0x0f,
+        0x0f, 0x00, 0x02, 0x0e, 0x03, 0x00, 0x05, 0x0e, 0x04, 0x0e, 0x04, 0x0e,
+        0x0e, 0x08, 0x0c, 0x0e, 0x0e, 0x00, 0x03, 0x0f, 0x0f, 0x0e, 0x02, 0x0e,
+        0x04, 0x00, 0x05, 0x0e, 0x04, 0x0e, 0x02, 0x0d, 0x02, 0x00, 0x05, 0x0d,
+        0x07, 0x0d, 0x03, 0x0e, 0x0e, 0x0d, 0x0d, 0x0e, 0x0e, 0x00, 0x03, 0x0f,
+        0x0f, 0x0e, 0x02, 0x0e, 0x05, 0x00, 0x05, 0x0e, 0x04, 0x0e, 0x03, 0x0e,
+        0x0e, 0x08, 0x0f, 0x0e, 0x0e, 0x00, 0x02, 0x0d, 0x06, 0x00, 0x04, 0x0e,
+        0x0e, 0x0d, 0x09, 0x0e, 0x0e, 0x00, 0x0c, 0x0e, 0x0e, 0x00, 0x03, 0x0f,
+        0x0f, 0x0e, 0x01, 0x09, 0x0f, 0x00, 0x02, 0x0f, 0x07, 0x00, 0x05, 0x0f,
+        0x09, 0x0f, 0x02, 0x0e, 0x06, 0x00, 0x03, 0x0f, 0x0f, 0x0e, 0x0f, 0x0f,
+        0x0f, 0x00, 0x01, 0x0a, 0x0f, 0x00, 0x02, 0x0f, 0x02, 0x00, 0x05, 0x0f,
+        0x0a, 0x0f, 0x02, 0x0e, 0x08, 0x00, 0x0b, 0x0f, 0x0f, 0x0e, 0x02, 0x0e,
+        0x09, 0x00, 0x0a, 0x0f, 0x0f, 0x0e, 0x01, 0x0b, 0x0f, 0x00, 0x05, 0x0f,
+        0x00, 0x0b, 0x01, 0x00, 0x0f, 0x00, 0x02, 0x0f, 0x09, 0x00, 0x04, 0x0f,
+        0x0f, 0x0b, 0x05, 0x0f, 0x01, 0x0f, 0x01, 0x01, 0x0f, 0x00, 0x05, 0x0f,
+        0x02, 0x0a, 0x01, 0x02, 0x0f, 0x00};
+
+  template <typename Work>
+  void time(const char *name, int frames, Work work)
+  {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++)
+      work(i);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-28s %10.3f\n", name, seconds * 1e6 / frames);
+  }
+
+  void benchOps(int frames)
+  {
+    static uint32_t frame[NUM_LEDS];
+    static uint32_t layer[NUM_LEDS];
+    uint16_t n = strip.numPixels();
+    for (uint16_t i = 0; i < n; i++)
+    {
+      frame[i] = strip.ColorHSV(i * 65536L / n);
+      layer[i] = strip.Color(i, 255 - i, 64);
+    }
+
+    printf("%-28s %10s\n", "operation", "us/frame");
+    time("accessor fade (c >> 1)", frames, [n](int)
+         {
+           for (uint16_t i = 0; i < n; i++)
+             strip.setPixelColor(i, (strip.getPixelColor(i) >> 1) & 0x7F7F7F);
+         });
+    time("fadeToBlackBy + write", frames, [n](int)
+         {
+           fadeToBlackBy(frame, n, 128);
+           writePixels(strip, frame, n);
+         });
+    time("accessor copy", frames, [n](int)
+         {
+           for (uint16_t i = 0; i < n; i++)
+             strip.setPixelColor(i, frame[i]);
+         });
+    time("writePixels", frames, [n](int)
+         { writePixels(strip, frame, n); });
+    time("fadeToBlackBy", frames, [n](int)
+         { fadeToBlackBy(frame, n, 32); });
+    time("blur1d", frames, [n](int)
+         { blur1d(frame, n, 64); });
+    time("addPixels", frames, [n](int)
+         { addPixels(frame, layer, n); });
+    time("rotatePixels", frames, [n](int i)
+         { rotatePixels(frame, n, i % 7 - 3); });
+    time("shiftPixels", frames, [n](int i)
+         { shiftPixels(frame, n, i % 7 - 3, 0); });
+    time("fillGradient", frames, [n](int i)
+         { fillGradient(frame, n, i, 0xFF8000); });
+  }
+
+  volatile uint32_t rngRegister = 1; // stands in for the hardware RNG data register
+
+  // random(low, high) as the device runs it: a register read, then a modulo.
+  long deviceRandom(long low, long high)
+  {
+    if (low >= high)
+      return low;
+    uint32_t value = rngRegister;
+    rngRegister = value * 1664525u + 1013904223u;
+    return low + value % (uint32_t)(high - low);
+  }
+
+  void benchRandom(int frames)
+  {
+    static FastRandom rng(1);
+    static volatile uint32_t sink; // keeps the draws from being optimised away
+    uint16_t n = strip.numPixels();
+
+    printf("%-28s %10s\n", "per-pixel draws", "us/frame");
+    time("random(0, 50)", frames, [n](int)
+         {
+           uint32_t sum = 0;
+           for (uint16_t i = 0; i < n; i++)
+             sum += random(0, 50);
+           sink = sum;
+         });
+    time("device path (0, 50)", frames, [n](int)
+         {
+           uint32_t sum = 0;
+           for (uint16_t i = 0; i < n; i++)
+             sum += deviceRandom(0, 50);
+           sink = sum;
+         });
+    time("FastRandom::below(50)", frames, [n](int)
+         {
+           uint32_t sum = 0;
+           for (uint16_t i = 0; i < n; i++)
+             sum += rng.below(50);
+           sink = sum;
+         });
+    // bounds from the colour, as apocalypse draws them, so the divisor is not a constant
+    time("random(c / 2, c) x3", frames, [n](int)
+         {
+           DeviceSettings *s = deviceSettings;
+           uint32_t sum = 0;
+           for (uint16_t i = 0; i < n; i++)
+             sum += random(s->red / 2, s->red) + random(s->green / 2, s->green) + random(s->blue / 2, s->blue);
+           sink = sum;
+         });
+    time("device path (c / 2, c) x3", frames, [n](int)
+         {
+           DeviceSettings *s = deviceSettings;
+           uint32_t sum = 0;
+           for (uint16_t i = 0; i < n; i++)
+             sum += deviceRandom(s->red / 2, s->red) + deviceRandom(s->green / 2, s->green) + deviceRandom(s->blue / 2, s->blue);
+           sink = sum;
+         });
+    time("FastRandom::range x3", frames, [n](int)
+         {
+           DeviceSettings *s = deviceSettings;
+           uint32_t sum = 0;
+           for (uint16_t i = 0; i < n; i++)
+             sum += rng.range(s->red / 2, s->red) + rng.range(s->green / 2, s->green) + rng.range(s->blue / 2, s->blue);
+           sink = sum;
+         });
+    printf("(checksum %08lx)\n", (unsigned long)sink);
+  }
+
+  template <uint16_t Capacity>
+  void benchParticlePool(int frames)
+  {
+    static ParticleSystem<Capacity> particles;
+    static uint32_t frame[NUM_LEDS];
+    static FastRandom rng(1);
+    uint16_t n = strip.numPixels();
+    uint64_t handled = 0;
+
+    particles.clear();
+    particles.wrap = true;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++)
+    {
+      while (particles.count < Capacity)
+      {
+        particles.spawn(rng.below(n * 256), rng.range(-512, 512), 255, 128, 32, 255, rng.range(1, 8));
+      }
+      handled += particles.count;
+      particles.step(n);
+      fillPixels(frame, n, 0);
+      particles.render(frame, n);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    char name[32];
+    snprintf(name, sizeof(name), "pool of %u", Capacity);
+    printf("%-28s %10.3f %14.0f\n", name, seconds * 1e6 / frames, handled / seconds);
+  }
+
+  void benchParticles(int frames)
+  {
+    printf("%-28s %10s %14s\n", "step + render", "us/frame", "particles/s");
+    benchParticlePool<16>(frames);
+    benchParticlePool<64>(frames);
+    benchParticlePool<256>(frames);
+    benchParticlePool<1024>(frames);
+  }
+
+  // The check loop() used to make on every pass: walk the pending map and
+  // collect expired or authenticated entries into a temporary set.
+  void scanPending(std::unordered_map<uint16_t, unsigned long> &pending, std::unordered_set<uint16_t> &authenticated)
+  {
+    auto now = millis();
+    std::unordered_set<uint16_t> toRemove = std::unordered_set<uint16_t>();
+    for (auto it = pending.begin(); it != pending.end(); ++it)
+    {
+      if (authenticated.find(it->first) != authenticated.end() || now - it->second > AUTHENTICATION_TIMEOUT)
+        toRemove.insert(it->first);
+    }
+    for (auto connectionID : toRemove)
+      pending.erase(connectionID);
+  }
+
+  void benchAuth(int frames)
+  {
+    printf("%-28s %10s\n", "check per loop", "us/loop");
+    for (uint16_t waiting = 1; waiting <= MAX_CONNECTIONS; waiting *= 2)
+    {
+      std::unordered_map<uint16_t, unsigned long> pending;
+      std::unordered_set<uint16_t> authenticated;
+      for (uint16_t id = 0; id < waiting; id++)
+      {
+        pending[id] = millis();
+        deviceSettings->sessions.open(id, millis() + AUTHENTICATION_TIMEOUT);
+      }
+
+      char name[32];
+      snprintf(name, sizeof(name), "map scan, %u pending", waiting);
+      time(name, frames, [&](int)
+           { scanPending(pending, authenticated); });
+      snprintf(name, sizeof(name), "deadline, %u pending", waiting);
+      time(name, frames, [](int)
+           { authenticationtimeoutHandler->verifyDevices(); });
+
+      for (uint16_t id = 0; id < waiting; id++)
+        deviceSettings->sessions.close(id);
+    }
+
+    deviceSettings->pattern = "flat";
+    time("loop() pass, flat", frames, [](int)
+         { loop(); });
+  }
+
+  void benchKernel(const char *name, const uint8_t *program, uint16_t length, int frames)
+  {
+    deviceSettings->programs.save(program, length);
+    Pattern *pattern = createPattern("custom", deviceSettings);
+
+    uint32_t shown = strip.frames;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++)
+    {
+      host::clock += 1000;
+      deviceSettings->timebase.advance(micros());
+      pattern->update();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    shown = strip.frames - shown;
+    delete pattern;
+
+    PatternVM vm;
+    vm.load(program, length);
+    double perFrame = shown > 0 ? seconds * 1e6 / shown : 0;
+    printf("%-16s %12lu %10.2f %9.2f%%\n", name, (unsigned long)vm.frameCost(strip.numPixels()), perFrame,
+           perFrame * 100 / (OUTPUT_FRAME_INTERVAL * 1000));
+  }
+
+  void benchVM(int frames)
+  {
+    printf("%-16s %12s %10s %10s\n", "kernel", "instructions", "us/frame", "of budget");
+    benchKernel("wave", WAVE_KERNEL, sizeof(WAVE_KERNEL), frames);
+    benchKernel("plasma", PLASMA_KERNEL, sizeof(PLASMA_KERNEL), frames);
+    deviceSettings->programs.save(WAVE_KERNEL, sizeof(WAVE_KERNEL));
+  }
+
+  void benchNoise(int frames)
+  {
+    const uint16_t n = 1000;
+    static uint8_t levels[n];
+
+    printf("%-28s %10s\n", "1000 pixels", "us/frame");
+    time("random(0, 50)", frames, [](int)
+         {
+           for (uint16_t i = 0; i < n; i++)
+             levels[i] = random(0, 50);
+         });
+    time("noise8 1D", frames, [](int frame)
+         {
+           for (uint16_t i = 0; i < n; i++)
+             levels[i] = noise8(i * 40 + frame * 48);
+         });
+    time("fillNoise8 2D", frames, [](int frame)
+         { fillNoise8(levels, n, 0, 40, frame * 48, 1); });
+    time("fillNoise8 2D, 2 octaves", frames, [](int frame)
+         { fillNoise8(levels, n, 0, 40, frame * 48, 2); });
+    time("fillNoise8 2D, 3 octaves", frames, [](int frame)
+         { fillNoise8(levels, n, 0, 40, frame * 48, 3); });
+  }
+}
+
+int main(int argc, char **argv)
+{
+  int frames = argc > 1 ? atoi(argv[1]) : 5000;
+
+  setup();
+  deviceSettings->setRate(1000);
+  deviceSettings->refreshPalette();
+  deviceSettings->interval = 0;
+  deviceSettings->programs.save(WAVE_KERNEL, sizeof(WAVE_KERNEL));
+
+  for (int i = 2; i < argc; i++)
+  {
+    if (strcmp(argv[i], "ops") == 0)
+    {
+      benchOps(frames * 20);
+      return 0;
+    }
+    if (strcmp(argv[i], "random") == 0)
+    {
+      benchRandom(frames * 20);
+      return 0;
+    }
+    if (strcmp(argv[i], "vm") == 0)
+    {
+      benchVM(frames);
+      return 0;
+    }
+    if (strcmp(argv[i], "auth") == 0)
+    {
+      benchAuth(frames * 20);
+      return 0;
+    }
+    if (strcmp(argv[i], "particles") == 0)
+    {
+      benchParticles(frames);
+      return 0;
+    }
+    if (strcmp(argv[i], "noise8") == 0)
+    {
+      benchNoise(frames);
+      return 0;
+    }
+  }
+
+  printf("%-16s %10s %12s\n", "pattern", "us/frame", "frames/s");
+  for (uint8_t id = 0; id < PATTERN_COUNT; id++)
+  {
+    const char *name = PATTERN_NAMES[id];
+    bool selected = argc <= 2;
+    for (int i = 2; i < argc; i++)
+      selected |= strcmp(argv[i], name) == 0;
+    if (!selected)
+      continue;
+
+    Pattern *pattern = createPattern(name, deviceSettings);
+    if (!pattern)
+      continue;
+
+    uint32_t shown = strip.frames;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; i++)
+    {
+      host::clock += 1000;
+      deviceSettings->timebase.advance(micros());
+      pattern->update();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    shown = strip.frames - shown;
+    delete pattern;
+
+    if (shown == 0)
+    {
+      printf("%-16s %10s %12s\n", name, "-", "-");
+      continue;
+    }
+    printf("%-16s %10.2f %12.0f\n", name, seconds * 1e6 / shown, shown / seconds);
+  }
+  return 0;
+}
@@ -0,0 +1,310 @@
+// device - the firmware as a virtual frame on a local socket.
+//
+// Build and run from the project directory:
+//   g++ -std=gnu++17 -O2 -I host/include -I include host/device.cpp -o device
+//   ./device unix:/tmp/frame.sock [-v] [--image=firmware.bin]
+//   ./device tcp:7000 [-v]
+//
+// setup() and loop() run unchanged on the host shims against the real clock.
+// Each socket connection is one GATT connection: connecting and closing call
+// the server callbacks, and GattSocket messages are delivered to the
+// characteristic callbacks the same way the BLE stack delivers them, so
+// authentication, session slots and timeouts behave as on the device.
+// Notifications go to every connected client, or to the one client the
+// firmware addressed. When the firmware disconnects a
+// client its socket is closed. A client that sends GATT_FRAMES is sent the
+// strip bytes of every frame from then on, as the stand-in for the LEDs.
+//
+// --image loads the file as the running image for delta OTA updates. When an
+// update completes and the firmware restarts, the new image is written next
+// to it as <image>.new and the device exits.
+//
+// Add -DMAX_CONNECTIONS=32 to the build to accept more than the device's four
+// concurrent links.
+
+#include "../src/main.cpp"
+
+#include <GattSocket.h>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <poll.h>
+#include <set>
+#include <signal.h>
+#include <vector>
+
+namespace
+{
+  struct Client
+  {
+    int fd;
+    gatt::Reader reader;
+  };
+
+  std::map<uint16_t, Client> clients; // by connection ID
+  std::vector<uint16_t> dropped;      // disconnected by the firmware, closed after the current message
+  std::set<int> watchers;             // sockets subscribed to frames
+
+  // A write that lands before the previous write to the same characteristic
+  // was rendered never reaches the LEDs.
+  std::map<uint16_t, uint32_t> lastWriteFrame;
+  uint32_t writes = 0;
+  uint32_t superseded = 0;
+  uint32_t refused = 0;
+
+  volatile sig_atomic_t running = 1;
+
+  void notifyClients(BLECharacteristic *characteristic)
+  {
+    for (auto &entry : clients)
+      gatt::send(entry.second.fd, GATT_NOTIFY, characteristic->handle, characteristic->getData(), characteristic->getLength());
+  }
+
+  void notifyClient(uint16_t connectionID, uint16_t handle, const uint8_t *value, uint16_t length)
+  {
+    auto it = clients.find(connectionID);
+    if (it != clients.end())
+      gatt::send(it->second.fd, GATT_NOTIFY, handle, value, length);
+  }
+
+  void sendFrame(const uint8_t *pixels, uint16_t length)
+  {
+    for (int fd : watchers)
+      gatt::send(fd, GATT_FRAMES, 0, pixels, length);
+  }
+
+  void dropClient(uint16_t connectionID)
+  {
+    dropped.push_back(connectionID);
+  }
+
+  void disconnect(uint16_t connectionID)
+  {
+    auto it = clients.find(connectionID);
+    if (it == clients.end())
+      return;
+
+    watchers.erase(it->second.fd);
+    close(it->second.fd);
+    clients.erase(it);
+    pServer->connected--;
+
+    esp_ble_gatts_cb_param_t param = {};
+    param.disconnect.conn_id = connectionID;
+    pServer->getCallbacks()->onDisconnect(pServer, &param);
+  }
+
+  std::string discovery()
+  {
+    std::string text;
+    char line[96];
+    for (BLECharacteristic *characteristic : BLECharacteristic::handles())
+    {
+      snprintf(line, sizeof(line), "%u %s %u\n", characteristic->handle, characteristic->uuid.c_str(), characteristic->properties);
+      text += line;
+    }
+    return text;
+  }
+
+  void handle(uint16_t connectionID, int fd, const GattMessage &message)
+  {
+    esp_ble_gatts_cb_param_t param = {};
+
+    if (message.op == GATT_DISCOVER)
+    {
+      gatt::send(fd, GATT_DISCOVER, 0, discovery());
+      return;
+    }
+
+    if (message.op == GATT_STATS)
+    {
+      char text[128];
+      snprintf(text, sizeof(text), "frames %u writes %u superseded %u refused %u\n", strip.frames, writes, superseded, refused);
+      gatt::send(fd, GATT_STATS, 0, text);
+      return;
+    }
+
+    if (message.op == GATT_FRAMES)
+    {
+      watchers.insert(fd);
+      return;
+    }
+
+    BLECharacteristic *characteristic = BLECharacteristic::byHandle(message.handle);
+    if (!characteristic || !characteristic->getCallbacks())
+    {
+      return;
+    }
+
+    switch (message.op)
+    {
+    case GATT_WRITE:
+    case GATT_WRITE_COMMAND:
+    {
+      auto last = lastWriteFrame.find(message.handle);
+      if (last != lastWriteFrame.end() && last->second == strip.frames)
+        superseded++;
+      lastWriteFrame[message.handle] = strip.frames;
+      writes++;
+
+      characteristic->setValue((const uint8_t *)message.value.data(), message.value.size());
+      param.write.conn_id = connectionID;
+      param.write.handle = message.handle;
+      param.write.len = message.value.size();
+      param.write.value = characteristic->getData();
+      param.write.need_rsp = message.op == GATT_WRITE;
+      characteristic->getCallbacks()->onWrite(characteristic, &param);
+
+      if (message.op == GATT_WRITE)
+        gatt::send(fd, GATT_WRITE_RESPONSE, message.handle);
+      break;
+    }
+    case GATT_READ:
+      param.read.conn_id = connectionID;
+      param.read.handle = message.handle;
+      characteristic->getCallbacks()->onRead(characteristic, &param);
+      gatt::send(fd, GATT_READ_RESPONSE, message.handle, characteristic->getData(), characteristic->getLength());
+      break;
+    }
+  }
+
+  void accept(int listener)
+  {
+    int fd = ::accept(listener, nullptr, nullptr);
+    if (fd < 0)
+      return;
+
+    uint16_t connectionID = 0;
+    while (clients.count(connectionID))
+      connectionID++;
+    clients[connectionID] = Client{fd, gatt::Reader()};
+    pServer->connected++;
+
+    esp_ble_gatts_cb_param_t param = {};
+    param.connect.conn_id = connectionID;
+    pServer->getCallbacks()->onConnect(pServer, &param);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s unix:<path> | tcp:[host:]<port> [-v] [--image=<firmware.bin>]\n", argv[0]);
+    return 2;
+  }
+
+  std::string image;
+  for (int i = 2; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-v") == 0)
+      host::echo = true;
+    else if (strncmp(argv[i], "--image=", 8) == 0)
+      image = argv[i] + 8;
+  }
+
+  if (!image.empty())
+  {
+    std::ifstream input(image, std::ios::binary);
+    host::runningImage.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+  }
+
+  int listener = gatt::open(argv[1], true);
+  if (listener < 0)
+  {
+    fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+
+  signal(SIGINT, [](int)
+         { running = 0; });
+  signal(SIGTERM, [](int)
+         { running = 0; });
+
+  host::notified = notifyClients;
+  host::indicated = notifyClient;
+  host::disconnected = dropClient;
+  host::frameShown = sendFrame;
+
+  auto start = std::chrono::steady_clock::now();
+  auto now = [&start]()
+  {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  };
+
+  setup();
+  fprintf(stderr, "listening on %s\n", argv[1]);
+
+  std::vector<pollfd> fds;
+  std::vector<uint16_t> connections;
+  while (running && host::restarts == 0)
+  {
+    fds.assign(1, pollfd{listener, POLLIN, 0});
+    connections.clear();
+    for (auto &entry : clients)
+    {
+      fds.push_back(pollfd{entry.second.fd, POLLIN, 0});
+      connections.push_back(entry.first);
+    }
+
+    // Wake at least once a millisecond to run the render loop.
+    poll(fds.data(), fds.size(), 1);
+    host::clock = now();
+
+    if (fds[0].revents & POLLIN)
+    {
+      accept(listener);
+      if (!dropped.empty())
+        refused++;
+    }
+
+    for (size_t i = 1; i < fds.size(); i++)
+    {
+      if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+        continue;
+
+      uint16_t connectionID = connections[i - 1];
+      auto it = clients.find(connectionID);
+      if (it == clients.end())
+        continue;
+
+      Client &client = it->second;
+      if (!client.reader.fill(client.fd))
+      {
+        disconnect(connectionID);
+        continue;
+      }
+
+      GattMessage message;
+      while (clients.count(connectionID) && client.reader.next(message))
+      {
+        handle(connectionID, client.fd, message);
+        for (uint16_t id : dropped)
+          disconnect(id);
+        dropped.clear();
+      }
+    }
+
+    for (uint16_t id : dropped)
+      disconnect(id);
+    dropped.clear();
+
+    host::clock = now();
+    loop();
+  }
+
+  while (!clients.empty())
+    disconnect(clients.begin()->first);
+  close(listener);
+
+  if (host::restarts > 0)
+  {
+    std::string updated = (image.empty() ? std::string("firmware.bin") : image) + ".new";
+    std::ofstream output(updated, std::ios::binary);
+    output.write((const char *)host::updateImage.data(), host::updateImage.size());
+    fprintf(stderr, "restarted into a %zu byte image, written to %s\n", host::updateImage.size(), updated.c_str());
+  }
+  printf("frames %u writes %u superseded %u refused %u\n", strip.frames, writes, superseded, refused);
+  return 0;
+}
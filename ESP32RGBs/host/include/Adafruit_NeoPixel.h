@@ -0,0 +1,155 @@
+#pragma once
+
+// Host build of Adafruit_NeoPixel: a plain pixel buffer in the same byte
+// order as the device, with nothing to send it to.
+
+#include <Arduino.h>
+
+#define NEO_GRB ((1 << 6) | (1 << 4) | (0 << 2) | (2))
+#define NEO_KHZ800 0x0000
+
+typedef uint16_t neoPixelType;
+
+namespace host
+{
+  // Called with the bytes of every frame sent to the strip, so a host
+  // transport can pass them on as if the LEDs had lit.
+  inline void (*frameShown)(const uint8_t *pixels, uint16_t length) = nullptr;
+}
+
+class Adafruit_NeoPixel
+{
+protected:
+  uint16_t numLEDs;
+  uint16_t numBytes;
+  uint8_t *pixels;
+  uint8_t rOffset;
+  uint8_t gOffset;
+  uint8_t bOffset;
+
+public:
+  uint32_t shown = 0; // frames sent to the (absent) strip
+
+  Adafruit_NeoPixel(uint16_t n, int16_t, neoPixelType type)
+  {
+    this->numLEDs = n;
+    this->numBytes = n * 3;
+    this->pixels = new uint8_t[this->numBytes]();
+    this->rOffset = (type >> 4) & 0b11;
+    this->gOffset = (type >> 2) & 0b11;
+    this->bOffset = type & 0b11;
+  }
+
+  ~Adafruit_NeoPixel() { delete[] this->pixels; }
+
+  void begin() {}
+  void show()
+  {
+    this->shown++;
+    if (host::frameShown)
+      host::frameShown(this->pixels, this->numBytes);
+  }
+  bool canShow() const { return true; }
+  uint16_t numPixels() const { return this->numLEDs; }
+  uint8_t *getPixels() const { return this->pixels; }
+
+  void setPixelColor(uint16_t n, uint8_t r, uint8_t g, uint8_t b)
+  {
+    if (n >= this->numLEDs)
+      return;
+    uint8_t *p = &this->pixels[n * 3];
+    p[this->rOffset] = r;
+    p[this->gOffset] = g;
+    p[this->bOffset] = b;
+  }
+
+  void setPixelColor(uint16_t n, uint32_t c)
+  {
+    this->setPixelColor(n, (uint8_t)(c >> 16), (uint8_t)(c >> 8), (uint8_t)c);
+  }
+
+  uint32_t getPixelColor(uint16_t n) const
+  {
+    if (n >= this->numLEDs)
+      return 0;
+    const uint8_t *p = &this->pixels[n * 3];
+    return ((uint32_t)p[this->rOffset] << 16) | ((uint32_t)p[this->gOffset] << 8) | p[this->bOffset];
+  }
+
+  void fill(uint32_t c = 0, uint16_t first = 0, uint16_t count = 0)
+  {
+    if (first >= this->numLEDs)
+      return;
+    uint16_t end = count == 0 ? this->numLEDs : min<uint16_t>(first + count, this->numLEDs);
+    for (uint16_t i = first; i < end; i++)
+      this->setPixelColor(i, c);
+  }
+
+  void clear() { memset(this->pixels, 0, this->numBytes); }
+
+  static uint32_t Color(uint8_t r, uint8_t g, uint8_t b)
+  {
+    return ((uint32_t)r << 16) | ((uint32_t)g << 8) | b;
+  }
+
+  // Same integer arithmetic as the library, so hues match the device exactly.
+  static uint32_t ColorHSV(uint16_t hue, uint8_t sat = 255, uint8_t val = 255)
+  {
+    uint8_t r, g, b;
+    hue = (hue * 1530L + 32768) / 65536;
+    if (hue < 510)
+    {
+      b = 0;
+      if (hue < 255)
+      {
+        r = 255;
+        g = hue;
+      }
+      else
+      {
+        r = 510 - hue;
+        g = 255;
+      }
+    }
+    else if (hue < 1020)
+    {
+      r = 0;
+      if (hue < 765)
+      {
+        g = 255;
+        b = hue - 510;
+      }
+      else
+      {
+        g = 1020 - hue;
+        b = 255;
+      }
+    }
+    else if (hue < 1530)
+    {
+      g = 0;
+      if (hue < 1275)
+      {
+        r = hue - 1020;
+        b = 255;
+      }
+      else
+      {
+        r = 255;
+        b = 1530 - hue;
+      }
+    }
+    else
+    {
+      r = 255;
+      g = b = 0;
+    }
+
+    uint32_t v1 = 1 + val;
+    uint16_t s1 = 1 + sat;
+    uint8_t s2 = 255 - sat;
+    return ((((((r * s1) >> 8) + s2) * v1) & 0xff00) << 8) |
+           (((((g * s1) >> 8) + s2) * v1) & 0xff00) |
+           (((((b * s1) >> 8) + s2) * v1) >> 8);
+  }
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+// Host build of the small part of the Arduino core the firmware uses.
+//
+// Time comes from a virtual clock that only moves when the host advances it
+// (or the firmware calls delay()), and random() is seeded and portable, so a
+// run is reproducible.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <deque>
+#include <string>
+
+using std::max;
+using std::min;
+
+#define D0 0
+#define D10 10
+#define OUTPUT 1
+#define LOW 0
+#define HIGH 1
+#define IRAM_ATTR
+
+#define constrain(amount, low, high) ((amount) < (low) ? (low) : ((amount) > (high) ? (high) : (amount)))
+
+class String
+{
+private:
+  std::string value;
+
+public:
+  String() {}
+  String(const char *value) : value(value) {}
+  String(const char *value, size_t length) : value(value, length) {}
+  String(const uint8_t *value, size_t length) : value((const char *)value, length) {}
+  String(const std::string &value) : value(value) {}
+  explicit String(int value) : value(std::to_string(value)) {}
+
+  size_t length() const { return this->value.size(); }
+  bool isEmpty() const { return this->value.empty(); }
+  const char *c_str() const { return this->value.c_str(); }
+  char operator[](size_t i) const { return this->value[i]; }
+  int toInt() const { return atoi(this->value.c_str()); }
+
+  bool operator==(const String &other) const { return this->value == other.value; }
+  bool operator==(const char *other) const { return this->value == other; }
+  bool operator!=(const String &other) const { return this->value != other.value; }
+  bool operator!=(const char *other) const { return this->value != other; }
+  String operator+(const String &other) const { return String(this->value + other.value); }
+};
+
+namespace host
+{
+  inline uint64_t clock = 0; // microseconds since boot
+  inline uint64_t seed = 0x9E3779B97F4A7C15ull;
+  inline bool echo = false; // copy Serial output to stderr
+}
+
+struct HostSerial
+{
+  std::deque<uint8_t> input;
+
+  void begin(unsigned long) {}
+
+  int printf(const char *format, ...)
+  {
+    va_list args;
+    va_start(args, format);
+    int length = host::echo ? vfprintf(stderr, format, args) : vsnprintf(nullptr, 0, format, args);
+    va_end(args);
+    return length;
+  }
+
+  void print(const char *text) { this->printf("%s", text); }
+  void print(const String &text) { this->printf("%s", text.c_str()); }
+  void print(double value, int digits = 2) { this->printf("%.*f", digits, value); }
+  void println() { this->printf("\n"); }
+  void println(const char *text) { this->printf("%s\n", text); }
+  void println(const String &text) { this->printf("%s\n", text.c_str()); }
+  void println(double value, int digits = 2) { this->printf("%.*f\n", digits, value); }
+
+  size_t write(const uint8_t *data, size_t length)
+  {
+    this->printf("%.*s", (int)length, (const char *)data);
+    return length;
+  }
+
+  int available() { return (int)this->input.size(); }
+
+  int read()
+  {
+    if (this->input.empty())
+      return -1;
+    int c = this->input.front();
+    this->input.pop_front();
+    return c;
+  }
+};
+
+inline HostSerial Serial;
+
+inline unsigned long millis() { return (unsigned long)(host::clock / 1000); }
+inline unsigned long micros() { return (unsigned long)host::clock; }
+inline void delay(unsigned long ms) { host::clock += (uint64_t)ms * 1000; }
+inline void delayMicroseconds(unsigned int us) { host::clock += us; }
+
+inline void pinMode(int, int) {}
+inline void digitalWrite(int, int) {}
+
+// splitmix64, so sequences are the same on every host.
+inline uint32_t esp_random()
+{
+  uint64_t z = (host::seed += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+inline void randomSeed(unsigned long seed) { host::seed = seed; }
+
+inline long random(long howBig)
+{
+  return howBig <= 0 ? 0 : (long)(esp_random() % (uint32_t)howBig);
+}
+
+inline long random(long howSmall, long howBig)
+{
+  return howSmall >= howBig ? howSmall : howSmall + random(howBig - howSmall);
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <BLEServer.h>
+
+class BLE2902 : public BLEDescriptor
+{
+public:
+  BLE2902() : BLEDescriptor((uint16_t)0x2902) {}
+};
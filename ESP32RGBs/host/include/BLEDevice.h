@@ -0,0 +1,19 @@
+#pragma once
+
+#include <BLEServer.h>
+
+class BLEDevice
+{
+public:
+  static BLEServer *server()
+  {
+    static BLEServer server;
+    return &server;
+  }
+
+  static void init(const char *) {}
+  static void setMTU(uint16_t) {}
+  static void setCustomGattsHandler(void (*)(esp_gatts_cb_event_t, esp_gatt_if_t, esp_ble_gatts_cb_param_t *)) {}
+  static BLEServer *createServer() { return server(); }
+  static BLEAdvertising *getAdvertising() { return server()->getAdvertising(); }
+};
@@ -0,0 +1,271 @@
+#pragma once
+
+// Host build of the Bluedroid GATT server classes. Characteristics keep their
+// value and callbacks so a host program can deliver writes and reads to the
+// firmware exactly as the BLE stack would; nothing goes over the air.
+
+#include <Arduino.h>
+#include <esp_gatts_api.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class BLECharacteristic;
+
+namespace host
+{
+  // Called when the firmware notifies a characteristic or drops a connection,
+  // so a host transport can pass it on to its clients.
+  inline void (*notified)(BLECharacteristic *characteristic) = nullptr;
+  inline void (*disconnected)(uint16_t connectionID) = nullptr;
+}
+
+class BLEUUID
+{
+public:
+  std::string value;
+
+  BLEUUID(const char *value) : value(value) {}
+};
+
+class BLEDescriptor
+{
+public:
+  BLEDescriptor(const char *) {}
+  BLEDescriptor(uint16_t) {}
+  virtual ~BLEDescriptor() {}
+
+  void setValue(const char *) {}
+};
+
+class BLECharacteristicCallbacks
+{
+public:
+  virtual ~BLECharacteristicCallbacks() {}
+  virtual void onRead(BLECharacteristic *) {}
+  virtual void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *) { this->onRead(pCharacteristic); }
+  virtual void onWrite(BLECharacteristic *) {}
+  virtual void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *) { this->onWrite(pCharacteristic); }
+  virtual void onNotify(BLECharacteristic *) {}
+};
+
+class BLECharacteristic
+{
+private:
+  std::string value;
+  BLECharacteristicCallbacks *callbacks = nullptr;
+
+public:
+  // Every characteristic in creation order; the attribute handle is the index + 1.
+  static std::vector<BLECharacteristic *> &handles()
+  {
+    static std::vector<BLECharacteristic *> handles;
+    return handles;
+  }
+
+  static BLECharacteristic *byHandle(uint16_t handle)
+  {
+    return handle >= 1 && handle <= handles().size() ? handles()[handle - 1] : nullptr;
+  }
+
+  std::string uuid;
+  uint32_t properties;
+  uint16_t handle;
+
+  static const uint32_t PROPERTY_READ = 1 << 0;
+  static const uint32_t PROPERTY_WRITE = 1 << 1;
+  static const uint32_t PROPERTY_NOTIFY = 1 << 2;
+  static const uint32_t PROPERTY_BROADCAST = 1 << 3;
+  static const uint32_t PROPERTY_INDICATE = 1 << 4;
+  static const uint32_t PROPERTY_WRITE_NR = 1 << 5;
+
+  uint32_t notifications = 0;
+
+  void setValue(const uint8_t *data, size_t length) { this->value.assign((const char *)data, length); }
+  void setValue(const String &value) { this->value.assign(value.c_str(), value.length()); }
+  void setValue(const char *value) { this->value = value; }
+  void setValue(uint16_t &value) { this->setValue((const uint8_t *)&value, sizeof(value)); }
+  void setValue(uint32_t &value) { this->setValue((const uint8_t *)&value, sizeof(value)); }
+  void setValue(int &value) { this->setValue((const uint8_t *)&value, sizeof(value)); }
+  void setValue(float &value) { this->setValue((const uint8_t *)&value, sizeof(value)); }
+  void setValue(double &value) { this->setValue((const uint8_t *)&value, sizeof(value)); }
+
+  String getValue() const { return String(this->value.data(), this->value.size()); }
+  uint8_t *getData() { return (uint8_t *)this->value.data(); }
+  size_t getLength() const { return this->value.size(); }
+  uint16_t getHandle() const { return this->handle; }
+
+  BLECharacteristic(const char *uuid, uint32_t properties) : uuid(uuid), properties(properties)
+  {
+    handles().push_back(this);
+    this->handle = handles().size();
+  }
+
+  void notify(bool = true)
+  {
+    this->notifications++;
+    if (host::notified)
+      host::notified(this);
+  }
+  void notify(const char *value)
+  {
+    this->setValue(value);
+    this->notify();
+  }
+  void indicate() { this->notify(); }
+
+  void setCallbacks(BLECharacteristicCallbacks *callbacks) { this->callbacks = callbacks; }
+  BLECharacteristicCallbacks *getCallbacks() const { return this->callbacks; }
+  void addDescriptor(BLEDescriptor *) {}
+};
+
+class BLEService
+{
+private:
+  std::map<std::string, BLECharacteristic *> characteristics;
+
+public:
+  BLECharacteristic *createCharacteristic(const char *uuid, uint32_t properties)
+  {
+    BLECharacteristic *&characteristic = this->characteristics[uuid];
+    if (!characteristic)
+      characteristic = new BLECharacteristic(uuid, properties);
+    return characteristic;
+  }
+
+  BLECharacteristic *getCharacteristic(const char *uuid)
+  {
+    auto it = this->characteristics.find(uuid);
+    return it == this->characteristics.end() ? nullptr : it->second;
+  }
+
+  void start() {}
+};
+
+#define ADVERTISING_PAYLOAD 31 // bytes in a legacy advertising or scan response packet
+
+// Keeps the fields the firmware sets and the length they take in the packet,
+// each as a length and type byte followed by the data.
+class BLEAdvertisementData
+{
+public:
+  std::string manufacturerData;
+  std::string name;
+  size_t length = 0;
+
+  void setFlags(uint8_t) { this->length += 3; }
+  void setName(const String &name) { this->addName(name); }
+  void setShortName(const String &name) { this->addName(name); }
+  void setManufacturerData(const String &data)
+  {
+    this->manufacturerData.assign(data.c_str(), data.length());
+    this->length += 2 + data.length();
+  }
+  void setCompleteServices(BLEUUID uuid) { this->length += 2 + (uuid.value.size() == 36 ? 16 : 2); }
+
+private:
+  void addName(const String &name)
+  {
+    this->name = name.c_str();
+    this->length += 2 + name.length();
+  }
+};
+
+class BLEAdvertising
+{
+public:
+  BLEAdvertisementData advertisement;
+  BLEAdvertisementData scanResponse;
+  bool advertising = false;
+
+  void addServiceUUID(const char *) {}
+  void setScanResponse(bool) {}
+  void setMinPreferred(uint16_t) {}
+  void setMaxPreferred(uint16_t) {}
+  uint32_t rejected = 0; // packets refused for not fitting ADVERTISING_PAYLOAD
+
+  // The controller refuses a packet that does not fit and keeps the old one.
+  void setAdvertisementData(BLEAdvertisementData &data) { this->accept(this->advertisement, data); }
+  void setScanResponseData(BLEAdvertisementData &data) { this->accept(this->scanResponse, data); }
+  void start() { this->advertising = true; }
+  void stop() { this->advertising = false; }
+
+private:
+  void accept(BLEAdvertisementData &current, const BLEAdvertisementData &data)
+  {
+    if (data.length > ADVERTISING_PAYLOAD)
+    {
+      fprintf(stderr, "advertising data of %zu bytes does not fit in %d\n", data.length, ADVERTISING_PAYLOAD);
+      this->rejected++;
+      return;
+    }
+    current = data;
+  }
+};
+
+class BLEServer;
+
+class BLEServerCallbacks
+{
+public:
+  virtual ~BLEServerCallbacks() {}
+  virtual void onConnect(BLEServer *) {}
+  virtual void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *) { this->onConnect(pServer); }
+  virtual void onDisconnect(BLEServer *) {}
+  virtual void onDisconnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *) { this->onDisconnect(pServer); }
+  virtual void onMtuChanged(BLEServer *, esp_ble_gatts_cb_param_t *) {}
+};
+
+class BLEServer
+{
+private:
+  std::map<std::string, BLEService *> services;
+  BLEServerCallbacks *callbacks = nullptr;
+  BLEAdvertising advertising;
+
+public:
+  uint16_t m_appId = 0;
+  uint32_t connected = 0;   // maintained by the host program
+  uint32_t disconnects = 0; // disconnect() requests from the firmware
+
+  BLEService *createService(const char *uuid) { return this->createService(BLEUUID(uuid), 15); }
+
+  BLEService *createService(BLEUUID uuid, uint32_t, uint8_t = 0)
+  {
+    BLEService *&service = this->services[uuid.value];
+    if (!service)
+      service = new BLEService();
+    return service;
+  }
+
+  BLEService *getServiceByUUID(const char *uuid)
+  {
+    auto it = this->services.find(uuid);
+    return it == this->services.end() ? nullptr : it->second;
+  }
+
+  // Host only: finds a characteristic in any service.
+  BLECharacteristic *findCharacteristic(const char *uuid)
+  {
+    for (auto &service : this->services)
+    {
+      if (BLECharacteristic *characteristic = service.second->getCharacteristic(uuid))
+        return characteristic;
+    }
+    return nullptr;
+  }
+
+  void setCallbacks(BLEServerCallbacks *callbacks) { this->callbacks = callbacks; }
+  BLEServerCallbacks *getCallbacks() const { return this->callbacks; }
+  BLEAdvertising *getAdvertising() { return &this->advertising; }
+  void startAdvertising() { this->advertising.start(); }
+  uint32_t getConnectedCount() const { return this->connected; }
+  void disconnect(uint16_t connectionID)
+  {
+    this->disconnects++;
+    if (host::disconnected)
+      host::disconnected(connectionID);
+  }
+  void updateConnParams(esp_bd_addr_t, uint16_t, uint16_t, uint16_t, uint16_t) {}
+  uint16_t getPeerMTU(uint16_t) const { return 517; }
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+// GATT-shaped messages over a stream socket, shared by the virtual device and
+// its clients.
+//
+// Every message is a 5-byte header (opcode, attribute handle and value length,
+// little endian) followed by the value. One socket is one connection.
+//
+// Addresses pick the transport: "unix:/path/to/socket" for a Unix domain
+// socket or "tcp:port" / "tcp:host:port" for TCP on loopback.
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string>
+
+enum GattOp : uint8_t
+{
+  GATT_DISCOVER = 'D',      // client: list characteristics; device: "handle uuid properties" lines
+  GATT_WRITE = 'W',         // client: write with response
+  GATT_WRITE_COMMAND = 'C', // client: write without response
+  GATT_WRITE_RESPONSE = 'A',
+  GATT_READ = 'R',
+  GATT_READ_RESPONSE = 'V',
+  GATT_NOTIFY = 'N',
+  GATT_STATS = 'S', // client: request device counters; device: text reply
+  GATT_FRAMES = 'F' // client: subscribe to shown frames; device: the strip bytes of each frame as it is shown
+};
+
+#define GATT_HEADER_SIZE 5
+
+struct GattMessage
+{
+  uint8_t op = 0;
+  uint16_t handle = 0;
+  std::string value;
+};
+
+namespace gatt
+{
+  inline bool sendAll(int fd, const void *data, size_t length)
+  {
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (length > 0)
+    {
+      ssize_t sent = send(fd, bytes, length, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR)
+        continue;
+      if (sent <= 0)
+        return false;
+      bytes += sent;
+      length -= sent;
+    }
+    return true;
+  }
+
+  inline bool send(int fd, uint8_t op, uint16_t handle, const void *value, size_t length)
+  {
+    uint8_t header[GATT_HEADER_SIZE] = {op, (uint8_t)handle, (uint8_t)(handle >> 8), (uint8_t)length, (uint8_t)(length >> 8)};
+    return sendAll(fd, header, sizeof(header)) && (length == 0 || sendAll(fd, value, length));
+  }
+
+  inline bool send(int fd, uint8_t op, uint16_t handle, const std::string &value = std::string())
+  {
+    return send(fd, op, handle, value.data(), value.size());
+  }
+
+  // Splits a byte stream into messages.
+  class Reader
+  {
+  private:
+    std::string buffer;
+
+  public:
+    // Reads what is available; false once the peer has closed.
+    bool fill(int fd)
+    {
+      char chunk[4096];
+      ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+      if (received < 0 && (errno == EINTR || errno == EAGAIN))
+        return true;
+      if (received <= 0)
+        return false;
+      this->buffer.append(chunk, received);
+      return true;
+    }
+
+    bool next(GattMessage &message)
+    {
+      if (this->buffer.size() < GATT_HEADER_SIZE)
+        return false;
+      const uint8_t *header = (const uint8_t *)this->buffer.data();
+      size_t length = header[3] | (header[4] << 8);
+      if (this->buffer.size() < GATT_HEADER_SIZE + length)
+        return false;
+
+      message.op = header[0];
+      message.handle = header[1] | (header[2] << 8);
+      message.value = this->buffer.substr(GATT_HEADER_SIZE, length);
+      this->buffer.erase(0, GATT_HEADER_SIZE + length);
+      return true;
+    }
+
+    // Blocks until a whole message arrives; false once the peer has closed.
+    bool receive(int fd, GattMessage &message)
+    {
+      while (!this->next(message))
+      {
+        if (!this->fill(fd))
+          return false;
+      }
+      return true;
+    }
+  };
+
+  inline int fail(int fd)
+  {
+    int error = errno;
+    close(fd);
+    errno = error;
+    return -1;
+  }
+
+  // Opens `address` for listening (server) or connects to it (client).
+  // Returns the socket, or -1 with errno set.
+  inline int open(const std::string &address, bool server)
+  {
+    int fd;
+
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+      sockaddr_un local = {};
+      local.sun_family = AF_UNIX;
+      std::string path = address.substr(5);
+      if (path.size() >= sizeof(local.sun_path))
+      {
+        errno = ENAMETOOLONG;
+        return -1;
+      }
+      memcpy(local.sun_path, path.c_str(), path.size());
+
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (server)
+      {
+        unlink(path.c_str());
+        if (bind(fd, (sockaddr *)&local, sizeof(local)) < 0 || listen(fd, 64) < 0)
+          return fail(fd);
+      }
+      else if (connect(fd, (sockaddr *)&local, sizeof(local)) < 0)
+        return fail(fd);
+      return fd;
+    }
+
+    if (address.compare(0, 4, "tcp:") == 0)
+    {
+      std::string rest = address.substr(4);
+      size_t colon = rest.rfind(':');
+      std::string hostName = colon == std::string::npos ? "127.0.0.1" : rest.substr(0, colon);
+      std::string port = colon == std::string::npos ? rest : rest.substr(colon + 1);
+
+      addrinfo hints = {};
+      hints.ai_family = AF_INET;
+      hints.ai_socktype = SOCK_STREAM;
+      addrinfo *info = nullptr;
+      if (getaddrinfo(hostName.c_str(), port.c_str(), &hints, &info) != 0)
+      {
+        errno = EINVAL;
+        return -1;
+      }
+
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+      int on = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      int result;
+      if (server)
+      {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        result = bind(fd, info->ai_addr, info->ai_addrlen) < 0 ? -1 : listen(fd, 64);
+      }
+      else
+      {
+        result = connect(fd, info->ai_addr, info->ai_addrlen);
+      }
+      freeaddrinfo(info);
+      if (result < 0)
+        return fail(fd);
+      return fd;
+    }
+
+    errno = EINVAL;
+    return -1;
+  }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+// Host build of the NVS-backed Preferences: an in-memory store that lives for
+// the length of the run, shared by every Preferences instance.
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class Preferences
+{
+private:
+  std::string prefix;
+
+  static std::map<std::string, std::vector<uint8_t>> &store()
+  {
+    static std::map<std::string, std::vector<uint8_t>> store;
+    return store;
+  }
+
+  std::vector<uint8_t> *find(const char *key)
+  {
+    auto it = store().find(this->prefix + key);
+    return it == store().end() ? nullptr : &it->second;
+  }
+
+  size_t put(const char *key, const void *value, size_t length)
+  {
+    const uint8_t *bytes = (const uint8_t *)value;
+    store()[this->prefix + key].assign(bytes, bytes + length);
+    return length;
+  }
+
+  template <typename T>
+  T get(const char *key, T defaultValue)
+  {
+    std::vector<uint8_t> *value = this->find(key);
+    if (!value || value->size() != sizeof(T))
+      return defaultValue;
+    T result;
+    memcpy(&result, value->data(), sizeof(T));
+    return result;
+  }
+
+public:
+  bool begin(const char *name, bool = false)
+  {
+    this->prefix = std::string(name) + "/";
+    return true;
+  }
+
+  void end() {}
+  bool isKey(const char *key) { return this->find(key) != nullptr; }
+  bool remove(const char *key) { return store().erase(this->prefix + key) > 0; }
+
+  bool clear()
+  {
+    for (auto it = store().begin(); it != store().end();)
+      it = it->first.compare(0, this->prefix.size(), this->prefix) == 0 ? store().erase(it) : std::next(it);
+    return true;
+  }
+
+  size_t putBytes(const char *key, const void *value, size_t length) { return this->put(key, value, length); }
+  size_t putUChar(const char *key, uint8_t value) { return this->put(key, &value, sizeof(value)); }
+  size_t putUShort(const char *key, uint16_t value) { return this->put(key, &value, sizeof(value)); }
+  size_t putUInt(const char *key, uint32_t value) { return this->put(key, &value, sizeof(value)); }
+
+  uint8_t getUChar(const char *key, uint8_t defaultValue = 0) { return this->get(key, defaultValue); }
+  uint16_t getUShort(const char *key, uint16_t defaultValue = 0) { return this->get(key, defaultValue); }
+  uint32_t getUInt(const char *key, uint32_t defaultValue = 0) { return this->get(key, defaultValue); }
+
+  size_t getBytesLength(const char *key)
+  {
+    std::vector<uint8_t> *value = this->find(key);
+    return value ? value->size() : 0;
+  }
+
+  size_t getBytes(const char *key, void *buffer, size_t length)
+  {
+    std::vector<uint8_t> *value = this->find(key);
+    if (!value || value->size() > length)
+      return 0;
+    memcpy(buffer, value->data(), value->size());
+    return value->size();
+  }
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+// The fields of the Bluedroid GATT server event parameters the firmware reads.
+
+#include <stdint.h>
+
+typedef uint8_t esp_bd_addr_t[6];
+typedef uint8_t esp_gatt_if_t;
+typedef int esp_err_t;
+
+#define ESP_GATT_IF_NONE 0xff
+
+typedef enum
+{
+  ESP_GATTS_CONNECT_EVT = 14,
+} esp_gatts_cb_event_t;
+
+typedef union
+{
+  struct
+  {
+    uint16_t conn_id;
+    esp_bd_addr_t remote_bda;
+  } connect;
+
+  struct
+  {
+    uint16_t conn_id;
+    esp_bd_addr_t remote_bda;
+    int reason;
+  } disconnect;
+
+  struct
+  {
+    uint16_t conn_id;
+    uint32_t trans_id;
+    esp_bd_addr_t bda;
+    uint16_t handle;
+    uint16_t offset;
+    bool need_rsp;
+    bool is_prep;
+    uint16_t len;
+    uint8_t *value;
+  } write;
+
+  struct
+  {
+    uint16_t conn_id;
+    uint32_t trans_id;
+    esp_bd_addr_t bda;
+    uint16_t handle;
+    uint16_t offset;
+    bool is_long;
+    bool need_rsp;
+  } read;
+} esp_ble_gatts_cb_param_t;
+
+namespace host
+{
+  // Called when the firmware notifies one connection directly, so a host
+  // transport can pass it on to that client only.
+  inline void (*indicated)(uint16_t connectionID, uint16_t handle, const uint8_t *value, uint16_t length) = nullptr;
+}
+
+inline esp_err_t esp_ble_gatts_send_indicate(esp_gatt_if_t, uint16_t conn_id, uint16_t attr_handle, uint16_t value_len,
+                                             uint8_t *value, bool)
+{
+  if (host::indicated)
+    host::indicated(conn_id, attr_handle, value, value_len);
+  return 0;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <esp_partition.h>
+
+typedef uint32_t esp_ota_handle_t;
+#define OTA_SIZE_UNKNOWN 0xffffffff
+#define OTA_WITH_SEQUENTIAL_WRITES 0xfffffffe
+
+namespace host
+{
+  inline const esp_partition_t *bootPartition = &partitions[0];
+  inline bool otaOpen = false;
+}
+
+inline const esp_partition_t *esp_ota_get_running_partition() { return &host::partitions[0]; }
+inline const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *) { return &host::partitions[1]; }
+
+inline esp_err_t esp_ota_begin(const esp_partition_t *partition, size_t, esp_ota_handle_t *handle)
+{
+  if (partition != &host::partitions[1])
+    return ESP_ERR_INVALID_ARG;
+  host::updateImage.clear();
+  host::otaOpen = true;
+  *handle = 1;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_ota_write(esp_ota_handle_t, const void *data, size_t size)
+{
+  if (!host::otaOpen || host::updateImage.size() + size > host::partitions[1].size)
+    return ESP_ERR_INVALID_SIZE;
+  host::updateImage.insert(host::updateImage.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_ota_end(esp_ota_handle_t)
+{
+  bool open = host::otaOpen;
+  host::otaOpen = false;
+  return open ? ESP_OK : ESP_FAIL;
+}
+
+inline esp_err_t esp_ota_abort(esp_ota_handle_t)
+{
+  host::otaOpen = false;
+  return ESP_OK;
+}
+
+inline esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+  host::bootPartition = partition;
+  return ESP_OK;
+}
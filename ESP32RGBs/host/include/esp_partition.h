@@ -0,0 +1,39 @@
+#pragma once
+
+// Host build of the two app partitions: the running one holds whatever image
+// the host loads into host::runningImage, the other receives OTA writes.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <vector>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_INVALID_ARG 0x102
+#define ESP_ERR_INVALID_SIZE 0x104
+
+typedef struct
+{
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+} esp_partition_t;
+
+namespace host
+{
+  inline std::vector<uint8_t> runningImage;
+  inline std::vector<uint8_t> updateImage;
+  inline const esp_partition_t partitions[2] = {{0x10000, 0x140000, "app0"}, {0x150000, 0x140000, "app1"}};
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t *partition, size_t offset, void *destination, size_t size)
+{
+  const std::vector<uint8_t> &image = partition == &host::partitions[0] ? host::runningImage : host::updateImage;
+  if (offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  for (size_t i = 0; i < size; i++)
+    ((uint8_t *)destination)[i] = offset + i < image.size() ? image[offset + i] : 0xFF;
+  return ESP_OK;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+namespace host
+{
+  inline unsigned restarts = 0;
+}
+
+// The host keeps running; callers can watch host::restarts.
+inline void esp_restart() { host::restarts++; }
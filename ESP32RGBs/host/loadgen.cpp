@@ -0,0 +1,285 @@
+// loadgen - many clients writing colours to a virtual device at once.
+//
+// Build and run from the project directory:
+//   g++ -std=gnu++17 -O2 -pthread -I host/include host/loadgen.cpp -o loadgen
+//   ./loadgen unix:/tmp/frame.sock [clients] [writes per second] [seconds]
+//   ./loadgen unix:/tmp/frame.sock --audio [beats per second] [seconds]
+//
+// Each client connects, authenticates and then writes a new colour with
+// response at the given rate, waiting for each write response before the
+// next. Reports acknowledged throughput, write latency percentiles, writes
+// that were never acknowledged, and the device's count of writes superseded
+// before a frame rendered them.
+//
+// --audio measures feature-to-photon latency instead. One client selects
+// audio_pulse, subscribes to the frames the device shows, and sends beat
+// packets to the audio characteristic without response. Each beat is timed
+// from the write to the first shown frame that brightens; the device holds
+// every packet for its playout delay first, so that delay is part of the total.
+
+#include <GattSocket.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+// Must match src/main.cpp.
+#define PASSWORD "ba1109ee-352f-4c22-9c67-b9c5350a2dc8"
+#define AUTHENTICATE_CHARACTERISTIC_UUID "e2ded851-c0dd-4dca-b607-2cb0631bc549"
+#define COLOR_CHARACTERISTIC_UUID "6cb02075-6a70-4f34-a51f-15120e7e1e2f"
+#define COLOR_PATTERN_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a664"
+#define AUDIO_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a668"
+#define AUDIO_PACKET_SIZE 13 // timestamp (4), flags (1), 8 bands
+#define AUDIO_BEAT 0x01
+#define AUDIO_PLAYOUT_DELAY 40 // milliseconds
+
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  struct Result
+  {
+    bool authenticated = false;
+    uint32_t sent = 0;
+    uint32_t acknowledged = 0;
+    uint32_t late = 0; // writes sent after their slot because the previous one was still pending
+    std::vector<uint32_t> latencies; // microseconds
+  };
+
+  // Returns the handle of `uuid` from a discovery reply, or 0.
+  uint16_t findHandle(const std::string &discovery, const char *uuid)
+  {
+    std::istringstream lines(discovery);
+    unsigned handle;
+    std::string found;
+    unsigned properties;
+    while (lines >> handle >> found >> properties)
+    {
+      if (found == uuid)
+        return handle;
+    }
+    return 0;
+  }
+
+  // Waits for a reply with opcode `op`, skipping notifications.
+  bool await(int fd, gatt::Reader &reader, uint8_t op, GattMessage &message)
+  {
+    while (reader.receive(fd, message))
+    {
+      if (message.op == op)
+        return true;
+    }
+    return false;
+  }
+
+  void client(const std::string &address, int index, double rate, Clock::time_point end, Result &result)
+  {
+    int fd = gatt::open(address, false);
+    if (fd < 0)
+      return;
+
+    timeval timeout = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    gatt::Reader reader;
+    GattMessage message;
+    gatt::send(fd, GATT_DISCOVER, 0);
+    if (!await(fd, reader, GATT_DISCOVER, message))
+    {
+      close(fd);
+      return;
+    }
+    uint16_t authenticate = findHandle(message.value, AUTHENTICATE_CHARACTERISTIC_UUID);
+    uint16_t color = findHandle(message.value, COLOR_CHARACTERISTIC_UUID);
+
+    gatt::send(fd, GATT_WRITE, authenticate, PASSWORD);
+    if (!await(fd, reader, GATT_WRITE_RESPONSE, message))
+    {
+      close(fd);
+      return;
+    }
+
+    // The device disconnects clients it has no session slot for, which shows
+    // up as the socket closing here.
+    result.authenticated = true;
+
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    auto next = Clock::now() + period * index / 64;
+    uint8_t value[3];
+    while (next < end)
+    {
+      std::this_thread::sleep_until(next);
+      auto sentAt = Clock::now();
+      if (sentAt - next > period)
+        result.late++;
+      next += period;
+
+      value[0] = result.sent * 7;
+      value[1] = index;
+      value[2] = result.sent >> 8;
+      result.sent++;
+      if (!gatt::send(fd, GATT_WRITE, color, value, sizeof(value)) || !await(fd, reader, GATT_WRITE_RESPONSE, message))
+        break;
+
+      result.acknowledged++;
+      result.latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sentAt).count());
+    }
+
+    close(fd);
+  }
+
+  double percentile(const std::vector<uint32_t> &sorted, double p)
+  {
+    return sorted.empty() ? 0.0 : sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))] / 1000.0;
+  }
+
+  int audioLatency(const std::string &address, double rate, double seconds)
+  {
+    int fd = gatt::open(address, false);
+    if (fd < 0)
+    {
+      fprintf(stderr, "%s: %s\n", address.c_str(), strerror(errno));
+      return 1;
+    }
+
+    timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    gatt::Reader reader;
+    GattMessage message;
+    gatt::send(fd, GATT_DISCOVER, 0);
+    if (!await(fd, reader, GATT_DISCOVER, message))
+      return 1;
+    uint16_t authenticate = findHandle(message.value, AUTHENTICATE_CHARACTERISTIC_UUID);
+    uint16_t color = findHandle(message.value, COLOR_CHARACTERISTIC_UUID);
+    uint16_t pattern = findHandle(message.value, COLOR_PATTERN_CHARACTERISTIC_UUID);
+    uint16_t audio = findHandle(message.value, AUDIO_CHARACTERISTIC_UUID);
+
+    const uint8_t white[3] = {255, 255, 255};
+    gatt::send(fd, GATT_WRITE, authenticate, PASSWORD);
+    if (!await(fd, reader, GATT_WRITE_RESPONSE, message))
+      return 1;
+    gatt::send(fd, GATT_WRITE, color, white, sizeof(white));
+    gatt::send(fd, GATT_WRITE, pattern, "audio_pulse");
+    gatt::send(fd, GATT_FRAMES, 0);
+
+    // let the first packet set the device's clock offset and the pulse die away
+    auto start = Clock::now();
+    auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    std::vector<uint32_t> latencies;
+    uint32_t sent = 0, missed = 0;
+    uint8_t previous = 255;
+
+    for (auto next = start + period; next < end; next += period)
+    {
+      // drain frames until the beat is due, tracking the current level
+      while (Clock::now() < next && reader.receive(fd, message))
+      {
+        if (message.op == GATT_FRAMES && !message.value.empty())
+          previous = message.value[0];
+      }
+
+      uint8_t packet[AUDIO_PACKET_SIZE] = {};
+      uint32_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count();
+      memcpy(packet, &timestamp, sizeof(timestamp));
+      packet[4] = AUDIO_BEAT;
+      auto sentAt = Clock::now();
+      gatt::send(fd, GATT_WRITE_COMMAND, audio, packet, sizeof(packet));
+      sent++;
+
+      bool seen = false;
+      while (!seen && Clock::now() < sentAt + period && reader.receive(fd, message))
+      {
+        if (message.op != GATT_FRAMES || message.value.empty())
+          continue;
+        uint8_t level = message.value[0];
+        if (level > previous && sent > 1)
+        {
+          latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - sentAt).count());
+          seen = true;
+        }
+        previous = level;
+      }
+      missed += !seen && sent > 1;
+    }
+    close(fd);
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%u beats at %.1f/s, %zu seen, %u missed (the first only syncs the clock)\n", sent, rate, latencies.size(), missed);
+    printf("feature-to-photon ms: p50 %.3f  p99 %.3f  max %.3f  (%d ms of it is the playout delay)\n",
+           percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 1.0), AUDIO_PLAYOUT_DELAY);
+    return 0;
+  }
+
+  std::string deviceStats(const std::string &address)
+  {
+    int fd = gatt::open(address, false);
+    if (fd < 0)
+      return "unavailable\n";
+
+    gatt::Reader reader;
+    GattMessage message;
+    gatt::send(fd, GATT_STATS, 0);
+    std::string stats = await(fd, reader, GATT_STATS, message) ? message.value : "unavailable\n";
+    close(fd);
+    return stats;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s <address> [clients] [writes per second] [seconds]\n"
+                    "       %s <address> --audio [beats per second] [seconds]\n", argv[0], argv[0]);
+    return 2;
+  }
+
+  std::string address = argv[1];
+  if (argc > 2 && strcmp(argv[2], "--audio") == 0)
+    return audioLatency(address, argc > 3 ? atof(argv[3]) : 4, argc > 4 ? atof(argv[4]) : 5);
+
+  int clients = argc > 2 ? atoi(argv[2]) : 24;
+  double rate = argc > 3 ? atof(argv[3]) : 50;
+  double seconds = argc > 4 ? atof(argv[4]) : 5;
+
+  std::string before = deviceStats(address);
+  std::vector<Result> results(clients);
+  std::vector<std::thread> threads;
+  auto start = Clock::now();
+  auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  for (int i = 0; i < clients; i++)
+    threads.emplace_back(client, address, i, rate, end, std::ref(results[i]));
+  for (std::thread &thread : threads)
+    thread.join();
+  double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+  uint32_t authenticated = 0, sent = 0, acknowledged = 0, late = 0;
+  std::vector<uint32_t> latencies;
+  for (const Result &result : results)
+  {
+    authenticated += result.authenticated;
+    sent += result.sent;
+    acknowledged += result.acknowledged;
+    late += result.late;
+    latencies.insert(latencies.end(), result.latencies.begin(), result.latencies.end());
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  printf("%d clients, %d authenticated, %.0f writes/s each for %.1f s\n", clients, authenticated, rate, elapsed);
+  printf("writes: %u sent, %u acknowledged (%.0f/s), %u unacknowledged, %u late\n",
+         sent, acknowledged, acknowledged / elapsed, sent - acknowledged, late);
+  printf("latency ms: p50 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n", percentile(latencies, 0.5), percentile(latencies, 0.99),
+         percentile(latencies, 0.999), percentile(latencies, 1.0));
+  printf("device before: %s", before.c_str());
+  printf("device after:  %s", deviceStats(address).c_str());
+  return 0;
+}
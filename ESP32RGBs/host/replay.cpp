@@ -0,0 +1,233 @@
+// replay - runs a captured command trace against the firmware on the host.
+//
+// Build and run from the project directory:
+//   g++ -std=gnu++17 -O2 -I host/include -I include host/replay.cpp -o replay
+//   ./replay trace.txt [-v]
+//
+// The trace is the text dumped by the device (send 'T' on the serial port, or
+// read the trace characteristic until it returns nothing); other serial
+// output mixed into the file is ignored.
+//
+// The firmware's own setup() and loop() run against the shims in
+// host/include, with a virtual clock advanced 1 ms per loop(). Each record is
+// delivered at its original time: connections and writes go through the same
+// callbacks the BLE stack would call. Authentication writes are redacted on
+// the device, so a redacted write is replayed as the correct password.
+//
+// For every write the time until the next frame is shown is reported as the
+// apply latency, and the device's frame hashes are compared with the host's
+// hash for the same frame number. Hashes only match for patterns that do not
+// draw on random() and for traces that start at boot.
+
+#include "../src/main.cpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+  struct Record
+  {
+    char kind;
+    unsigned long time;
+    unsigned connectionID;
+    unsigned characteristic;
+    unsigned length;
+    std::vector<uint8_t> payload;
+    unsigned long frame;
+    uint32_t hash;
+  };
+
+  struct Latency
+  {
+    unsigned count = 0;
+    unsigned long total = 0;
+    unsigned long worst = 0;
+  };
+
+  bool parse(const char *line, Record &record)
+  {
+    // the payload field is at most two hex digits per kept byte
+    static char writeFormat[32];
+    if (!writeFormat[0])
+      snprintf(writeFormat, sizeof(writeFormat), "W %%lu %%u %%u %%u %%%us", 2 * TRACE_PAYLOAD);
+    char hex[2 * TRACE_PAYLOAD + 1] = {};
+    record = Record();
+
+    if (sscanf(line, writeFormat, &record.time, &record.connectionID, &record.characteristic, &record.length, hex) >= 4)
+    {
+      record.kind = 'W';
+      for (size_t i = 0; hex[i] && hex[i + 1]; i += 2)
+      {
+        unsigned byte;
+        sscanf(hex + i, "%2x", &byte);
+        record.payload.push_back(byte);
+      }
+      return true;
+    }
+    if (sscanf(line, "F %lu %lu %x", &record.time, &record.frame, &record.hash) == 3)
+    {
+      record.kind = 'F';
+      return true;
+    }
+    if (sscanf(line, "C %lu %u", &record.time, &record.connectionID) == 2)
+    {
+      record.kind = 'C';
+      return true;
+    }
+    if (sscanf(line, "D %lu %u", &record.time, &record.connectionID) == 2)
+    {
+      record.kind = 'D';
+      return true;
+    }
+    return false;
+  }
+
+  void deliver(const Record &record)
+  {
+    esp_ble_gatts_cb_param_t param = {};
+    BLEServerCallbacks *server = pServer->getCallbacks();
+
+    switch (record.kind)
+    {
+    case 'C':
+      param.connect.conn_id = record.connectionID;
+      pServer->connected++;
+      server->onConnect(pServer, &param);
+      break;
+    case 'D':
+      param.disconnect.conn_id = record.connectionID;
+      pServer->connected--;
+      server->onDisconnect(pServer, &param);
+      break;
+    case 'W':
+    {
+      BLECharacteristic *characteristic = pServer->findCharacteristic(TRACED_CHARACTERISTICS[record.characteristic]);
+      if (record.characteristic == 0 && record.payload.empty())
+        characteristic->setValue(PASSWORD);
+      else
+        characteristic->setValue(record.payload.data(), record.payload.size());
+
+      param.write.conn_id = record.connectionID;
+      param.write.len = characteristic->getLength();
+      param.write.value = characteristic->getData();
+      characteristic->getCallbacks()->onWrite(characteristic, &param);
+      break;
+    }
+    }
+  }
+
+  // Runs the firmware loop until `until`, recording the hash of every frame.
+  void run(unsigned long until, std::map<uint32_t, uint32_t> &hashes)
+  {
+    while (millis() < until)
+    {
+      loop();
+      if (strip.frames != 0 && hashes.count(strip.frames) == 0)
+        hashes[strip.frames] = strip.hash();
+      host::clock += 1000;
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+  {
+    fprintf(stderr, "usage: %s <trace.txt> [-v]\n", argv[0]);
+    return 2;
+  }
+  host::echo = argc > 2 && strcmp(argv[2], "-v") == 0;
+
+  FILE *input = fopen(argv[1], "r");
+  if (!input)
+  {
+    fprintf(stderr, "%s: cannot open\n", argv[1]);
+    return 1;
+  }
+
+  std::vector<Record> records;
+  char line[256];
+  while (fgets(line, sizeof(line), input))
+  {
+    Record record;
+    if (parse(line, record))
+      records.push_back(record);
+  }
+  fclose(input);
+
+  setup();
+
+  std::map<uint32_t, uint32_t> hashes;
+  std::map<unsigned, Latency> latencies;
+  unsigned skipped = 0, matched = 0, mismatched = 0, unreached = 0;
+
+  for (size_t i = 0; i < records.size(); i++)
+  {
+    const Record &record = records[i];
+    run(record.time, hashes);
+
+    if (record.kind == 'F')
+    {
+      continue;
+    }
+
+    if (record.kind == 'W' && (record.characteristic >= TRACED_CHARACTERISTIC_COUNT || record.length != record.payload.size()) &&
+        !(record.characteristic == 0 && record.payload.empty()))
+    {
+      fprintf(stderr, "skipping write at %lu: %u of %u bytes captured\n", record.time, (unsigned)record.payload.size(), record.length);
+      skipped++;
+      continue;
+    }
+
+    uint32_t frame = strip.frames;
+    unsigned long applied = millis();
+    deliver(record);
+
+    if (record.kind == 'W')
+    {
+      // Writes followed by another record before any frame are not measured.
+      unsigned long limit = applied + 5000;
+      if (i + 1 < records.size())
+        limit = min(limit, max(applied, records[i + 1].time));
+      while (strip.frames == frame && millis() < limit)
+        run(millis() + 1, hashes);
+      if (strip.frames == frame)
+        continue;
+
+      Latency &latency = latencies[record.characteristic];
+      unsigned long elapsed = millis() - applied;
+      latency.count++;
+      latency.total += elapsed;
+      latency.worst = max(latency.worst, elapsed);
+    }
+  }
+
+  for (const Record &record : records)
+  {
+    if (record.kind != 'F')
+      continue;
+    auto it = hashes.find(record.frame);
+    if (it == hashes.end())
+      unreached++;
+    else if (it->second == record.hash)
+      matched++;
+    else
+    {
+      if (mismatched == 0)
+        printf("first mismatch at frame %lu (%lu ms): device %08x, host %08x\n", record.frame, record.time, record.hash, it->second);
+      mismatched++;
+    }
+  }
+
+  printf("%zu records, %u writes skipped, %u frames shown\n", records.size(), skipped, strip.frames);
+  printf("frame hashes: %u match, %u differ, %u not reached\n", matched, mismatched, unreached);
+  for (const auto &entry : latencies)
+  {
+    printf("%-48s %5u writes, apply latency mean %lu ms, worst %lu ms\n",
+           TRACED_CHARACTERISTICS[entry.first], entry.second.count, entry.second.total / entry.second.count, entry.second.worst);
+  }
+
+  return mismatched == 0 ? 0 : 1;
+}
@@ -0,0 +1,691 @@
+// test - checks of device behaviour that the host can reproduce exactly.
+//
+// Build and run from the project directory:
+//   g++ -std=gnu++17 -O2 -I host/include -I include host/test.cpp -o test
+//   ./test
+//
+// Prints one line per failed check and exits non-zero if there were any.
+//
+// `fade` draws a trail that fades by reading the previous frame back from the
+// strip, at a low output brightness, and checks the strip still holds the
+// full-scale trail and sends it scaled.
+//
+// `pixels` checks a frame copied in bulk with writePixels() reads back the
+// same through the strip's accessors, whatever its byte order.
+//
+// `timebase` checks steps are counted exactly at the shortest and a long
+// step length, and that program time stays non-negative across its wrap.
+//
+// `presets` loads a stored preset table holding records this firmware cannot
+// apply and checks they load as empty slots and cannot be recalled.
+//
+// `show` uploads a show and plays it through the show characteristic, and
+// checks neither reaches the render loop's playlist until a loop pass takes
+// it, that a second upload sent before then is refused, and that steps with
+// no interval or duration are refused.
+//
+// `recall` recalls a preset through the preset characteristic and checks its
+// settings only arrive from the render loop, and its notification from the
+// link pass after them.
+//
+// `rate` writes step lengths through the pattern rate characteristic and
+// checks they are applied exactly and read back as the same double,
+// including one that is not a whole number of milliseconds.
+//
+// `palette` uploads a gradient and checks the render loop's palette only
+// changes when a loop pass takes it.
+//
+// `auth` checks SHA-256 and HMAC-SHA-256 against the FIPS 180-2 and RFC 4231
+// vectors, then runs the challenge, a resume, a replayed resume and a wrong
+// response through the authenticate characteristic, checking a second
+// connection neither reads the challenge nor receives the ticket. Finally a
+// connection that never answers is dropped at its deadline, dropped again if
+// it lingers, and left alone once it closes.
+//
+// `advertising` checks the scan response carrying the device state fits in
+// its packet and is accepted.
+//
+// `ota` sends a signed delta through the OTA characteristic the way the app
+// does, running loop() in between, and checks the patched image is
+// installed; then that a delta with a bad MAC or made against another image
+// is refused.
+
+#include "../src/main.cpp"
+
+namespace
+{
+  int failures = 0;
+
+  void check(bool ok, const char *what)
+  {
+    if (!ok)
+    {
+      printf("FAIL %s\n", what);
+      failures++;
+    }
+  }
+
+  std::vector<uint8_t> sent;
+
+  // Notifications sent to a single connection, as (connection, handle, value).
+  struct Indication
+  {
+    uint16_t connectionID;
+    uint16_t handle;
+    std::string value;
+  };
+  std::vector<Indication> indications;
+
+  void recordIndication(uint16_t connectionID, uint16_t handle, const uint8_t *value, uint16_t length)
+  {
+    indications.push_back({connectionID, handle, std::string((const char *)value, length)});
+  }
+
+  // The last value notified to `connectionID` on `uuid`, or on any
+  // characteristic for nullptr.
+  std::string indicated(uint16_t connectionID, const char *uuid = nullptr)
+  {
+    uint16_t handle = uuid ? pServer->findCharacteristic(uuid)->handle : 0;
+    for (auto it = indications.rbegin(); it != indications.rend(); ++it)
+    {
+      if (it->connectionID == connectionID && (handle == 0 || it->handle == handle))
+        return it->value;
+    }
+    return "";
+  }
+
+  void open(uint16_t connectionID)
+  {
+    esp_ble_gatts_cb_param_t param = {};
+    param.connect.conn_id = connectionID;
+    pServer->connected++;
+    pServer->getCallbacks()->onConnect(pServer, &param);
+  }
+
+  void close(uint16_t connectionID)
+  {
+    esp_ble_gatts_cb_param_t param = {};
+    param.disconnect.conn_id = connectionID;
+    pServer->connected--;
+    pServer->getCallbacks()->onDisconnect(pServer, &param);
+  }
+
+  // Connects `connectionID` and authenticates it with the password.
+  void connect(uint16_t connectionID)
+  {
+    open(connectionID);
+
+    esp_ble_gatts_cb_param_t param = {};
+    BLECharacteristic *characteristic = pServer->findCharacteristic(AUTHENTICATE_CHARACTERISTIC_UUID);
+    characteristic->setValue(PASSWORD);
+    param.write.conn_id = connectionID;
+    characteristic->getCallbacks()->onWrite(characteristic, &param);
+  }
+
+  std::string read(const char *uuid, uint16_t connectionID)
+  {
+    BLECharacteristic *characteristic = pServer->findCharacteristic(uuid);
+    characteristic->setValue((const uint8_t *)"", 0);
+
+    esp_ble_gatts_cb_param_t param = {};
+    param.read.conn_id = connectionID;
+    characteristic->getCallbacks()->onRead(characteristic, &param);
+    return std::string((const char *)characteristic->getData(), characteristic->getLength());
+  }
+
+  void write(const char *uuid, uint16_t connectionID, const std::vector<uint8_t> &value)
+  {
+    BLECharacteristic *characteristic = pServer->findCharacteristic(uuid);
+    characteristic->setValue(value.data(), value.size());
+
+    esp_ble_gatts_cb_param_t param = {};
+    param.write.conn_id = connectionID;
+    param.write.len = characteristic->getLength();
+    param.write.value = characteristic->getData();
+    characteristic->getCallbacks()->onWrite(characteristic, &param);
+  }
+
+  void runLoop(int passes)
+  {
+    for (int i = 0; i < passes; i++)
+    {
+      host::clock += 1000;
+      loop();
+    }
+  }
+
+  void put32(std::vector<uint8_t> &out, uint32_t value)
+  {
+    for (int shift = 0; shift < 32; shift += 8)
+      out.push_back(value >> shift);
+  }
+
+  void testFade()
+  {
+    const uint8_t level = 24;
+    const uint16_t length = 16;
+    uint8_t trail[length] = {}; // the same trail in plain integers
+
+    host::frameShown = [](const uint8_t *pixels, uint16_t length)
+    { sent.assign(pixels, pixels + length); };
+
+    strip.clear();
+    strip.setOutputBrightness(level);
+    bool exact = true;
+    bool scaled = true;
+    for (uint16_t frame = 0; frame < 4 * length; frame++)
+    {
+      // each frame keeps 7/8 of the last one and lights a new head
+      for (uint16_t i = 0; i < length; i++)
+      {
+        uint8_t red = strip.getPixelColor(i) >> 16;
+        strip.setPixelColor(i, strip.Color(red * 7 / 8, 0, 0));
+        trail[i] = trail[i] * 7 / 8;
+      }
+      strip.setPixelColor(frame % length, strip.Color(255, 0, 0));
+      trail[frame % length] = 255;
+      strip.show();
+
+      for (uint16_t i = 0; i < length; i++)
+      {
+        exact &= (uint8_t)(strip.getPixelColor(i) >> 16) == trail[i];
+        scaled &= sent[i * 3 + 1] == (trail[i] * (level + 1)) >> 8; // GRB
+      }
+    }
+    strip.setOutputBrightness(255);
+    host::frameShown = nullptr;
+
+    check(exact, "fade: trail read back from the strip loses precision");
+    check(scaled, "fade: frame sent to the strip is not the trail scaled by the output brightness");
+
+    // the last head is pixel 15, so pixel 0 is the oldest part of the tail
+    uint8_t tail = strip.getPixelColor(0) >> 16;
+    check(tail > 0 && tail == trail[0], "fade: tail decayed to nothing");
+  }
+
+  void testPixels()
+  {
+    uint32_t frame[NUM_LEDS];
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+      frame[i] = (i * 0x010203u + 0x102030u) & 0xFFFFFF;
+
+    writePixels(strip, frame, NUM_LEDS);
+    bool same = true;
+    for (uint16_t i = 0; i < NUM_LEDS; i++)
+      same &= strip.getPixelColor(i) == frame[i];
+    check(same, "pixels: writePixels() and getPixelColor() disagree on byte order");
+  }
+
+  void testTimebase()
+  {
+    Timebase fast;
+    fast.setStep(1);
+    fast.advance(0);
+    fast.advance(123456);
+    check(fast.steps() == 123456 && fast.fraction8() == 0, "timebase: one-microsecond steps not counted");
+
+    Timebase slow;
+    slow.setStep(3000);
+    slow.advance(0);
+    for (unsigned long now = 5; now <= 9000000; now += 5)
+      slow.advance(now);
+    check(slow.steps() == 3000, "timebase: three-millisecond steps drift");
+
+    check(PatternVM::time(PATTERN_VM_TIME_PERIOD - 1, 0xFFFF) == 0x7FFFFFFF, "timebase: program time short of its wrap");
+    check(PatternVM::time(PATTERN_VM_TIME_PERIOD, 0) == 0, "timebase: program time does not wrap to 0");
+    check(PatternVM::time(3 * PATTERN_VM_TIME_PERIOD + 5, 0x8000) == 5 * PatternVM::ONE + 0x8000,
+          "timebase: program time wrong after several wraps");
+  }
+
+  void testPresets()
+  {
+    uint8_t records[MAX_PRESETS][PRESET_SIZE];
+    memset(records, PRESET_EMPTY, sizeof(records));
+    const uint8_t unknownPattern[PRESET_SIZE] = {200, 0, 255, 0, 0, 50, 0, 255};
+    const uint8_t noInterval[PRESET_SIZE] = {1, 0, 255, 0, 0, 0, 0, 255};
+    const uint8_t good[PRESET_SIZE] = {1, 0, 0, 0, 255, 40, 0, 128};
+    memcpy(records[0], unknownPattern, PRESET_SIZE);
+    memcpy(records[1], noInterval, PRESET_SIZE);
+    memcpy(records[2], good, PRESET_SIZE);
+
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, false);
+    preferences.putBytes("presets", records, sizeof(records));
+    preferences.end();
+
+    PresetStore presets;
+    presets.load();
+    check(!presets.isStored(0), "presets: record with an unknown pattern loaded");
+    check(!presets.isStored(1), "presets: record with no interval loaded");
+    check(presets.isStored(2), "presets: valid record not loaded");
+    check(!deviceSettings->recallPreset(0, unknownPattern), "presets: record with an unknown pattern recalled");
+    check(!presets.save(3, noInterval), "presets: record with no interval stored");
+  }
+
+  // The value last written or notified on `uuid`.
+  std::string reply(const char *uuid)
+  {
+    BLECharacteristic *characteristic = pServer->findCharacteristic(uuid);
+    return std::string((const char *)characteristic->getData(), characteristic->getLength());
+  }
+
+  void testShow()
+  {
+    const uint16_t connectionID = 2;
+    connect(connectionID);
+
+    const std::vector<uint8_t> upload = {SHOW_UPLOAD, 2,
+                                         1, 0, 255, 0, 0, 50, 0, 10, 0, 0, 0,
+                                         2, 0, 0, 0, 255, 40, 0, 10, 0, 0, 0};
+    uint16_t revision = deviceSettings->show.revision;
+    write(SHOW_CHARACTERISTIC_UUID, connectionID, upload);
+    check(reply(SHOW_CHARACTERISTIC_UUID) == "OK", "show: upload not stored");
+    check(deviceSettings->show.revision == revision && deviceSettings->show.count == 0,
+          "show: upload changed the playlist outside the render loop");
+    write(SHOW_CHARACTERISTIC_UUID, connectionID, upload);
+    check(reply(SHOW_CHARACTERISTIC_UUID) == "ERR", "show: upload accepted before the last was taken");
+    runLoop(1);
+
+    std::vector<uint8_t> noInterval = upload;
+    noInterval[2 + SHOW_STEP_SIZE + 5] = 0;
+    write(SHOW_CHARACTERISTIC_UUID, connectionID, noInterval);
+    check(reply(SHOW_CHARACTERISTIC_UUID) == "ERR", "show: step with no interval accepted");
+    std::vector<uint8_t> noDuration = upload;
+    noDuration[2 + 7] = 0;
+    write(SHOW_CHARACTERISTIC_UUID, connectionID, noDuration);
+    check(reply(SHOW_CHARACTERISTIC_UUID) == "ERR", "show: step with no duration accepted");
+
+    write(SHOW_CHARACTERISTIC_UUID, connectionID, {SHOW_PLAY});
+    check(reply(SHOW_CHARACTERISTIC_UUID) == "OK", "show: play refused");
+    check(!deviceSettings->show.playing, "show: play applied outside the render loop");
+    check(read(SHOW_CHARACTERISTIC_UUID, connectionID) == std::string("\x02\x01", 2), "show: state not read back");
+
+    runLoop(1);
+    check(deviceSettings->show.count == 2 && deviceSettings->show.playing, "show: not taken by the render loop");
+    check(deviceSettings->pattern == PATTERN_NAMES[1], "show: first step not entered");
+
+    write(SHOW_CHARACTERISTIC_UUID, connectionID, {SHOW_STOP});
+    runLoop(1);
+    check(!deviceSettings->show.playing, "show: stop not applied");
+    close(connectionID);
+  }
+
+  std::string presetNotified; // the preset notification, and the pattern shown when it was sent
+
+  void testRecall()
+  {
+    const uint16_t connectionID = 2;
+    connect(connectionID);
+    host::indicated = [](uint16_t connectionID, uint16_t handle, const uint8_t *value, uint16_t length)
+    {
+      recordIndication(connectionID, handle, value, length);
+      if (handle == pServer->findCharacteristic(PRESET_CHARACTERISTIC_UUID)->handle)
+        presetNotified = std::string((const char *)value, length) + deviceSettings->pattern.c_str();
+    };
+
+    const std::vector<uint8_t> store = {5, 1, 0, 0, 0, 255, 40, 0, 128};
+    write(PRESET_CHARACTERISTIC_UUID, connectionID, store);
+    check(reply(PRESET_CHARACTERISTIC_UUID) == "OK", "recall: preset not stored");
+    runLoop(1);
+
+    presetNotified.clear();
+    uint8_t brightness = deviceSettings->brightness;
+    write(PRESET_CHARACTERISTIC_UUID, connectionID, {5});
+    check(presetNotified.empty() && deviceSettings->brightness == brightness,
+          "recall: preset applied outside the render loop");
+
+    runLoop(1);
+    check(deviceSettings->pattern == PATTERN_NAMES[1] && deviceSettings->blue == 255 && deviceSettings->red == 0 &&
+              deviceSettings->interval == 40 && deviceSettings->brightness == 128,
+          "recall: preset not applied by the render loop");
+    check(presetNotified == std::string((const char *)store.data(), store.size()) + PATTERN_NAMES[1],
+          "recall: preset not notified after it was applied");
+
+    write(PRESET_CHARACTERISTIC_UUID, connectionID, {6});
+    check(reply(PRESET_CHARACTERISTIC_UUID) == "ERR", "recall: empty slot recalled");
+
+    host::indicated = recordIndication;
+    close(connectionID);
+  }
+
+  void testRate()
+  {
+    const uint16_t connectionID = 2;
+    connect(connectionID);
+
+    // 1.7 times the base interval is an 85 ms step, which the old whole
+    // millisecond readback could not tell from 85.4 ms.
+    double written = 1.7;
+    std::vector<uint8_t> value(sizeof(double));
+    memcpy(value.data(), &written, sizeof(double));
+    write(PATTERN_RATE_CHARACTERISTIC_UUID, connectionID, value);
+    runLoop(1);
+    check(deviceSettings->timebase.step() == 85000, "rate: step not applied by the render loop");
+
+    std::string readBack = read(PATTERN_RATE_CHARACTERISTIC_UUID, connectionID);
+    double rate = 0;
+    if (readBack.size() == sizeof(double))
+      memcpy(&rate, readBack.data(), sizeof(double));
+    check(rate == written, "rate: not read back in the format it was written");
+
+    written = 1.7084;
+    memcpy(value.data(), &written, sizeof(double));
+    write(PATTERN_RATE_CHARACTERISTIC_UUID, connectionID, value);
+    runLoop(1);
+    readBack = read(PATTERN_RATE_CHARACTERISTIC_UUID, connectionID);
+    memcpy(&rate, readBack.data(), sizeof(double));
+    check(rate == 85420 / 50000.0, "rate: sub-millisecond step not read back");
+
+    deviceSettings->setRate(50000);
+    close(connectionID);
+  }
+
+  void testPalette()
+  {
+    const uint16_t connectionID = 2;
+    connect(connectionID);
+
+    const std::vector<uint8_t> gradient = {0, 255, 0, 0, 128, 0, 255, 0, 255, 0, 0, 255};
+    uint16_t revision = deviceSettings->palettes.revision;
+    write(PALETTE_CHARACTERISTIC_UUID, connectionID, gradient);
+    check(reply(PALETTE_CHARACTERISTIC_UUID) == "OK", "palette: upload not stored");
+    check(deviceSettings->palettes.revision == revision && deviceSettings->palettes.gradient.count != 3,
+          "palette: upload changed the gradient outside the render loop");
+    check(read(PALETTE_CHARACTERISTIC_UUID, connectionID) == std::string((const char *)gradient.data(), gradient.size()),
+          "palette: upload not read back");
+
+    runLoop(1);
+    check(deviceSettings->palettes.revision != revision && deviceSettings->palettes.gradient.count == 3,
+          "palette: upload not taken by the render loop");
+
+    write(PALETTE_CHARACTERISTIC_UUID, connectionID, {0, 1, 2, 3});
+    check(reply(PALETTE_CHARACTERISTIC_UUID) == "ERR", "palette: single stop accepted");
+
+    close(connectionID);
+  }
+
+  std::string hex(const uint8_t *data, size_t length)
+  {
+    std::string out;
+    char digits[3];
+    for (size_t i = 0; i < length; i++)
+    {
+      snprintf(digits, sizeof(digits), "%02x", data[i]);
+      out += digits;
+    }
+    return out;
+  }
+
+  std::string sha256(const std::string &message)
+  {
+    Sha256 hash;
+    hash.update((const uint8_t *)message.data(), message.size());
+    uint8_t digest[SHA256_SIZE];
+    hash.finish(digest);
+    return hex(digest, SHA256_SIZE);
+  }
+
+  // HMAC over `message`, handed to hmacSha256() in three parts.
+  std::string hmac(const std::string &key, const std::string &message)
+  {
+    const uint8_t *data = (const uint8_t *)message.data();
+    size_t third = message.size() / 3;
+    uint8_t mac[SHA256_SIZE];
+    hmacSha256((const uint8_t *)key.data(), key.size(), data, third, data + third, third,
+               data + 2 * third, message.size() - 2 * third, mac);
+    return hex(mac, SHA256_SIZE);
+  }
+
+  // AUTH_RESUME for `ticket` (an AUTH_TICKET reply) under `key`.
+  std::vector<uint8_t> resumeMessage(const std::string &ticket, const uint8_t *key, uint32_t counter)
+  {
+    std::vector<uint8_t> message = {AUTH_RESUME};
+    message.insert(message.end(), ticket.begin() + 1, ticket.begin() + 1 + TICKET_ID_SIZE);
+    put32(message, counter);
+
+    static const uint8_t label[] = {'r', 'e', 's', 'u', 'm', 'e'};
+    uint8_t mac[SHA256_SIZE];
+    hmacSha256(key, SHA256_SIZE, label, sizeof(label), message.data() + 1, TICKET_ID_SIZE, message.data() + 1 + TICKET_ID_SIZE, 4, mac);
+    message.insert(message.end(), mac, mac + SHA256_SIZE);
+    return message;
+  }
+
+  void testAuth()
+  {
+    check(sha256("") == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855", "auth: SHA-256 of nothing");
+    check(sha256("abc") == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", "auth: SHA-256 of abc");
+    check(sha256("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq") ==
+              "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+          "auth: SHA-256 of two blocks");
+    check(sha256(std::string(1000000, 'a')) == "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0",
+          "auth: SHA-256 of a million a");
+    check(hmac(std::string(20, '\x0b'), "Hi There") == "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7",
+          "auth: HMAC RFC 4231 case 1");
+    check(hmac("Jefe", "what do ya want for nothing?") == "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843",
+          "auth: HMAC RFC 4231 case 2");
+    check(hmac(std::string(131, '\xaa'), "Test Using Larger Than Block-Size Key - Hash Key First") ==
+              "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54",
+          "auth: HMAC RFC 4231 case 6, key longer than a block");
+
+    // challenge and response, as the app would run them, with an
+    // authenticated connection alongside
+    const uint16_t bystander = 9;
+    connect(bystander);
+    const uint16_t first = 10;
+    open(first);
+    std::string challenge = read(AUTHENTICATE_CHARACTERISTIC_UUID, first);
+    check(challenge.size() == AUTH_NONCE_SIZE, "auth: no challenge for a pending connection");
+    check(read(AUTHENTICATE_CHARACTERISTIC_UUID, bystander).empty(), "auth: challenge read by another connection");
+
+    uint8_t nonce[AUTH_NONCE_SIZE];
+    for (uint8_t i = 0; i < AUTH_NONCE_SIZE; i++)
+      nonce[i] = i * 7;
+    std::vector<uint8_t> response = {AUTH_RESPONSE};
+    response.insert(response.end(), nonce, nonce + AUTH_NONCE_SIZE);
+    uint8_t mac[SHA256_SIZE];
+    hmacSha256((const uint8_t *)PASSWORD, strlen(PASSWORD), (const uint8_t *)challenge.data(), AUTH_NONCE_SIZE,
+               nonce, AUTH_NONCE_SIZE, nullptr, 0, mac);
+    response.insert(response.end(), mac, mac + SHA256_SIZE);
+    write(AUTHENTICATE_CHARACTERISTIC_UUID, first, response);
+    check(deviceSettings->isAuthenticated(first), "auth: correct response not accepted");
+
+    std::string ticket = indicated(first, AUTHENTICATE_CHARACTERISTIC_UUID);
+    check(ticket.size() == 1 + TICKET_ID_SIZE && ticket[0] == AUTH_TICKET, "auth: no ticket issued");
+    check(indicated(bystander, AUTHENTICATE_CHARACTERISTIC_UUID) == "OK", "auth: ticket sent to another connection");
+    close(bystander);
+
+    // the app derives the ticket key the same way
+    static const uint8_t label[] = {'t', 'i', 'c', 'k', 'e', 't'};
+    uint8_t key[SHA256_SIZE];
+    hmacSha256((const uint8_t *)PASSWORD, strlen(PASSWORD), label, sizeof(label),
+               (const uint8_t *)challenge.data(), AUTH_NONCE_SIZE, nonce, AUTH_NONCE_SIZE, key);
+
+    // resume on a new connection, then replay the same message on another
+    const uint16_t second = 11;
+    open(second);
+    write(AUTHENTICATE_CHARACTERISTIC_UUID, second, resumeMessage(ticket, key, 1));
+    check(deviceSettings->isAuthenticated(second), "auth: resume not accepted");
+
+    const uint16_t third = 12;
+    open(third);
+    write(AUTHENTICATE_CHARACTERISTIC_UUID, third, resumeMessage(ticket, key, 1));
+    check(!deviceSettings->isAuthenticated(third), "auth: replayed resume accepted");
+    check(indicated(third, AUTHENTICATE_CHARACTERISTIC_UUID) == "ERR", "auth: replayed resume not answered ERR");
+    write(AUTHENTICATE_CHARACTERISTIC_UUID, third, resumeMessage(ticket, key, 2));
+    check(deviceSettings->isAuthenticated(third), "auth: resume with a higher counter not accepted");
+
+    // a response to a challenge that was never read, and a wrong MAC
+    const uint16_t fourth = 13;
+    open(fourth);
+    uint32_t disconnects = pServer->disconnects;
+    write(AUTHENTICATE_CHARACTERISTIC_UUID, fourth, response);
+    check(!deviceSettings->isAuthenticated(fourth) && pServer->disconnects == disconnects + 1,
+          "auth: response without a challenge not refused");
+
+    const uint16_t fifth = 14;
+    open(fifth);
+    read(AUTHENTICATE_CHARACTERISTIC_UUID, fifth);
+    response.back() ^= 1;
+    write(AUTHENTICATE_CHARACTERISTIC_UUID, fifth, response);
+    check(!deviceSettings->isAuthenticated(fifth) && pServer->disconnects == disconnects + 2,
+          "auth: wrong response not refused");
+
+    // a connection that never answers is dropped at its deadline, and again
+    // after a while if the disconnect does not come back
+    const uint16_t sixth = 15;
+    open(sixth);
+    disconnects = pServer->disconnects;
+    host::clock += (uint64_t)AUTHENTICATION_TIMEOUT * 1000;
+    runLoop(2);
+    check(pServer->disconnects == disconnects + 1, "auth: connection not dropped at its deadline");
+    host::clock += (uint64_t)SESSION_EXPIRY_RETRY * 1000;
+    runLoop(1);
+    check(pServer->disconnects == disconnects + 2, "auth: expired connection not dropped again");
+    close(sixth);
+    host::clock += (uint64_t)SESSION_EXPIRY_RETRY * 1000;
+    runLoop(1);
+    check(pServer->disconnects == disconnects + 2, "auth: closed connection dropped");
+
+  }
+
+  void testAdvertising()
+  {
+    BLEAdvertising *advertising = pServer->getAdvertising();
+    check(advertising->rejected == 0, "advertising: packet refused for its length");
+    check(advertising->scanResponse.manufacturerData.size() == STATE_SIZE, "advertising: no state in the scan response");
+    check(advertising->scanResponse.length <= ADVERTISING_PAYLOAD, "advertising: scan response too long");
+  }
+
+  std::vector<uint8_t> otaReplies; // status bytes notified on the OTA characteristic
+
+  // A delta from `source` to `target` made of the given copies and inserts,
+  // with its header signed by `key`.
+  std::vector<uint8_t> makeDelta(const std::vector<uint8_t> &source, const std::vector<uint8_t> &target,
+                                 const std::vector<uint8_t> &operations, const char *key)
+  {
+    std::vector<uint8_t> delta = {'P', 'D', DELTA_VERSION, 0};
+    put32(delta, source.size());
+    put32(delta, crc32(0, source.data(), source.size()));
+    put32(delta, target.size());
+    put32(delta, crc32(0, target.data(), target.size()));
+
+    Sha256 hash;
+    hash.update(target.data(), target.size());
+    uint8_t digest[SHA256_SIZE];
+    uint8_t mac[SHA256_SIZE];
+    hash.finish(digest);
+    deltaMac((const uint8_t *)key, strlen(key), delta.data(), digest, mac);
+    delta.insert(delta.end(), mac, mac + SHA256_SIZE);
+    delta.insert(delta.end(), operations.begin(), operations.end());
+    return delta;
+  }
+
+  // Sends `delta` as the app does and returns the reply to OTA_COMMIT, or
+  // the reply that ended the transfer early.
+  uint8_t sendDelta(const std::vector<uint8_t> &delta, int &checkPasses)
+  {
+    const uint16_t connectionID = 1;
+    otaReplies.clear();
+
+    std::vector<uint8_t> begin = {OTA_BEGIN};
+    begin.insert(begin.end(), delta.begin(), delta.begin() + DELTA_HEADER_SIZE);
+    write(OTA_CHARACTERISTIC_UUID, connectionID, begin);
+    for (checkPasses = 0; otaReplies.empty() && checkPasses < 1000; checkPasses++)
+      runLoop(1);
+    if (otaReplies.empty() || otaReplies.back() != OTA_ACK)
+      return otaReplies.empty() ? 0xFF : otaReplies.back();
+
+    uint16_t sequence = 0;
+    for (size_t at = DELTA_HEADER_SIZE; at < delta.size(); at += 200, sequence++)
+    {
+      size_t length = std::min<size_t>(200, delta.size() - at);
+      std::vector<uint8_t> chunk = {OTA_DATA, (uint8_t)sequence, (uint8_t)(sequence >> 8)};
+      put32(chunk, crc32(0, delta.data() + at, length));
+      chunk.insert(chunk.end(), delta.begin() + at, delta.begin() + at + length);
+      write(OTA_CHARACTERISTIC_UUID, connectionID, chunk);
+      if (otaReplies.back() != OTA_ACK)
+        return otaReplies.back();
+    }
+
+    write(OTA_CHARACTERISTIC_UUID, connectionID, {OTA_COMMIT});
+    return otaReplies.back();
+  }
+
+  void testOta()
+  {
+    host::indicated = [](uint16_t connectionID, uint16_t handle, const uint8_t *value, uint16_t length)
+    {
+      recordIndication(connectionID, handle, value, length);
+      if (handle == pServer->findCharacteristic(OTA_CHARACTERISTIC_UUID)->handle && length > 0)
+        otaReplies.push_back(value[0]);
+    };
+    connect(1);
+
+    // a 100 KB image, and a new one with 1 KB changed and 500 bytes added
+    std::vector<uint8_t> source(100000);
+    for (uint8_t &byte : source)
+      byte = random(256);
+    std::vector<uint8_t> target = source;
+    for (size_t i = 40000; i < 41000; i++)
+      target[i] ^= 0x5A;
+    for (int i = 0; i < 500; i++)
+      target.push_back(i);
+
+    std::vector<uint8_t> operations = {DELTA_COPY};
+    put32(operations, 0);
+    put32(operations, 40000);
+    operations.push_back(DELTA_INSERT);
+    put32(operations, 1000);
+    operations.insert(operations.end(), target.begin() + 40000, target.begin() + 41000);
+    operations.push_back(DELTA_COPY);
+    put32(operations, 41000);
+    put32(operations, source.size() - 41000);
+    operations.push_back(DELTA_INSERT);
+    put32(operations, 500);
+    operations.insert(operations.end(), target.end() - 500, target.end());
+
+    host::runningImage = source;
+    int passes = 0;
+    uint8_t status = sendDelta(makeDelta(source, target, operations, OTA_KEY), passes);
+    check(status == OTA_DONE, "ota: signed delta was not installed");
+    check(host::updateImage == target, "ota: patched image differs from the target");
+    check(host::bootPartition == &host::partitions[1], "ota: new image not set to boot");
+    check(passes == (int)((source.size() + OTA_CHECK_STEP - 1) / OTA_CHECK_STEP),
+          "ota: source check not spread over link passes");
+    deviceSettings->restartAt = 0;
+
+    host::bootPartition = &host::partitions[0];
+    std::vector<uint8_t> forged = makeDelta(source, target, operations, "not the key");
+    status = sendDelta(forged, passes);
+    check(status == OTA_FAILED, "ota: delta with a bad MAC was not refused at commit");
+    check(host::bootPartition == &host::partitions[0], "ota: delta with a bad MAC was set to boot");
+
+    host::runningImage[1234] ^= 1;
+    status = sendDelta(makeDelta(source, target, operations, OTA_KEY), passes);
+    check(status == OTA_FAILED, "ota: delta against another image was not refused");
+    check(host::bootPartition == &host::partitions[0], "ota: delta against another image was set to boot");
+
+    host::indicated = recordIndication;
+  }
+}
+
+int main()
+{
+  setup();
+  host::indicated = recordIndication;
+
+  testFade();
+  testPixels();
+  testTimebase();
+  testPresets();
+  testShow();
+  testRecall();
+  testRate();
+  testPalette();
+  testAuth();
+  testAdvertising();
+  testOta();
+
+  printf("%s\n", failures == 0 ? "all passed" : "failed");
+  return failures == 0 ? 0 : 1;
+}
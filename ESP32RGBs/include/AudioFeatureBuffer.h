@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+#define AUDIO_BANDS 8
+#define AUDIO_BEAT 0x01
+#define AUDIO_PACKET_SIZE (5 + AUDIO_BANDS) // timestamp (4), flags (1), bands
+#define AUDIO_BUFFER_SIZE 16                // power of two
+#define AUDIO_PLAYOUT_DELAY 40              // milliseconds of jitter absorbed
+#define AUDIO_STALE_AFTER 1000              // milliseconds without packets
+
+struct AudioFeatures
+{
+  uint32_t timestamp; // sender clock, milliseconds
+  uint8_t flags;
+  uint8_t bands[AUDIO_BANDS]; // energy per band, low to high
+  unsigned long playAt;       // local millis() at which the features take effect
+};
+
+// Jitter buffer for audio features computed on the phone.
+//
+// Packets arrive in bursts over BLE, so each one is scheduled at its sender
+// timestamp mapped onto the local clock plus a fixed playout delay. The clock
+// offset tracks the fastest packet seen (the one with the least transport
+// delay) and relaxes slowly so sender clock drift is followed.
+//
+// push() is called from the BLE task and sample() from the render loop; the
+// ring is single-producer, single-consumer. The clock state push() keeps is
+// atomic too, since isLive() reads it from the render loop.
+class AudioFeatureBuffer
+{
+private:
+  AudioFeatures ring[AUDIO_BUFFER_SIZE];
+  std::atomic<uint8_t> head{0}; // next slot to write
+  std::atomic<uint8_t> tail{0}; // next slot to read
+
+  std::atomic<int32_t> offset{0};       // milliseconds from sender to local clock
+  std::atomic<bool> synced{false};
+  unsigned long lastRelax = 0;           // BLE task only
+  std::atomic<uint32_t> lastArrival{0};  // local millis() of the last packet
+
+  AudioFeatures current = {};
+
+public:
+  uint32_t dropped = 0;
+
+  // Parses one packet received at local time `arrival`. Returns false if the
+  // packet is malformed or the buffer is full.
+  bool push(const uint8_t *data, size_t length, unsigned long arrival)
+  {
+    if (length != AUDIO_PACKET_SIZE)
+    {
+      return false;
+    }
+
+    uint8_t h = this->head.load(std::memory_order_relaxed);
+    uint8_t next = (h + 1) & (AUDIO_BUFFER_SIZE - 1);
+    if (next == this->tail.load(std::memory_order_acquire))
+    {
+      this->dropped++;
+      return false;
+    }
+
+    AudioFeatures &features = this->ring[h];
+    features.timestamp = (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+    features.flags = data[4];
+    for (uint8_t i = 0; i < AUDIO_BANDS; i++)
+    {
+      features.bands[i] = data[5 + i];
+    }
+
+    int32_t delay = (int32_t)((uint32_t)arrival - features.timestamp);
+    int32_t offset = this->offset.load(std::memory_order_relaxed);
+    bool synced = this->synced.load(std::memory_order_relaxed);
+    if (!synced || delay < offset || (uint32_t)arrival - this->lastArrival.load(std::memory_order_relaxed) > AUDIO_STALE_AFTER)
+    {
+      offset = delay;
+      this->lastRelax = arrival;
+    }
+    else if (arrival - this->lastRelax >= 1000)
+    {
+      offset++;
+      this->lastRelax = arrival;
+    }
+
+    features.playAt = features.timestamp + offset + AUDIO_PLAYOUT_DELAY;
+    this->offset.store(offset, std::memory_order_relaxed);
+    this->lastArrival.store(arrival, std::memory_order_relaxed);
+    this->synced.store(true, std::memory_order_release);
+
+    this->head.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Plays out every packet that is due. Returns true if any of them carried a
+  // beat; `features` receives the most recent due packet.
+  bool sample(unsigned long now, AudioFeatures &features)
+  {
+    bool beat = false;
+    uint8_t t = this->tail.load(std::memory_order_relaxed);
+
+    while (t != this->head.load(std::memory_order_acquire))
+    {
+      const AudioFeatures &next = this->ring[t];
+      if ((long)(now - next.playAt) < 0)
+      {
+        break;
+      }
+
+      this->current = next;
+      beat |= (next.flags & AUDIO_BEAT) != 0;
+      t = (t + 1) & (AUDIO_BUFFER_SIZE - 1);
+    }
+
+    this->tail.store(t, std::memory_order_release);
+
+    if (!this->isLive(now))
+    {
+      for (uint8_t i = 0; i < AUDIO_BANDS; i++)
+      {
+        this->current.bands[i] = 0;
+      }
+    }
+
+    features = this->current;
+    return beat;
+  }
+
+  bool isLive(unsigned long now) const
+  {
+    return this->synced.load(std::memory_order_acquire) &&
+           (int32_t)((uint32_t)now - this->lastArrival.load(std::memory_order_relaxed)) < AUDIO_STALE_AFTER;
+  }
+};
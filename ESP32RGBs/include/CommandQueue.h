@@ -0,0 +1,112 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#define COMMAND_CAPACITY 32 // queued commands, power of two
+
+enum CommandField : uint8_t
+{
+  COMMAND_COLOR,      // value: 0x00RRGGBB
+  COMMAND_PATTERN,    // value: pattern ID
+  COMMAND_RATE,       // value: step length in microseconds
+  COMMAND_RAINBOW,    // value: 0 or 1
+  COMMAND_BRIGHTNESS, // value: 0-255
+  COMMAND_SHOW,       // value: 1 to play the stored show, 0 to stop it
+  COMMAND_PRESET,     // value: index of a recalled preset, notified once the fields above are applied
+  COMMAND_FIELDS
+};
+
+struct Command
+{
+  uint8_t field;
+  uint32_t value;
+  unsigned long applyAt; // millis() from which the command may be applied
+};
+
+// Setting changes handed from the BLE task to the render loop.
+//
+// The BLE task pushes each write as a small command and returns; the render
+// loop collects them once per pass and applies them there, so a setting never
+// changes halfway through a frame. The ring has one producer and one consumer
+// and needs no lock.
+//
+// On collection the newest command for each field replaces any older one
+// still held, so a burst of colour writes costs one change, and a command can
+// be held until its applyAt time to land on a chosen frame. A newer command
+// for the same field replaces a held one even if the held one was scheduled
+// and the newer one was not. Commands due in the same pass are applied in
+// field order.
+template <uint16_t Capacity>
+class CommandQueue
+{
+private:
+  Command ring[Capacity];
+  std::atomic<uint16_t> head{0}; // next slot to write, owned by the producer
+  std::atomic<uint16_t> tail{0}; // next slot to read, owned by the consumer
+
+  Command held[COMMAND_FIELDS];
+  bool holding[COMMAND_FIELDS] = {};
+
+public:
+  uint32_t coalesced = 0; // commands replaced before they were applied
+  std::atomic<uint32_t> dropped{0}; // pushes refused because the ring was full
+
+  // Producer side. Returns false if the ring is full.
+  bool push(uint8_t field, uint32_t value, unsigned long applyAt)
+  {
+    uint16_t head = this->head.load(std::memory_order_relaxed);
+    if ((uint16_t)(head - this->tail.load(std::memory_order_acquire)) >= Capacity)
+    {
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    Command &command = this->ring[head & (Capacity - 1)];
+    command.field = field;
+    command.value = value;
+    command.applyAt = applyAt;
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Producer side: how many pushes will fit.
+  uint16_t space() const
+  {
+    return Capacity - (uint16_t)(this->head.load(std::memory_order_relaxed) - this->tail.load(std::memory_order_acquire));
+  }
+
+  // Consumer side: moves everything pushed so far into the per-field slots.
+  void collect()
+  {
+    uint16_t tail = this->tail.load(std::memory_order_relaxed);
+    uint16_t head = this->head.load(std::memory_order_acquire);
+    for (; tail != head; tail++)
+    {
+      const Command &command = this->ring[tail & (Capacity - 1)];
+      if (command.field >= COMMAND_FIELDS)
+      {
+        continue;
+      }
+      if (this->holding[command.field])
+      {
+        this->coalesced++;
+      }
+      this->held[command.field] = command;
+      this->holding[command.field] = true;
+    }
+    this->tail.store(tail, std::memory_order_release);
+  }
+
+  // Consumer side: hands over the command held for `field` if it is due.
+  bool take(uint8_t field, unsigned long now, Command &command)
+  {
+    if (!this->holding[field] || (long)(now - this->held[field].applyAt) < 0)
+    {
+      return false;
+    }
+    command = this->held[field];
+    this->holding[field] = false;
+    return true;
+  }
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <Sha256.h>
+
+// Delta image format, little endian:
+//   header: 'P' 'D' version reserved, source size, source CRC-32,
+//           target size, target CRC-32, MAC (32)
+//   then operations until the target is complete:
+//     DELTA_COPY   [source offset u32, length u32]  bytes from the source image
+//     DELTA_INSERT [length u32, bytes...]           literal bytes
+//
+// The MAC is HMAC-SHA-256(key, first 20 header bytes | SHA-256 of the
+// target), so only a holder of the key can produce an image that installs.
+#define DELTA_VERSION 2
+#define DELTA_FIELDS_SIZE 20 // header bytes before the MAC
+#define DELTA_HEADER_SIZE (DELTA_FIELDS_SIZE + SHA256_SIZE)
+#define DELTA_COPY 0x00
+#define DELTA_INSERT 0x01
+#define DELTA_BUFFER 256 // bytes staged before each target write
+
+// CRC-32 (IEEE, as zlib) continued from `crc`; start from 0.
+inline uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+  static const uint32_t table[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++)
+  {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+inline uint32_t readLE32(const uint8_t *data)
+{
+  return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// The header MAC for a target whose SHA-256 is `digest`.
+inline void deltaMac(const uint8_t *key, size_t keyLength, const uint8_t *fields, const uint8_t *digest, uint8_t *mac)
+{
+  hmacSha256(key, keyLength, fields, DELTA_FIELDS_SIZE, digest, SHA256_SIZE, nullptr, 0, mac);
+}
+
+struct DeltaHeader
+{
+  uint32_t sourceSize;
+  uint32_t sourceCRC;
+  uint32_t targetSize;
+  uint32_t targetCRC;
+  uint8_t fields[DELTA_FIELDS_SIZE];
+  uint8_t mac[SHA256_SIZE];
+
+  bool parse(const uint8_t *data, size_t length)
+  {
+    if (length != DELTA_HEADER_SIZE || data[0] != 'P' || data[1] != 'D' || data[2] != DELTA_VERSION)
+    {
+      return false;
+    }
+    this->sourceSize = readLE32(data + 4);
+    this->sourceCRC = readLE32(data + 8);
+    this->targetSize = readLE32(data + 12);
+    this->targetCRC = readLE32(data + 16);
+    memcpy(this->fields, data, DELTA_FIELDS_SIZE);
+    memcpy(this->mac, data + DELTA_FIELDS_SIZE, SHA256_SIZE);
+    return true;
+  }
+};
+
+// Applies a delta as it streams in.
+//
+// Input can be split anywhere; only the operation being decoded and one
+// DELTA_BUFFER of output are held, so the target is never in RAM. Source bytes
+// are fetched and target bytes written through callbacks, which on the device
+// read the running partition and write the OTA partition.
+class DeltaPatcher
+{
+public:
+  typedef bool (*ReadSource)(void *context, uint32_t offset, uint8_t *data, size_t length);
+  typedef bool (*WriteTarget)(void *context, const uint8_t *data, size_t length);
+
+private:
+  enum State : uint8_t
+  {
+    OPCODE,
+    ARGUMENTS,
+    LITERAL,
+    FAILED
+  };
+
+  DeltaHeader header = {};
+  ReadSource read = nullptr;
+  WriteTarget write = nullptr;
+  void *context = nullptr;
+
+  State state = FAILED;
+  uint8_t opcode = 0;
+  uint8_t arguments[8];
+  uint8_t argumentsHeld = 0;
+  uint32_t remaining = 0; // literal bytes still to come
+
+  uint8_t buffer[DELTA_BUFFER];
+  uint16_t buffered = 0;
+  uint32_t produced = 0; // target bytes accepted, including buffered ones
+  uint32_t crc = 0;
+  Sha256 digest;
+
+  bool flush()
+  {
+    if (this->buffered == 0)
+    {
+      return true;
+    }
+    this->crc = crc32(this->crc, this->buffer, this->buffered);
+    this->digest.update(this->buffer, this->buffered);
+    bool ok = this->write(this->context, this->buffer, this->buffered);
+    this->buffered = 0;
+    return ok;
+  }
+
+  bool emit(const uint8_t *data, size_t length)
+  {
+    while (length > 0)
+    {
+      size_t room = DELTA_BUFFER - this->buffered;
+      size_t chunk = length < room ? length : room;
+      for (size_t i = 0; i < chunk; i++)
+      {
+        this->buffer[this->buffered + i] = data[i];
+      }
+      this->buffered += chunk;
+      this->produced += chunk;
+      data += chunk;
+      length -= chunk;
+      if (this->buffered == DELTA_BUFFER && !this->flush())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Copies straight from the source into the output buffer.
+  bool copy(uint32_t offset, uint32_t length)
+  {
+    while (length > 0)
+    {
+      if (this->buffered == DELTA_BUFFER && !this->flush())
+      {
+        return false;
+      }
+      uint32_t room = DELTA_BUFFER - this->buffered;
+      uint32_t chunk = length < room ? length : room;
+      if (!this->read(this->context, offset, this->buffer + this->buffered, chunk))
+      {
+        return false;
+      }
+      this->buffered += chunk;
+      this->produced += chunk;
+      offset += chunk;
+      length -= chunk;
+    }
+    return true;
+  }
+
+  bool execute()
+  {
+    if (this->opcode == DELTA_COPY)
+    {
+      uint32_t offset = readLE32(this->arguments);
+      uint32_t length = readLE32(this->arguments + 4);
+      if (offset > this->header.sourceSize || length > this->header.sourceSize - offset ||
+          length > this->header.targetSize - this->produced)
+      {
+        return false;
+      }
+      return this->copy(offset, length);
+    }
+
+    this->remaining = readLE32(this->arguments);
+    return this->remaining <= this->header.targetSize - this->produced;
+  }
+
+public:
+  void begin(const DeltaHeader &header, ReadSource read, WriteTarget write, void *context)
+  {
+    this->header = header;
+    this->read = read;
+    this->write = write;
+    this->context = context;
+    this->state = OPCODE;
+    this->remaining = 0;
+    this->buffered = 0;
+    this->produced = 0;
+    this->crc = 0;
+    this->digest = Sha256();
+  }
+
+  // Consumes the next piece of the delta. False once the delta is malformed
+  // or a callback fails; the patcher then rejects everything until begin().
+  bool feed(const uint8_t *data, size_t length)
+  {
+    size_t i = 0;
+    while (i < length && this->state != FAILED)
+    {
+      switch (this->state)
+      {
+      case OPCODE:
+        this->opcode = data[i++];
+        this->argumentsHeld = 0;
+        this->state = this->opcode == DELTA_COPY || this->opcode == DELTA_INSERT ? ARGUMENTS : FAILED;
+        break;
+
+      case ARGUMENTS:
+      {
+        uint8_t needed = this->opcode == DELTA_COPY ? 8 : 4;
+        while (i < length && this->argumentsHeld < needed)
+        {
+          this->arguments[this->argumentsHeld++] = data[i++];
+        }
+        if (this->argumentsHeld == needed)
+        {
+          if (!this->execute())
+            this->state = FAILED;
+          else
+            this->state = this->remaining > 0 ? LITERAL : OPCODE;
+        }
+        break;
+      }
+
+      case LITERAL:
+      {
+        size_t chunk = length - i < this->remaining ? length - i : this->remaining;
+        if (!this->emit(data + i, chunk))
+        {
+          this->state = FAILED;
+          break;
+        }
+        i += chunk;
+        this->remaining -= chunk;
+        if (this->remaining == 0)
+          this->state = OPCODE;
+        break;
+      }
+
+      case FAILED:
+        break;
+      }
+    }
+    return this->state != FAILED;
+  }
+
+  // Writes out what is buffered and checks the whole target against the
+  // header and the header's MAC under `key`. True only for a complete, intact
+  // image signed with that key.
+  bool finish(const uint8_t *key, size_t keyLength)
+  {
+    if (this->state != OPCODE || !this->flush())
+    {
+      this->state = FAILED;
+      return false;
+    }
+    if (this->produced != this->header.targetSize || this->crc != this->header.targetCRC)
+    {
+      return false;
+    }
+
+    uint8_t digest[SHA256_SIZE];
+    uint8_t mac[SHA256_SIZE];
+    this->digest.finish(digest);
+    deltaMac(key, keyLength, this->header.fields, digest, mac);
+    return macEqual(mac, this->header.mac, SHA256_SIZE);
+  }
+
+  uint32_t written() const
+  {
+    return this->produced;
+  }
+
+  uint32_t targetSize() const
+  {
+    return this->header.targetSize;
+  }
+};
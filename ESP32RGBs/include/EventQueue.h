@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// A fixed ring of small records handed from one task to another.
+//
+// One task pushes and one task pops; the indices are the only shared state,
+// so neither side takes a lock or waits. A push onto a full ring is refused
+// and counted rather than overwriting a record the consumer has not read.
+template <typename Event, uint16_t Capacity>
+class EventQueue
+{
+  static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+private:
+  Event ring[Capacity];
+  std::atomic<uint16_t> head{0}; // next slot to write, owned by the producer
+  std::atomic<uint16_t> tail{0}; // next slot to read, owned by the consumer
+
+public:
+  std::atomic<uint32_t> dropped{0}; // pushes refused because the ring was full
+
+  // Producer side. Returns false if the ring is full.
+  bool push(const Event &event)
+  {
+    uint16_t head = this->head.load(std::memory_order_relaxed);
+    if ((uint16_t)(head - this->tail.load(std::memory_order_acquire)) >= Capacity)
+    {
+      this->dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    this->ring[head & (Capacity - 1)] = event;
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Returns false if there is nothing to pop.
+  bool pop(Event &event)
+  {
+    uint16_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail == this->head.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+
+    event = this->ring[tail & (Capacity - 1)];
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+};
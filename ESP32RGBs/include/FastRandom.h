@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdint.h>
+
+// Small seeded generator for per-pixel randomness.
+//
+// Arduino's random() reads the hardware RNG, which stalls when called faster
+// than it gathers entropy, and reduces the result with a modulo. Patterns
+// that want a few random numbers per pixel per frame use this instead: a
+// xorshift32 step is three shifts and three XORs, and numbers in a range come
+// from the high half of a 32x32-bit multiply rather than a division. The
+// bias this leaves is below 1 in 2^24 for the ranges patterns use.
+//
+// The sequence depends only on the seed, so a pattern seeded with a constant
+// renders the same frames on every run, on the device and in the simulator.
+class FastRandom
+{
+private:
+  uint32_t state;
+
+public:
+  explicit FastRandom(uint32_t seed)
+  {
+    this->seed(seed);
+  }
+
+  void seed(uint32_t seed)
+  {
+    this->state = seed != 0 ? seed : 0x9E3779B9; // xorshift never leaves 0
+  }
+
+  uint32_t next()
+  {
+    uint32_t x = this->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    this->state = x;
+    return x;
+  }
+
+  // 0 to bound - 1.
+  uint32_t below(uint32_t bound)
+  {
+    return ((uint64_t)this->next() * bound) >> 32;
+  }
+
+  // low to high - 1, or low if the range is empty, as Arduino's random(low, high).
+  int32_t range(int32_t low, int32_t high)
+  {
+    return high <= low ? low : low + (int32_t)this->below((uint32_t)(high - low));
+  }
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <FrameStrip.h>
+
+// One cycle of a periodic pattern, stored as a palette index per pixel.
+//
+// A pattern that repeats every `period` frames renders each frame of its
+// first cycle into the cache and afterwards only replays it: one table read
+// per pixel instead of a sin() or ColorHSV(). Pixels are stored as 8-bit
+// levels looked up in a 256-entry palette, so a colour change only rebuilds
+// the palette, and rotating the index walks the palette without touching the
+// frames (a whole rainbow cycle fits in a single frame this way).
+//
+// Frames can be rendered in any order: a pattern that follows the timebase
+// seeks to the frame for the current time, skipping any it was too late for.
+//
+// Storage comes from the heap and is limited by the caller's budget; a
+// pattern whose cycle does not fit keeps rendering live.
+template <uint16_t Pixels>
+class FrameCache
+{
+private:
+  uint8_t *levels = nullptr;
+  uint32_t *ready = nullptr; // one bit per frame already rendered
+  uint16_t capacity = 0;     // frames allocated
+  uint16_t period = 0;       // frames in the cycle, 0 while unused
+  uint16_t cursor = 0;
+  uint32_t key = 0;
+  uint32_t paletteKey = 0;
+  bool paletteValid = false;
+  uint32_t palette[256];
+
+public:
+  ~FrameCache()
+  {
+    free(this->levels);
+    free(this->ready);
+  }
+
+  // Starts caching a cycle of `period` frames rendered with the settings
+  // summarised by `key`. Keeps the cached frames if neither changed. Returns
+  // false if the cycle would not fit in `budget` bytes.
+  bool prepare(uint16_t period, uint32_t key, size_t budget)
+  {
+    if (this->period != 0 && period == this->period && key == this->key)
+    {
+      return true;
+    }
+
+    this->period = 0;
+    this->cursor = 0;
+
+    size_t bytes = (size_t)period * Pixels;
+    if (period == 0 || bytes > budget)
+    {
+      return false;
+    }
+
+    if (period > this->capacity)
+    {
+      free(this->levels);
+      free(this->ready);
+      this->levels = (uint8_t *)malloc(bytes);
+      this->ready = (uint32_t *)malloc(((period + 31) / 32) * sizeof(uint32_t));
+      this->capacity = this->levels && this->ready ? period : 0;
+      if (this->capacity == 0)
+      {
+        return false;
+      }
+    }
+
+    memset(this->ready, 0, ((period + 31) / 32) * sizeof(uint32_t));
+    this->period = period;
+    this->key = key;
+    return true;
+  }
+
+  // Rebuilds the palette when `key` (usually the colour) changes.
+  template <typename Colour>
+  void setPalette(uint32_t key, Colour colour)
+  {
+    if (this->paletteValid && key == this->paletteKey)
+    {
+      return;
+    }
+    for (uint16_t level = 0; level < 256; level++)
+    {
+      this->palette[level] = colour(level);
+    }
+    this->paletteKey = key;
+    this->paletteValid = true;
+  }
+
+  // Position of the next frame in the cycle.
+  uint16_t frame() const
+  {
+    return this->cursor;
+  }
+
+  // Makes `frame` (less than the period) the next one.
+  void seek(uint16_t frame)
+  {
+    this->cursor = frame;
+  }
+
+  // True if the next frame has already been rendered into the cache.
+  bool cached() const
+  {
+    return this->ready[this->cursor / 32] & (1u << (this->cursor % 32));
+  }
+
+  // Levels of the next frame, for the pattern to fill when it is not cached.
+  uint8_t *frameLevels()
+  {
+    return this->levels + (size_t)this->cursor * Pixels;
+  }
+
+  // Writes the next frame to the strip through the palette, offset by
+  // `rotation`, and moves on to the following one.
+  void render(FrameStrip &strip, uint8_t rotation = 0)
+  {
+    const uint8_t *frame = this->frameLevels();
+    for (uint16_t i = 0; i < Pixels; i++)
+    {
+      strip.setPixelColor(i, this->palette[(uint8_t)(frame[i] + rotation)]);
+    }
+
+    this->ready[this->cursor / 32] |= 1u << (this->cursor % 32);
+    this->cursor = this->cursor + 1 == this->period ? 0 : this->cursor + 1;
+  }
+
+  size_t bytes() const
+  {
+    return (size_t)this->capacity * Pixels + ((this->capacity + 31) / 32) * sizeof(uint32_t) + sizeof(this->palette);
+  }
+};
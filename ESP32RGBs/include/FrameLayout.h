@@ -0,0 +1,156 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+struct PixelCoordinate
+{
+  uint8_t x;      // 0-255 across the longer side of the frame
+  uint8_t y;      // same scale as x, so shapes keep their aspect ratio
+  uint8_t angle;  // around the frame centre, 0 = right, clockwise, 256 = full turn
+  uint8_t radius; // distance from the frame centre, 255 = corner
+};
+
+// Per-pixel geometry for a strip laid around a rectangular picture frame.
+//
+// The lookup table is built once at boot, so the gradient kernels below are a
+// table read and at most a couple of multiplies per pixel, the same cost as
+// indexing by strip position.
+template <uint16_t Pixels>
+class FrameLayout
+{
+private:
+  PixelCoordinate lut[Pixels];
+  int16_t dx = 90; // direction of the linear gradient, cos * 90 (128 / sqrt 2)
+  int16_t dy = 0;
+  uint8_t heading = 0;
+  uint8_t centreX = 128;
+  uint8_t centreY = 128;
+  uint8_t inner = 0;   // smallest radius of any pixel
+  int32_t low = 0;     // smallest projection along the current direction
+  int32_t stretch = 0; // 255 / projection span, 16.16
+
+  int32_t project(uint16_t i) const
+  {
+    const PixelCoordinate &c = this->lut[i];
+    return (c.x - this->centreX) * this->dx + (c.y - this->centreY) * this->dy;
+  }
+
+  // Finds the span of projections along the current direction so linear()
+  // can spread it over 0-255.
+  void measure()
+  {
+    int32_t high = this->project(0);
+    this->low = high;
+    for (uint16_t i = 1; i < Pixels; i++)
+    {
+      int32_t projection = this->project(i);
+      this->low = projection < this->low ? projection : this->low;
+      high = projection > high ? projection : high;
+    }
+    // rounded up so the pixel furthest ahead lands on 255 rather than 254
+    int32_t span = high - this->low;
+    this->stretch = span > 0 ? ((255 << 16) + span - 1) / span : 0;
+  }
+
+public:
+  // Lays the strip clockwise around a frame `width` pixels across and
+  // `height` pixels tall, starting at the top-left corner and shifted by
+  // `start` pixels. Strips that do not exactly cover the perimeter are spread
+  // evenly over it.
+  void perimeter(uint16_t width, uint16_t height, uint16_t start, bool counterClockwise)
+  {
+    float w = width;
+    float h = height;
+    float total = 2 * (w + h);
+    float scale = 255.0f / (w > h ? w : h);
+    float maxRadius = sqrtf(w * w + h * h) / 2;
+    this->centreX = (uint8_t)lroundf(w / 2 * scale);
+    this->centreY = (uint8_t)lroundf(h / 2 * scale);
+    this->inner = 255;
+
+    for (uint16_t i = 0; i < Pixels; i++)
+    {
+      uint16_t index = counterClockwise ? (Pixels - i) % Pixels : i;
+      float p = fmodf((index + start + 0.5f) * total / Pixels, total);
+      float x, y;
+
+      if (p < w)
+      {
+        x = p;
+        y = 0;
+      }
+      else if (p < w + h)
+      {
+        x = w;
+        y = p - w;
+      }
+      else if (p < 2 * w + h)
+      {
+        x = w - (p - w - h);
+        y = h;
+      }
+      else
+      {
+        x = 0;
+        y = h - (p - 2 * w - h);
+      }
+
+      float cx = x - w / 2;
+      float cy = y - h / 2;
+      float turns = atan2f(cy, cx) / (2 * (float)M_PI);
+
+      PixelCoordinate &coordinate = this->lut[i];
+      coordinate.x = (uint8_t)lroundf(x * scale);
+      coordinate.y = (uint8_t)lroundf(y * scale);
+      coordinate.angle = (uint8_t)((int32_t)lroundf(turns * 256) & 0xFF);
+      coordinate.radius = (uint8_t)lroundf(sqrtf(cx * cx + cy * cy) / maxRadius * 255);
+      this->inner = coordinate.radius < this->inner ? coordinate.radius : this->inner;
+    }
+    this->measure();
+  }
+
+  const PixelCoordinate &at(uint16_t i) const
+  {
+    return this->lut[i];
+  }
+
+  // Sets the direction used by linear(), 0-255 for a full turn. Walks the
+  // table when the direction changes.
+  void direction(uint8_t angle)
+  {
+    if (angle == this->heading)
+    {
+      return;
+    }
+    float radians = angle * 2 * (float)M_PI / 256;
+    this->heading = angle;
+    this->dx = (int16_t)lroundf(cosf(radians) * 90);
+    this->dy = (int16_t)lroundf(sinf(radians) * 90);
+    this->measure();
+  }
+
+  // Position of pixel i along the current direction: 0 at the pixel furthest
+  // back, 255 at the one furthest ahead.
+  uint8_t linear(uint16_t i) const
+  {
+    return (uint8_t)(((this->project(i) - this->low) * this->stretch) >> 16);
+  }
+
+  // Distance of pixel i from the frame centre, from innerRadius() to 255.
+  uint8_t radial(uint16_t i) const
+  {
+    return this->lut[i].radius;
+  }
+
+  // The radius of the pixels nearest the centre; no pixel has a smaller one.
+  uint8_t innerRadius() const
+  {
+    return this->inner;
+  }
+
+  uint8_t angular(uint16_t i, uint8_t rotation) const
+  {
+    return this->lut[i].angle - rotation;
+  }
+};
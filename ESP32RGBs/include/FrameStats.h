@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// How long the render loop works on each frame it shows, against the time
+// between frames, so the headroom a build leaves can be read off the device.
+//
+// A frame's cost runs from the start of the loop pass that showed it to the
+// end of that pass, so it includes any time the pass lost to other tasks on
+// the same core. Figures cover the frames since the last reset().
+class FrameStats
+{
+private:
+  uint32_t frames = 0;
+  uint64_t busy = 0;    // microseconds
+  uint64_t elapsed = 0; // microseconds
+  uint32_t worst = 0;
+  unsigned long lastFrame = 0;
+  bool started = false;
+
+public:
+  // Records a frame shown by a loop pass that ran from `start` to `end`
+  // (micros() readings).
+  void record(unsigned long start, unsigned long end)
+  {
+    if (this->started)
+    {
+      uint32_t cost = end - start;
+      this->frames++;
+      this->busy += cost;
+      this->elapsed += end - this->lastFrame;
+      if (cost > this->worst)
+      {
+        this->worst = cost;
+      }
+    }
+    this->started = true;
+    this->lastFrame = end;
+  }
+
+  void reset()
+  {
+    this->frames = 0;
+    this->busy = 0;
+    this->elapsed = 0;
+    this->worst = 0;
+  }
+
+  // "frames <n> busy <average us> worst <us> period <average us> load <percent>"
+  size_t format(char *out, size_t capacity) const
+  {
+    uint32_t average = this->frames > 0 ? this->busy / this->frames : 0;
+    uint32_t period = this->frames > 0 ? this->elapsed / this->frames : 0;
+    uint32_t load = this->elapsed > 0 ? this->busy * 100 / this->elapsed : 0;
+    int length = snprintf(out, capacity, "frames %lu busy %lu worst %lu period %lu load %lu%%\n",
+                          (unsigned long)this->frames, (unsigned long)average, (unsigned long)this->worst,
+                          (unsigned long)period, (unsigned long)load);
+    return length > 0 && (size_t)length < capacity ? length : 0;
+  }
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Adafruit_NeoPixel.h>
+#include <string.h>
+
+// NeoPixel strip whose global brightness is applied only while a frame is
+// being sent.
+//
+// Adafruit_NeoPixel::setBrightness() rescales the pixel buffer in place, so
+// patterns that build on the previous frame read back values that lose
+// precision every time. Here the buffer always holds full-scale colours:
+// show() scales a copy on the way out and restores the original afterwards.
+//
+// The library's show() is not virtual, so the strip is not handed out as an
+// Adafruit_NeoPixel: code holding a base reference would send the buffer
+// unscaled. Helpers that write to the strip take a FrameStrip instead.
+class FrameStrip : protected Adafruit_NeoPixel
+{
+private:
+  uint8_t level = 255;
+  uint8_t *shadow;
+
+public:
+  uint32_t frames = 0; // frames shown since boot
+
+  using Adafruit_NeoPixel::Color;
+  using Adafruit_NeoPixel::ColorHSV;
+  using Adafruit_NeoPixel::begin;
+  using Adafruit_NeoPixel::clear;
+  using Adafruit_NeoPixel::fill;
+  using Adafruit_NeoPixel::getPixelColor;
+  using Adafruit_NeoPixel::getPixels;
+  using Adafruit_NeoPixel::numPixels;
+  using Adafruit_NeoPixel::setPixelColor;
+
+  FrameStrip(uint16_t n, int16_t pin, neoPixelType type) : Adafruit_NeoPixel(n, pin, type)
+  {
+    this->shadow = new uint8_t[this->numBytes];
+  }
+
+  void setOutputBrightness(uint8_t level)
+  {
+    this->level = level;
+  }
+
+  uint8_t outputBrightness() const
+  {
+    return this->level;
+  }
+
+  // Where each channel sits within a pixel's three bytes.
+  uint8_t redOffset() const
+  {
+    return this->rOffset;
+  }
+
+  uint8_t greenOffset() const
+  {
+    return this->gOffset;
+  }
+
+  uint8_t blueOffset() const
+  {
+    return this->bOffset;
+  }
+
+  // FNV-1a over the full-scale pixel buffer.
+  uint32_t hash() const
+  {
+    uint32_t hash = 2166136261u;
+    for (uint16_t i = 0; i < this->numBytes; i++)
+    {
+      hash = (hash ^ this->pixels[i]) * 16777619u;
+    }
+    return hash;
+  }
+
+  void show()
+  {
+    this->frames++;
+
+    if (this->level == 255)
+    {
+      Adafruit_NeoPixel::show();
+      return;
+    }
+
+    memcpy(this->shadow, this->pixels, this->numBytes);
+
+    uint16_t scale = this->level + 1;
+    for (uint16_t i = 0; i < this->numBytes; i++)
+    {
+      this->pixels[i] = (this->pixels[i] * scale) >> 8;
+    }
+
+    Adafruit_NeoPixel::show();
+    memcpy(this->pixels, this->shadow, this->numBytes);
+  }
+};
@@ -0,0 +1,220 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <EventQueue.h>
+
+#define LINK_WINDOW 500      // milliseconds over which the write rate is measured
+#define LINK_FAST_WRITES 5   // writes in one window that make a link fast (10 per second)
+#define LINK_QUIET_WRITES 1  // writes in one window still counted as quiet
+#define LINK_IDLE_WINDOWS 4  // quiet windows in a row before a link is relaxed
+#define LINK_EVENTS 16       // opens and closes waiting for the next collect(), power of two
+
+enum class LinkMode : uint8_t
+{
+  Default, // whatever the central picked when it connected
+  Fast,
+  Idle
+};
+
+struct Link
+{
+  uint16_t connectionID;
+  bool used;
+  LinkMode mode;
+  uint8_t quietWindows;
+  uint16_t rate; // writes per second over the last window
+  uint8_t address[6];
+  std::atomic<uint16_t> key{0};    // connectionID + 1 while used, 0 when free; for the BLE task to find the link by
+  std::atomic<uint16_t> writes{0}; // in the current window; counted by the BLE task
+};
+
+struct LinkEvent
+{
+  uint16_t connectionID;
+  bool opened; // false for a close
+  uint8_t address[6];
+};
+
+// Per-connection write rate, for choosing BLE connection parameters.
+//
+// A client streaming colours or audio wants a short connection interval so
+// each write lands within a frame; a client that is only connected wants a
+// long one with slave latency so the radio can sleep between events. Writes
+// are counted as they arrive, and once per window the render loop looks at
+// the counts: a busy link is switched to fast straight away, and a link is
+// relaxed to idle only after several quiet windows in a row, so a pause
+// between two bursts does not bounce it back and forth.
+//
+// The table belongs to the task that calls collect() and review(). The BLE
+// task only posts opens and closes, which collect() applies, and counts
+// writes into the link it finds by its published key. A write that races a
+// close is counted against a link about to go, which does no harm.
+template <uint8_t Capacity>
+class LinkTable
+{
+private:
+  Link links[Capacity];
+  EventQueue<LinkEvent, LINK_EVENTS> events;
+  unsigned long windowStart = 0;
+
+  Link *find(uint16_t connectionID)
+  {
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      if (this->links[i].used && this->links[i].connectionID == connectionID)
+      {
+        return &this->links[i];
+      }
+    }
+    return nullptr;
+  }
+
+  void add(const LinkEvent &event)
+  {
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      Link &link = this->links[i];
+      if (!link.used)
+      {
+        link.connectionID = event.connectionID;
+        link.mode = LinkMode::Default;
+        link.quietWindows = 0;
+        link.rate = 0;
+        memcpy(link.address, event.address, sizeof(link.address));
+        link.writes.store(0, std::memory_order_relaxed);
+        link.used = true;
+        link.key.store(event.connectionID + 1, std::memory_order_release);
+        return;
+      }
+    }
+  }
+
+  void remove(uint16_t connectionID)
+  {
+    Link *link = this->find(connectionID);
+    if (link != nullptr)
+    {
+      link->key.store(0, std::memory_order_release);
+      link->used = false;
+    }
+  }
+
+public:
+  LinkTable()
+  {
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      this->links[i].used = false;
+    }
+  }
+
+  static uint8_t capacity()
+  {
+    return Capacity;
+  }
+
+  const Link &at(uint8_t index) const
+  {
+    return this->links[index];
+  }
+
+  // BLE task.
+  void open(uint16_t connectionID, const uint8_t *address)
+  {
+    LinkEvent event = {connectionID, true, {}};
+    memcpy(event.address, address, sizeof(event.address));
+    this->events.push(event);
+  }
+
+  // BLE task.
+  void close(uint16_t connectionID)
+  {
+    this->events.push(LinkEvent{connectionID, false, {}});
+  }
+
+  // BLE task.
+  void write(uint16_t connectionID)
+  {
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      Link &link = this->links[i];
+      if (link.key.load(std::memory_order_acquire) == (uint16_t)(connectionID + 1))
+      {
+        link.writes.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+    }
+  }
+
+  // Links in use, as of the last collect().
+  uint8_t count() const
+  {
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      count += this->links[i].used ? 1 : 0;
+    }
+    return count;
+  }
+
+  // Applies the opens and closes posted since the last call.
+  void collect()
+  {
+    LinkEvent event;
+    while (this->events.pop(event))
+    {
+      if (event.opened)
+      {
+        this->add(event);
+      }
+      else
+      {
+        this->remove(event.connectionID);
+      }
+    }
+  }
+
+  // Closes the measurement window once it has run its length and calls
+  // `retune(link)` for every link whose mode changed.
+  template <typename Retune>
+  void review(unsigned long now, Retune retune)
+  {
+    if (now - this->windowStart < LINK_WINDOW)
+    {
+      return;
+    }
+    unsigned long elapsed = now - this->windowStart;
+    this->windowStart = now;
+
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      Link &link = this->links[i];
+      if (!link.used)
+      {
+        continue;
+      }
+
+      uint16_t writes = link.writes.exchange(0, std::memory_order_relaxed);
+      link.rate = (uint32_t)writes * 1000 / elapsed;
+      link.quietWindows = writes <= LINK_QUIET_WRITES ? (link.quietWindows < 255 ? link.quietWindows + 1 : 255) : 0;
+
+      LinkMode mode = link.mode;
+      if (writes >= LINK_FAST_WRITES)
+      {
+        mode = LinkMode::Fast;
+      }
+      else if (link.quietWindows >= LINK_IDLE_WINDOWS)
+      {
+        mode = LinkMode::Idle;
+      }
+
+      if (mode != link.mode)
+      {
+        link.mode = mode;
+        retune(link);
+      }
+    }
+  }
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+// An uploaded blob handed from the BLE task to the render loop.
+//
+// The BLE task posts a whole message and returns; the render loop takes it
+// between frames and copies it into the state it owns, so a pattern never
+// sees a program, show or palette half written. Only one message is held at
+// a time: a post made before the last one was taken is refused, and the
+// client retries. The render loop takes a message within one pass, so that
+// only happens to uploads sent back to back.
+//
+// The producer may read back the last message it posted at any time; the
+// consumer only ever reads the buffer too, and the producer only writes it
+// once the consumer is done.
+template <size_t Capacity>
+class Mailbox
+{
+private:
+  uint8_t buffer[Capacity];
+  size_t length = 0;
+  std::atomic<bool> full{false};
+
+public:
+  // Producer side. Returns false if the last message has not been taken yet
+  // or this one does not fit.
+  bool post(const uint8_t *message, size_t messageLength)
+  {
+    if (messageLength > Capacity || this->full.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+
+    memcpy(this->buffer, message, messageLength);
+    this->length = messageLength;
+    this->full.store(true, std::memory_order_release);
+    return true;
+  }
+
+  // Producer side: the last message posted, whether or not it was taken.
+  const uint8_t *data() const
+  {
+    return this->buffer;
+  }
+
+  size_t size() const
+  {
+    return this->length;
+  }
+
+  // Consumer side: copies out the waiting message, if there is one.
+  bool take(uint8_t *message, size_t &messageLength)
+  {
+    if (!this->full.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+
+    memcpy(message, this->buffer, this->length);
+    messageLength = this->length;
+    this->full.store(false, std::memory_order_release);
+    return true;
+  }
+};
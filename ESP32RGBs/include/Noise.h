@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+
+// Gradient (Perlin) noise in integer arithmetic.
+//
+// Coordinates are 24.8 fixed point: the high bits pick a lattice cell, the low
+// byte is the position inside it. Each lattice point gets a pseudo-random
+// gradient from a 256-entry permutation table, and the value at a point
+// blends the gradients of the surrounding corners with a smoothstep curve, so
+// neighbouring pixels and neighbouring frames get similar values and the field
+// changes smoothly in space and time. Everything is table lookups, adds and
+// small multiplies; there is no floating point.
+//
+// Results are 0-255 with 128 in the middle; most values fall within about
+// ±100 of it. The field repeats every 256 cells along each axis, so a
+// coordinate that wraps around 2^32 continues without a seam.
+
+namespace noise
+{
+  // Ken Perlin's reference permutation.
+  static const uint8_t PERMUTATION[256] = {
+      151, 160, 137, 91, 90, 15, 131, 13, 201, 95, 96, 53, 194, 233, 7, 225,
+      140, 36, 103, 30, 69, 142, 8, 99, 37, 240, 21, 10, 23, 190, 6, 148,
+      247, 120, 234, 75, 0, 26, 197, 62, 94, 252, 219, 203, 117, 35, 11, 32,
+      57, 177, 33, 88, 237, 149, 56, 87, 174, 20, 125, 136, 171, 168, 68, 175,
+      74, 165, 71, 134, 139, 48, 27, 166, 77, 146, 158, 231, 83, 111, 229, 122,
+      60, 211, 133, 230, 220, 105, 92, 41, 55, 46, 245, 40, 244, 102, 143, 54,
+      65, 25, 63, 161, 1, 216, 80, 73, 209, 76, 132, 187, 208, 89, 18, 169,
+      200, 196, 135, 130, 116, 188, 159, 86, 164, 100, 109, 198, 173, 186, 3, 64,
+      52, 217, 226, 250, 124, 123, 5, 202, 38, 147, 118, 126, 255, 82, 85, 212,
+      207, 206, 59, 227, 47, 16, 58, 17, 182, 189, 28, 42, 223, 183, 170, 213,
+      119, 248, 152, 2, 44, 154, 163, 70, 221, 153, 101, 155, 167, 43, 172, 9,
+      129, 22, 39, 253, 19, 98, 108, 110, 79, 113, 224, 232, 178, 185, 112, 104,
+      218, 246, 97, 228, 251, 34, 242, 193, 238, 210, 144, 12, 191, 179, 162, 241,
+      81, 51, 145, 235, 249, 14, 239, 107, 49, 192, 214, 31, 181, 199, 106, 157,
+      184, 84, 204, 176, 115, 121, 50, 45, 127, 4, 150, 254, 138, 236, 205, 93,
+      222, 114, 67, 29, 24, 72, 243, 141, 128, 195, 78, 66, 215, 61, 156, 180};
+
+  inline uint8_t hash(uint8_t i)
+  {
+    return PERMUTATION[i];
+  }
+
+  // 3t² - 2t³ on 0-255, so the blend has no kink at cell edges.
+  inline uint8_t ease(uint8_t t)
+  {
+    uint16_t t2 = ((uint16_t)t * t) >> 8;
+    return (t2 * (768 - 2 * (uint16_t)t)) >> 8;
+  }
+
+  inline int32_t lerp(int32_t a, int32_t b, uint8_t t)
+  {
+    return a + (((b - a) * t) >> 8);
+  }
+
+  // Dot product of (x, y) with one of eight gradients picked by the hash.
+  // Looked up rather than switched on: the hash is random, so a branch on it
+  // would mispredict most of the time.
+  inline int32_t grad(uint8_t hash, int32_t x, int32_t y)
+  {
+    static const int8_t GRADIENT_X[8] = {1, -1, 1, -1, 1, -1, 0, 0};
+    static const int8_t GRADIENT_Y[8] = {1, 1, -1, -1, 0, 0, 1, -1};
+    return x * GRADIENT_X[hash & 7] + y * GRADIENT_Y[hash & 7];
+  }
+
+  inline int32_t grad(uint8_t hash, int32_t x)
+  {
+    int32_t slope = (hash & 7) + 1; // 1-8
+    return (hash & 8 ? -x : x) * slope >> 2;
+  }
+
+  // Raw values, within ±256.
+  inline int32_t raw(uint32_t x)
+  {
+    uint8_t cell = x >> 8;
+    uint8_t fraction = x;
+    int32_t a = grad(hash(cell), fraction);
+    int32_t b = grad(hash(cell + 1), (int32_t)fraction - 256);
+    return lerp(a, b, ease(fraction));
+  }
+
+  inline int32_t raw(uint32_t x, uint32_t y)
+  {
+    uint8_t cellX = x >> 8;
+    uint8_t cellY = y >> 8;
+    int32_t fx = x & 0xFF;
+    int32_t fy = y & 0xFF;
+
+    uint8_t a = hash(cellX) + cellY;
+    uint8_t b = hash(cellX + 1) + cellY;
+    int32_t n00 = grad(hash(a), fx, fy);
+    int32_t n10 = grad(hash(b), fx - 256, fy);
+    int32_t n01 = grad(hash(a + 1), fx, fy - 256);
+    int32_t n11 = grad(hash(b + 1), fx - 256, fy - 256);
+
+    uint8_t u = ease(fx);
+    return lerp(lerp(n00, n10, u), lerp(n01, n11, u), ease(fy));
+  }
+
+  inline uint8_t clamp8(int32_t value)
+  {
+    return value < 0 ? 0 : value > 255 ? 255 : value;
+  }
+}
+
+inline uint8_t noise8(uint32_t x)
+{
+  return noise::clamp8(128 + (noise::raw(x) * 3 >> 2));
+}
+
+inline uint8_t noise8(uint32_t x, uint32_t y)
+{
+  return noise::clamp8(128 + (noise::raw(x, y) * 3 >> 2));
+}
+
+// Sums up to four layers of 2D noise, each at twice the frequency and half the
+// weight of the one before, for detail at several sizes at once.
+inline uint8_t fractalNoise8(uint32_t x, uint32_t y, uint8_t octaves)
+{
+  // 3/4 of 65536 over the total weight of 1, 1.5, 1.75 and 1.875 layers
+  static const int32_t NORMALISE[5] = {0, 49152, 32768, 28087, 26214};
+  if (octaves > 4)
+  {
+    octaves = 4;
+  }
+
+  int32_t sum = 0;
+  for (uint8_t octave = 0; octave < octaves; octave++)
+  {
+    sum += noise::raw(x, y) >> octave;
+    // move each layer off the previous one's lattice so their cells don't line up
+    x = (x << 1) + 0x3A00;
+    y = (y << 1) + 0x7100;
+  }
+  return noise::clamp8(128 + ((sum * NORMALISE[octaves]) >> 16));
+}
+
+// Fills a line of `count` values starting at (x, y) and stepping `scale`
+// (8.8: 256 is one cell per pixel) along x, the usual way to lay a noise field
+// along a strip with time as y.
+inline void fillNoise8(uint8_t *values, uint16_t count, uint32_t x, uint16_t scale, uint32_t y, uint8_t octaves)
+{
+  for (uint16_t i = 0; i < count; i++)
+  {
+    values[i] = octaves > 1 ? fractalNoise8(x, y, octaves) : noise8(x, y);
+    x += scale;
+  }
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <PixelOps.h>
+
+// Gradient palettes: a few colour stops, looked up through a 256-entry table.
+//
+// A gradient is sent and stored compactly as up to PALETTE_MAX_STOPS stops of
+// [position, red, green, blue]; positions run from 0 to 255 and never go back,
+// and two stops at the same position make a hard edge. Before use it is
+// expanded once into a table of packed 0x00RRGGBB colours with the stops
+// blended linearly between, so a pattern pays one table read per pixel.
+#define PALETTE_MAX_STOPS 16
+#define PALETTE_STOP_SIZE 4
+
+struct GradientPalette
+{
+  uint8_t stops[PALETTE_MAX_STOPS * PALETTE_STOP_SIZE];
+  uint8_t count = 0;
+
+  // Whether `length` bytes hold a gradient encoded as above.
+  static bool validate(const uint8_t *data, size_t length)
+  {
+    if (length % PALETTE_STOP_SIZE != 0)
+    {
+      return false;
+    }
+    size_t count = length / PALETTE_STOP_SIZE;
+    if (count < 2 || count > PALETTE_MAX_STOPS || data[0] != 0 || data[length - PALETTE_STOP_SIZE] != 255)
+    {
+      return false;
+    }
+    for (size_t i = 1; i < count; i++)
+    {
+      if (data[i * PALETTE_STOP_SIZE] < data[(i - 1) * PALETTE_STOP_SIZE])
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Accepts `count` stops encoded as above; leaves the palette alone if the
+  // data is not a valid gradient.
+  bool parse(const uint8_t *data, size_t length)
+  {
+    if (!validate(data, length))
+    {
+      return false;
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+      this->stops[i] = data[i];
+    }
+    this->count = length / PALETTE_STOP_SIZE;
+    return true;
+  }
+
+  uint8_t position(uint8_t stop) const
+  {
+    return this->stops[stop * PALETTE_STOP_SIZE];
+  }
+
+  uint32_t color(uint8_t stop) const
+  {
+    const uint8_t *s = this->stops + stop * PALETTE_STOP_SIZE;
+    return ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 8) | s[3];
+  }
+
+  void expand(uint32_t *table) const
+  {
+    uint8_t stop = 0;
+    for (uint16_t index = 0; index < 256; index++)
+    {
+      // move to the segment [stop, stop + 1] that holds this index
+      while (stop + 2 < this->count && this->position(stop + 1) < index)
+      {
+        stop++;
+      }
+      uint8_t from = this->position(stop);
+      uint8_t to = this->position(stop + 1);
+      uint16_t weight = to > from ? ((index - from) << 8) / (to - from) : 256;
+      table[index] = blendPixel(this->color(stop), this->color(stop + 1), weight);
+    }
+  }
+};
+
+class Palette
+{
+private:
+  uint32_t table[256];
+
+public:
+  void load(const GradientPalette &gradient)
+  {
+    gradient.expand(this->table);
+  }
+
+  uint32_t color(uint8_t index) const
+  {
+    return this->table[index];
+  }
+
+  // The colour at `index`, dimmed to brightness / 255.
+  uint32_t color(uint8_t index, uint8_t brightness) const
+  {
+    return scalePixel(this->table[index], brightness + 1);
+  }
+};
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdint.h>
+#include <PixelOps.h>
+
+// Fixed-capacity particle pool for one-dimensional strips.
+//
+// Particles are stored as parallel arrays (struct-of-arrays) and kept packed
+// in [0, count): spawning appends, dying swaps the last live particle into the
+// freed slot. Nothing is allocated after construction.
+//
+// Positions are 24.8 fixed-point pixels, velocities are 8.8 fixed-point
+// pixels per step and life is an 8-bit intensity that drops by `decay` every
+// step. Rendering is additive and anti-aliased across the two pixels a
+// particle straddles.
+template <uint16_t Capacity>
+class ParticleSystem
+{
+public:
+  static const int32_t ONE = 256; // 1.0 pixel in fixed-point
+
+  int32_t position[Capacity];
+  int16_t velocity[Capacity];
+  uint8_t red[Capacity];
+  uint8_t green[Capacity];
+  uint8_t blue[Capacity];
+  uint8_t life[Capacity];
+  uint8_t decay[Capacity];
+
+  uint16_t count = 0;
+  uint16_t drag = 256; // velocity kept per step, in 256ths (256 = no drag)
+  bool wrap = false;   // wrap around the strip instead of dying at the ends
+
+  static uint16_t capacity()
+  {
+    return Capacity;
+  }
+
+  void clear()
+  {
+    this->count = 0;
+  }
+
+  // Returns false when the pool is full; the particle is dropped.
+  bool spawn(int32_t position, int16_t velocity, uint8_t r, uint8_t g, uint8_t b, uint8_t life, uint8_t decay)
+  {
+    if (this->count >= Capacity)
+    {
+      return false;
+    }
+
+    uint16_t i = this->count++;
+    this->position[i] = position;
+    this->velocity[i] = velocity;
+    this->red[i] = r;
+    this->green[i] = g;
+    this->blue[i] = b;
+    this->life[i] = life;
+    this->decay[i] = decay;
+    return true;
+  }
+
+  // Advance every particle by one step, retiring the ones that burnt out or
+  // left the strip.
+  void step(uint16_t numPixels)
+  {
+    int32_t span = (int32_t)numPixels * ONE;
+    uint16_t i = 0;
+
+    while (i < this->count)
+    {
+      if (this->life[i] <= this->decay[i])
+      {
+        this->kill(i);
+        continue;
+      }
+
+      this->life[i] -= this->decay[i];
+      this->position[i] += this->velocity[i];
+      this->velocity[i] = (int16_t)(((int32_t)this->velocity[i] * this->drag) >> 8);
+
+      if (this->position[i] < 0 || this->position[i] >= span)
+      {
+        if (!this->wrap)
+        {
+          this->kill(i);
+          continue;
+        }
+
+        this->position[i] %= span;
+        if (this->position[i] < 0)
+        {
+          this->position[i] += span;
+        }
+      }
+
+      i++;
+    }
+  }
+
+  // Add every live particle onto a packed 0x00RRGGBB frame.
+  // `ahead` draws each particle that many 256ths of a step further along its
+  // velocity, for frames shown between steps.
+  void render(uint32_t *pixels, uint16_t numPixels, uint8_t ahead = 0) const
+  {
+    int32_t span = (int32_t)numPixels * 256;
+    for (uint16_t i = 0; i < this->count; i++)
+    {
+      int32_t position = this->position[i] + ((this->velocity[i] * ahead) >> 8);
+      if (this->wrap && (position < 0 || position >= span))
+      {
+        position = ((position % span) + span) % span;
+      }
+      if (position < 0 || position >= span)
+      {
+        continue;
+      }
+
+      uint16_t pixel = position >> 8;
+      uint8_t fraction = position & 0xFF;
+      uint8_t lead = (this->life[i] * fraction) >> 8;
+      uint8_t tail = this->life[i] - lead;
+
+      this->blend(pixels[pixel], i, tail);
+
+      if (lead == 0)
+      {
+        continue;
+      }
+
+      uint16_t next = pixel + 1;
+      if (next >= numPixels)
+      {
+        if (!this->wrap)
+        {
+          continue;
+        }
+        next = 0;
+      }
+
+      this->blend(pixels[next], i, lead);
+    }
+  }
+
+private:
+  void kill(uint16_t i)
+  {
+    uint16_t last = --this->count;
+    if (i == last)
+    {
+      return;
+    }
+
+    this->position[i] = this->position[last];
+    this->velocity[i] = this->velocity[last];
+    this->red[i] = this->red[last];
+    this->green[i] = this->green[last];
+    this->blue[i] = this->blue[last];
+    this->life[i] = this->life[last];
+    this->decay[i] = this->decay[last];
+  }
+
+  void blend(uint32_t &pixel, uint16_t i, uint8_t weight) const
+  {
+    uint32_t color = ((uint32_t)this->red[i] << 16) | ((uint32_t)this->green[i] << 8) | this->blue[i];
+    pixel = addPixel(pixel, scalePixel(color, weight + 1));
+  }
+};
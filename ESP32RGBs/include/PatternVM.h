@@ -0,0 +1,323 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+
+// Register-based interpreter for user-uploaded patterns.
+//
+// A program has a per-frame prologue and a per-pixel kernel, both straight
+// line (there are no jumps), so the work per frame is bounded by
+// prologueLength + kernelLength * pixels and is checked when the program is
+// loaded. All arithmetic is 16.16 fixed-point.
+//
+// Binary layout (little-endian):
+//   'P' 'V' version constantCount prologueLength kernelLength
+//   int32 constants[constantCount]
+//   uint8 code[prologueLength + kernelLength][4]   (op, dst, a, b)
+//
+// Registers r0-r2 hold the base colour (0-255) on entry and the pixel colour
+// on exit. r3 is the pixel index, r4 the position along the strip (0-1), r5
+// the pixel count and r6 the pattern time in rate ticks. The prologue runs
+// once per frame; every pixel's kernel starts from the registers it left.
+//
+// Time counts up from 0 when the pattern starts and is taken modulo
+// PATTERN_VM_TIME_PERIOD ticks, so it never goes negative: at 32768 ticks
+// (27 minutes at the default 50 ms rate) it drops back to 0. A program that
+// uses time as a phase with a period dividing 32768 ticks, such as any power
+// of two up to it, runs on across the wrap without a jump.
+#define PATTERN_VM_VERSION 1
+#define PATTERN_VM_TIME_PERIOD 32768 // ticks; 16.16 time modulo this fits a non-negative register
+#define PATTERN_VM_REGISTERS 16
+#define PATTERN_VM_MAX_CONSTANTS 24
+#define PATTERN_VM_MAX_CODE 96
+#define PATTERN_VM_MAX_KERNEL 64
+#define PATTERN_VM_HEADER_SIZE 6
+#define PATTERN_VM_MAX_PROGRAM_SIZE (PATTERN_VM_HEADER_SIZE + PATTERN_VM_MAX_CONSTANTS * 4 + PATTERN_VM_MAX_CODE * 4)
+
+enum PatternOp : uint8_t
+{
+  OP_NOP,
+  OP_MOV,   // dst = a
+  OP_LOADK, // dst = constants[a | b << 8]
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV, // division by zero yields 0
+  OP_MOD, // floored, result has the sign of b
+  OP_NEG,
+  OP_ABS,
+  OP_MIN,
+  OP_MAX,
+  OP_SIN, // argument in turns, result in [-1, 1]
+  OP_COS,
+  OP_FLOOR,
+  OP_FRAC,
+  OP_LT, // 1.0 when a < b, else 0
+  OP_COUNT
+};
+
+enum PatternRegister : uint8_t
+{
+  REG_RED,
+  REG_GREEN,
+  REG_BLUE,
+  REG_INDEX,
+  REG_X,
+  REG_PIXELS,
+  REG_TIME,
+  REG_FIRST_FREE
+};
+
+class PatternVM
+{
+public:
+  static const int32_t ONE = 65536;
+
+private:
+  int32_t constants[PATTERN_VM_MAX_CONSTANTS];
+  uint32_t code[PATTERN_VM_MAX_CODE];
+  uint8_t prologueLength = 0;
+  uint8_t kernelLength = 0;
+  bool loaded = false;
+
+  int32_t frameRegisters[PATTERN_VM_REGISTERS];
+  int32_t xStep = 0;
+  int16_t sineTable[256]; // Q15
+
+  static uint32_t readWord(const uint8_t *data)
+  {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+  }
+
+  int32_t sine(int32_t turns) const
+  {
+    uint16_t fraction = turns & 0xFFFF;
+    uint8_t index = fraction >> 8;
+    int32_t a = this->sineTable[index];
+    int32_t b = this->sineTable[(uint8_t)(index + 1)];
+    int32_t value = a + (((b - a) * (fraction & 0xFF)) >> 8);
+    return value * 2; // Q15 -> 16.16
+  }
+
+  static uint8_t toChannel(int32_t value)
+  {
+    if (value <= 0)
+    {
+      return 0;
+    }
+    value >>= 16;
+    return value > 255 ? 255 : value;
+  }
+
+  void run(const uint32_t *instructions, uint8_t length, int32_t *reg) const
+  {
+    for (uint8_t pc = 0; pc < length; pc++)
+    {
+      uint32_t instruction = instructions[pc];
+      uint8_t op = instruction & 0xFF;
+      uint8_t dst = (instruction >> 8) & 0x0F;
+      uint8_t a = (instruction >> 16) & 0xFF;
+      uint8_t b = (instruction >> 24) & 0xFF;
+      int32_t x = reg[a & 0x0F];
+      int32_t y = reg[b & 0x0F];
+
+      switch (op)
+      {
+      case OP_MOV:
+        reg[dst] = x;
+        break;
+      case OP_LOADK:
+        reg[dst] = this->constants[a | (b << 8)];
+        break;
+      // Uploaded programs may overflow anything; arithmetic wraps rather than
+      // trapping or invoking undefined behaviour.
+      case OP_ADD:
+        reg[dst] = (int32_t)((uint32_t)x + (uint32_t)y);
+        break;
+      case OP_SUB:
+        reg[dst] = (int32_t)((uint32_t)x - (uint32_t)y);
+        break;
+      case OP_MUL:
+        reg[dst] = (int32_t)(((int64_t)x * y) >> 16);
+        break;
+      case OP_DIV:
+        reg[dst] = y == 0 ? 0 : (int32_t)(((int64_t)x * ONE) / y);
+        break;
+      case OP_MOD:
+        if (y == 0 || y == -1)
+        {
+          reg[dst] = 0; // INT32_MIN % -1 traps
+        }
+        else
+        {
+          int32_t m = x % y;
+          reg[dst] = (m != 0 && ((m < 0) != (y < 0))) ? m + y : m;
+        }
+        break;
+      case OP_NEG:
+        reg[dst] = (int32_t)(0u - (uint32_t)x);
+        break;
+      case OP_ABS:
+        reg[dst] = x < 0 ? (int32_t)(0u - (uint32_t)x) : x;
+        break;
+      case OP_MIN:
+        reg[dst] = x < y ? x : y;
+        break;
+      case OP_MAX:
+        reg[dst] = x > y ? x : y;
+        break;
+      case OP_SIN:
+        reg[dst] = this->sine(x);
+        break;
+      case OP_COS:
+        reg[dst] = this->sine((int32_t)((uint32_t)x + ONE / 4));
+        break;
+      case OP_FLOOR:
+        reg[dst] = x & ~(ONE - 1);
+        break;
+      case OP_FRAC:
+        reg[dst] = x & (ONE - 1);
+        break;
+      case OP_LT:
+        reg[dst] = x < y ? ONE : 0;
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+public:
+  PatternVM()
+  {
+    for (int i = 0; i < 256; i++)
+    {
+      this->sineTable[i] = (int16_t)lroundf(sinf(i * 2.0f * (float)M_PI / 256.0f) * 32767.0f);
+    }
+  }
+
+  // Checks a program image without loading it.
+  static bool validate(const uint8_t *data, size_t length)
+  {
+    if (length < PATTERN_VM_HEADER_SIZE || data[0] != 'P' || data[1] != 'V' || data[2] != PATTERN_VM_VERSION)
+    {
+      return false;
+    }
+
+    uint8_t constantCount = data[3];
+    uint8_t prologueLength = data[4];
+    uint8_t kernelLength = data[5];
+
+    if (constantCount > PATTERN_VM_MAX_CONSTANTS ||
+        prologueLength + kernelLength > PATTERN_VM_MAX_CODE ||
+        kernelLength > PATTERN_VM_MAX_KERNEL ||
+        length != PATTERN_VM_HEADER_SIZE + constantCount * 4u + (prologueLength + kernelLength) * 4u)
+    {
+      return false;
+    }
+
+    const uint8_t *instructions = data + PATTERN_VM_HEADER_SIZE + constantCount * 4;
+    for (int pc = 0; pc < prologueLength + kernelLength; pc++)
+    {
+      const uint8_t *instruction = instructions + pc * 4;
+      if (instruction[0] >= OP_COUNT || instruction[1] >= PATTERN_VM_REGISTERS)
+      {
+        return false;
+      }
+
+      if (instruction[0] == OP_LOADK)
+      {
+        if ((instruction[2] | (instruction[3] << 8)) >= constantCount)
+        {
+          return false;
+        }
+      }
+      else if (instruction[2] >= PATTERN_VM_REGISTERS || instruction[3] >= PATTERN_VM_REGISTERS)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  bool load(const uint8_t *data, size_t length)
+  {
+    this->loaded = false;
+    if (!validate(data, length))
+    {
+      return false;
+    }
+
+    uint8_t constantCount = data[3];
+    this->prologueLength = data[4];
+    this->kernelLength = data[5];
+
+    const uint8_t *cursor = data + PATTERN_VM_HEADER_SIZE;
+    for (uint8_t i = 0; i < constantCount; i++, cursor += 4)
+    {
+      this->constants[i] = (int32_t)readWord(cursor);
+    }
+    for (uint8_t pc = 0; pc < this->prologueLength + this->kernelLength; pc++, cursor += 4)
+    {
+      this->code[pc] = readWord(cursor);
+    }
+
+    this->loaded = true;
+    return true;
+  }
+
+  bool isLoaded() const
+  {
+    return this->loaded;
+  }
+
+  // Upper bound on instructions executed for one frame.
+  uint32_t frameCost(uint16_t pixels) const
+  {
+    return this->prologueLength + (uint32_t)this->kernelLength * pixels;
+  }
+
+  // Elapsed pattern time for r6: `ticks` whole ticks and `fraction` 1/65536ths
+  // of one, reduced modulo PATTERN_VM_TIME_PERIOD.
+  static int32_t time(uint32_t ticks, uint16_t fraction)
+  {
+    return (int32_t)(((ticks % PATTERN_VM_TIME_PERIOD) << 16) | fraction);
+  }
+
+  void beginFrame(int32_t time, uint16_t pixels, uint8_t r, uint8_t g, uint8_t b)
+  {
+    for (int i = 0; i < PATTERN_VM_REGISTERS; i++)
+    {
+      this->frameRegisters[i] = 0;
+    }
+
+    this->frameRegisters[REG_RED] = (int32_t)r << 16;
+    this->frameRegisters[REG_GREEN] = (int32_t)g << 16;
+    this->frameRegisters[REG_BLUE] = (int32_t)b << 16;
+    this->frameRegisters[REG_PIXELS] = (int32_t)((uint32_t)pixels << 16);
+    this->frameRegisters[REG_TIME] = time;
+    this->xStep = pixels > 0 ? ONE / pixels : 0;
+
+    this->run(this->code, this->prologueLength, this->frameRegisters);
+  }
+
+  void shade(uint16_t index, uint8_t &r, uint8_t &g, uint8_t &b) const
+  {
+    int32_t reg[PATTERN_VM_REGISTERS];
+    for (int i = 0; i < PATTERN_VM_REGISTERS; i++)
+    {
+      reg[i] = this->frameRegisters[i];
+    }
+
+    reg[REG_INDEX] = (int32_t)((uint32_t)index << 16);
+    reg[REG_X] = this->xStep * index;
+
+    this->run(this->code + this->prologueLength, this->kernelLength, reg);
+
+    r = toChannel(reg[REG_RED]);
+    g = toChannel(reg[REG_GREEN]);
+    b = toChannel(reg[REG_BLUE]);
+  }
+};
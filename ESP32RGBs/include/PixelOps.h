@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <FrameStrip.h>
+
+// Bulk operations on a frame held as packed 0x00RRGGBB words.
+//
+// Channels are processed together inside one 32-bit word (SIMD within a
+// register): red and blue sit 16 bits apart, so one multiply scales both
+// without their products overlapping, and green takes a second multiply.
+// Saturating adds work on all three bytes at once with masks. Patterns draw
+// into their own frame with these and copy it to the strip in one pass,
+// instead of a bounds-checked getPixelColor()/setPixelColor() per pixel.
+
+// Scales every channel by scale / 256 (scale 256 keeps the colour).
+inline uint32_t scalePixel(uint32_t color, uint16_t scale)
+{
+  uint32_t redBlue = (((color & 0xFF00FF) * scale) >> 8) & 0xFF00FF;
+  uint32_t green = (((color & 0x00FF00) * scale) >> 8) & 0x00FF00;
+  return redBlue | green;
+}
+
+// Adds two colours, each channel clamped at 255.
+inline uint32_t addPixel(uint32_t a, uint32_t b)
+{
+  uint32_t low = (a & 0x7F7F7F) + (b & 0x7F7F7F);               // bits 0-7 of each sum, carries kept in-lane
+  uint32_t sum = low ^ ((a ^ b) & 0x808080);                     // each byte's sum, wrapped
+  uint32_t carry = ((a & b) | ((a | b) & ~sum)) & 0x808080;      // lanes that overflowed
+  return sum | ((carry >> 7) * 0xFF);
+}
+
+// Linear blend from `from` to `to`, weight 0-256.
+inline uint32_t blendPixel(uint32_t from, uint32_t to, uint16_t weight)
+{
+  uint16_t keep = 256 - weight;
+  uint32_t redBlue = (((from & 0xFF00FF) * keep + (to & 0xFF00FF) * weight) >> 8) & 0xFF00FF;
+  uint32_t green = (((from & 0x00FF00) * keep + (to & 0x00FF00) * weight) >> 8) & 0x00FF00;
+  return redBlue | green;
+}
+
+inline void fillPixels(uint32_t *pixels, uint16_t count, uint32_t color)
+{
+  for (uint16_t i = 0; i < count; i++)
+  {
+    pixels[i] = color;
+  }
+}
+
+// Dims every pixel by amount / 256; 128 halves them.
+inline void fadeToBlackBy(uint32_t *pixels, uint16_t count, uint8_t amount)
+{
+  uint16_t scale = 256 - amount;
+  for (uint16_t i = 0; i < count; i++)
+  {
+    pixels[i] = scalePixel(pixels[i], scale);
+  }
+}
+
+// Each pixel keeps (256 - amount) / 256 of itself and gives half of the
+// rest to each neighbour, so light spreads without the total growing.
+inline void blur1d(uint32_t *pixels, uint16_t count, uint8_t amount)
+{
+  uint16_t keep = 256 - amount;
+  uint16_t seep = amount >> 1;
+  uint32_t carry = 0;
+  for (uint16_t i = 0; i < count; i++)
+  {
+    uint32_t current = pixels[i];
+    uint32_t part = scalePixel(current, seep);
+    current = addPixel(scalePixel(current, keep), carry);
+    if (i > 0)
+    {
+      pixels[i - 1] = addPixel(pixels[i - 1], part);
+    }
+    pixels[i] = current;
+    carry = part;
+  }
+}
+
+// Adds `source` onto `pixels`, clamping each channel.
+inline void addPixels(uint32_t *pixels, const uint32_t *source, uint16_t count)
+{
+  for (uint16_t i = 0; i < count; i++)
+  {
+    pixels[i] = addPixel(pixels[i], source[i]);
+  }
+}
+
+// Moves the frame `by` pixels towards the end (negative: towards the start),
+// filling the uncovered pixels with `fill`.
+inline void shiftPixels(uint32_t *pixels, uint16_t count, int16_t by, uint32_t fill)
+{
+  uint16_t distance = by < 0 ? -by : by;
+  if (distance >= count)
+  {
+    fillPixels(pixels, count, fill);
+    return;
+  }
+
+  if (by > 0)
+  {
+    memmove(pixels + distance, pixels, (count - distance) * sizeof(uint32_t));
+    fillPixels(pixels, distance, fill);
+  }
+  else
+  {
+    memmove(pixels, pixels + distance, (count - distance) * sizeof(uint32_t));
+    fillPixels(pixels + count - distance, distance, fill);
+  }
+}
+
+// Rotates the frame `by` pixels towards the end, in place.
+inline void rotatePixels(uint32_t *pixels, uint16_t count, int16_t by)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  uint16_t split = ((by % count) + count) % count;
+
+  auto reverse = [](uint32_t *first, uint32_t *last)
+  {
+    while (first < --last)
+    {
+      uint32_t t = *first;
+      *first++ = *last;
+      *last = t;
+    }
+  };
+  reverse(pixels, pixels + count);
+  reverse(pixels, pixels + split);
+  reverse(pixels + split, pixels + count);
+}
+
+// Fills `count` pixels from `from` to `to` inclusive.
+inline void fillGradient(uint32_t *pixels, uint16_t count, uint32_t from, uint32_t to)
+{
+  if (count == 0)
+  {
+    return;
+  }
+  uint32_t step = count > 1 ? (256u << 16) / (count - 1) : 0; // weight per pixel, 16.16
+  uint32_t weight = 0;
+  for (uint16_t i = 0; i < count; i++)
+  {
+    pixels[i] = blendPixel(from, to, weight >> 16);
+    weight += step;
+  }
+  pixels[count - 1] = to;
+}
+
+// Copies the frame into the strip's buffer in one pass, in the strip's byte
+// order.
+inline void writePixels(FrameStrip &strip, const uint32_t *pixels, uint16_t count)
+{
+  uint8_t *out = strip.getPixels();
+  uint8_t red = strip.redOffset();
+  uint8_t green = strip.greenOffset();
+  uint8_t blue = strip.blueOffset();
+  for (uint16_t i = 0; i < count; i++)
+  {
+    uint32_t color = pixels[i];
+    out[red] = color >> 16;
+    out[green] = color >> 8;
+    out[blue] = color;
+    out += 3;
+  }
+}
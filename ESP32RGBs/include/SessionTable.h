@@ -0,0 +1,190 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+enum class SessionState : uint8_t
+{
+  Free,
+  Pending,
+  Authenticated
+};
+
+#define SESSION_CHALLENGE_SIZE 16
+#define SESSION_EXPIRY_RETRY 1000 // milliseconds before an expired session is disconnected again
+
+// The connection ID, state and deadline are also read by the expiry check;
+// the challenge is only ever touched by the BLE task.
+struct Session
+{
+  std::atomic<uint16_t> connectionID{0};
+  std::atomic<SessionState> state{SessionState::Free};
+  std::atomic<unsigned long> deadline{0}; // millis() by which a pending session must authenticate
+  uint8_t challenge[SESSION_CHALLENGE_SIZE];
+  bool challenged = false; // a challenge was handed out and not yet answered
+};
+
+// Per-connection authentication state, one slot per concurrent BLE link.
+//
+// Slots are keyed by the connection ID carried in the GATT event, so several
+// clients can be connected and authenticated independently. Lookups are a
+// linear scan over a handful of entries and nothing is allocated.
+//
+// The BLE task opens, authenticates and closes sessions; the expiry check
+// runs elsewhere and never changes a session. It only reads the pending ones
+// and asks the stack to disconnect those past their deadline, and the BLE
+// task frees them when the disconnect arrives. Each slot is filled in before
+// its state is published as Pending, so the check never sees a half-opened
+// one.
+//
+// The earliest pending deadline is cached so the check can poll for expiry
+// with a single comparison instead of walking the table. The cache belongs
+// to the check; open() only flags that it needs recomputing.
+template <uint8_t Capacity>
+class SessionTable
+{
+private:
+  Session sessions[Capacity];
+  unsigned long nextDeadline = 0;
+  bool deadlineArmed = false;
+  std::atomic<bool> opened{false}; // a session was opened since the cache was computed
+
+  void arm(unsigned long deadline)
+  {
+    if (!this->deadlineArmed || (long)(deadline - this->nextDeadline) < 0)
+    {
+      this->nextDeadline = deadline;
+    }
+    this->deadlineArmed = true;
+  }
+
+public:
+  static uint8_t capacity()
+  {
+    return Capacity;
+  }
+
+  // BLE task.
+  Session *find(uint16_t connectionID)
+  {
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      Session &session = this->sessions[i];
+      if (session.state.load(std::memory_order_relaxed) != SessionState::Free &&
+          session.connectionID.load(std::memory_order_relaxed) == connectionID)
+      {
+        return &session;
+      }
+    }
+
+    return nullptr;
+  }
+
+  // BLE task: starts a pending session. Returns nullptr when every slot is
+  // taken.
+  Session *open(uint16_t connectionID, unsigned long deadline)
+  {
+    Session *session = this->find(connectionID);
+
+    for (uint8_t i = 0; session == nullptr && i < Capacity; i++)
+    {
+      if (this->sessions[i].state.load(std::memory_order_relaxed) == SessionState::Free)
+      {
+        session = &this->sessions[i];
+      }
+    }
+
+    if (session != nullptr)
+    {
+      session->connectionID.store(connectionID, std::memory_order_relaxed);
+      session->deadline.store(deadline, std::memory_order_relaxed);
+      session->challenged = false;
+      session->state.store(SessionState::Pending, std::memory_order_release);
+      this->opened.store(true, std::memory_order_release);
+    }
+
+    return session;
+  }
+
+  // BLE task.
+  void close(uint16_t connectionID)
+  {
+    Session *session = this->find(connectionID);
+    if (session != nullptr)
+    {
+      session->state.store(SessionState::Free, std::memory_order_release);
+    }
+  }
+
+  // BLE task.
+  bool authenticate(uint16_t connectionID)
+  {
+    Session *session = this->find(connectionID);
+    if (session == nullptr)
+    {
+      return false;
+    }
+
+    session->state.store(SessionState::Authenticated, std::memory_order_release);
+    return true;
+  }
+
+  // BLE task.
+  bool isAuthenticated(uint16_t connectionID)
+  {
+    Session *session = this->find(connectionID);
+    return session != nullptr && session->state.load(std::memory_order_relaxed) == SessionState::Authenticated;
+  }
+
+  // Expiry check: true once the earliest pending deadline has passed.
+  bool deadlineDue(unsigned long now)
+  {
+    if (this->opened.exchange(false, std::memory_order_acquire))
+    {
+      this->rearm();
+    }
+    return this->deadlineArmed && (long)(now - this->nextDeadline) >= 0;
+  }
+
+  // Expiry check: calls `expire(connectionID)` for every pending session past
+  // its deadline and recomputes the earliest deadline. Sessions that
+  // authenticated or closed since they were armed simply drop out here. An
+  // expired session stays pending until the BLE task closes it, so one still
+  // there is expired again after SESSION_EXPIRY_RETRY.
+  template <typename Expire>
+  void expire(unsigned long now, Expire expire)
+  {
+    this->deadlineArmed = false;
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      Session &session = this->sessions[i];
+      if (session.state.load(std::memory_order_acquire) != SessionState::Pending)
+      {
+        continue;
+      }
+
+      unsigned long deadline = session.deadline.load(std::memory_order_relaxed);
+      if ((long)(now - deadline) >= 0)
+      {
+        expire(session.connectionID.load(std::memory_order_relaxed));
+        deadline = now + SESSION_EXPIRY_RETRY;
+      }
+      this->arm(deadline);
+    }
+  }
+
+  // Expiry check: recomputes the earliest deadline from the sessions still
+  // pending.
+  void rearm()
+  {
+    this->deadlineArmed = false;
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      Session &session = this->sessions[i];
+      if (session.state.load(std::memory_order_acquire) == SessionState::Pending)
+      {
+        this->arm(session.deadline.load(std::memory_order_relaxed));
+      }
+    }
+  }
+};
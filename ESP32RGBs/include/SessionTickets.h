@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <Sha256.h>
+
+#define TICKET_ID_SIZE 8
+
+struct SessionTicket
+{
+  uint8_t id[TICKET_ID_SIZE];
+  uint8_t key[SHA256_SIZE];
+  uint32_t counter;       // highest resume counter accepted so far
+  unsigned long issuedAt; // millis()
+  bool valid;
+};
+
+// Tickets that let a client which authenticated once resume later with a
+// single write.
+//
+// A ticket is issued after a successful challenge-response. Its key is derived
+// on both ends from the password and that exchange's nonces, so only the ID
+// goes over the air. To resume, the client sends the ID, a counter higher than
+// any it used before, and an HMAC of both under the ticket key; a captured
+// resume cannot be replayed because its counter is then no longer higher.
+//
+// Tickets are kept in RAM only: after a restart clients fall back to the full
+// challenge. When the table is full the oldest ticket is replaced.
+template <uint8_t Capacity>
+class TicketTable
+{
+private:
+  SessionTicket tickets[Capacity];
+
+  SessionTicket *find(const uint8_t *id)
+  {
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      if (this->tickets[i].valid && memcmp(this->tickets[i].id, id, TICKET_ID_SIZE) == 0)
+      {
+        return &this->tickets[i];
+      }
+    }
+    return nullptr;
+  }
+
+public:
+  TicketTable()
+  {
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      this->tickets[i].valid = false;
+    }
+  }
+
+  void issue(const uint8_t *id, const uint8_t *key, unsigned long now)
+  {
+    SessionTicket *slot = &this->tickets[0];
+    for (uint8_t i = 0; i < Capacity; i++)
+    {
+      if (!this->tickets[i].valid)
+      {
+        slot = &this->tickets[i];
+        break;
+      }
+      if ((long)(this->tickets[i].issuedAt - slot->issuedAt) < 0)
+      {
+        slot = &this->tickets[i];
+      }
+    }
+
+    memcpy(slot->id, id, TICKET_ID_SIZE);
+    memcpy(slot->key, key, SHA256_SIZE);
+    slot->counter = 0;
+    slot->issuedAt = now;
+    slot->valid = true;
+  }
+
+  // Checks a resume request and, if it is good, records its counter.
+  bool resume(const uint8_t *id, uint32_t counter, const uint8_t *mac, unsigned long now, unsigned long lifetime)
+  {
+    SessionTicket *ticket = this->find(id);
+    if (ticket == nullptr)
+    {
+      return false;
+    }
+    if (now - ticket->issuedAt > lifetime)
+    {
+      ticket->valid = false;
+      return false;
+    }
+    if (counter <= ticket->counter)
+    {
+      return false;
+    }
+
+    static const uint8_t label[] = {'r', 'e', 's', 'u', 'm', 'e'};
+    uint8_t counterBytes[4] = {(uint8_t)counter, (uint8_t)(counter >> 8), (uint8_t)(counter >> 16), (uint8_t)(counter >> 24)};
+    uint8_t message[sizeof(label) + TICKET_ID_SIZE];
+    memcpy(message, label, sizeof(label));
+    memcpy(message + sizeof(label), id, TICKET_ID_SIZE);
+
+    uint8_t expected[SHA256_SIZE];
+    hmacSha256(ticket->key, SHA256_SIZE, message, sizeof(message), counterBytes, 4, nullptr, 0, expected);
+    if (!macEqual(expected, mac, SHA256_SIZE))
+    {
+      return false;
+    }
+
+    ticket->counter = counter;
+    return true;
+  }
+};
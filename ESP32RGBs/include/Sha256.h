@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// SHA-256 (FIPS 180-4) and HMAC-SHA-256 (RFC 2104), for authenticating
+// clients without sending the password. Small and table-free apart from the
+// round constants, so it builds the same on the device and on the host.
+#define SHA256_SIZE 32
+#define SHA256_BLOCK 64
+
+class Sha256
+{
+private:
+  uint32_t state[8];
+  uint8_t block[SHA256_BLOCK];
+  uint8_t held = 0;
+  uint64_t length = 0;
+
+  static uint32_t rotate(uint32_t x, uint8_t n)
+  {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  void compress()
+  {
+    static const uint32_t K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    uint32_t w[64];
+    for (uint8_t i = 0; i < 16; i++)
+    {
+      const uint8_t *b = this->block + i * 4;
+      w[i] = ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+    }
+    for (uint8_t i = 16; i < 64; i++)
+    {
+      uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = this->state[0], b = this->state[1], c = this->state[2], d = this->state[3];
+    uint32_t e = this->state[4], f = this->state[5], g = this->state[6], h = this->state[7];
+    for (uint8_t i = 0; i < 64; i++)
+    {
+      uint32_t t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+      uint32_t t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    this->state[0] += a;
+    this->state[1] += b;
+    this->state[2] += c;
+    this->state[3] += d;
+    this->state[4] += e;
+    this->state[5] += f;
+    this->state[6] += g;
+    this->state[7] += h;
+  }
+
+public:
+  Sha256()
+  {
+    static const uint32_t H[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(this->state, H, sizeof(H));
+  }
+
+  void update(const uint8_t *data, size_t length)
+  {
+    this->length += length;
+    while (length > 0)
+    {
+      size_t chunk = SHA256_BLOCK - this->held;
+      if (chunk > length)
+      {
+        chunk = length;
+      }
+      memcpy(this->block + this->held, data, chunk);
+      this->held += chunk;
+      data += chunk;
+      length -= chunk;
+      if (this->held == SHA256_BLOCK)
+      {
+        this->compress();
+        this->held = 0;
+      }
+    }
+  }
+
+  void finish(uint8_t *digest)
+  {
+    uint64_t bits = this->length * 8;
+    uint8_t pad = 0x80;
+    this->update(&pad, 1);
+    pad = 0;
+    while (this->held != SHA256_BLOCK - 8)
+    {
+      this->update(&pad, 1);
+    }
+    uint8_t size[8];
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      size[i] = bits >> (56 - 8 * i);
+    }
+    this->update(size, 8);
+
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      digest[i * 4] = this->state[i] >> 24;
+      digest[i * 4 + 1] = this->state[i] >> 16;
+      digest[i * 4 + 2] = this->state[i] >> 8;
+      digest[i * 4 + 3] = this->state[i];
+    }
+  }
+};
+
+// HMAC-SHA-256 over the concatenation of up to three parts; unused parts may
+// be null with length 0.
+inline void hmacSha256(const uint8_t *key, size_t keyLength,
+                       const uint8_t *a, size_t aLength,
+                       const uint8_t *b, size_t bLength,
+                       const uint8_t *c, size_t cLength,
+                       uint8_t *mac)
+{
+  uint8_t pad[SHA256_BLOCK] = {};
+  if (keyLength > SHA256_BLOCK)
+  {
+    Sha256 hash;
+    hash.update(key, keyLength);
+    hash.finish(pad);
+  }
+  else
+  {
+    memcpy(pad, key, keyLength);
+  }
+
+  for (uint8_t i = 0; i < SHA256_BLOCK; i++)
+  {
+    pad[i] ^= 0x36;
+  }
+  Sha256 inner;
+  inner.update(pad, SHA256_BLOCK);
+  inner.update(a, aLength);
+  inner.update(b, bLength);
+  inner.update(c, cLength);
+  uint8_t innerDigest[SHA256_SIZE];
+  inner.finish(innerDigest);
+
+  for (uint8_t i = 0; i < SHA256_BLOCK; i++)
+  {
+    pad[i] ^= 0x36 ^ 0x5c;
+  }
+  Sha256 outer;
+  outer.update(pad, SHA256_BLOCK);
+  outer.update(innerDigest, SHA256_SIZE);
+  outer.finish(mac);
+}
+
+// Compares two MACs in time that does not depend on where they differ.
+inline bool macEqual(const uint8_t *a, const uint8_t *b, size_t length)
+{
+  uint8_t difference = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    difference |= a[i] ^ b[i];
+  }
+  return difference == 0;
+}
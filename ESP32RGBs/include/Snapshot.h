@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+
+// A blob one task republishes and another reads back whole.
+//
+// The writer fills the copy readers are not using and then bumps the
+// sequence, which flips the copy readers take. A reader copies the current
+// one out and checks the sequence afterwards; if the writer published in the
+// meantime it may have been overwriting that copy, so the reader takes the
+// new one instead. The writer never waits, and a reader only retries while
+// publishes keep landing, which for a pattern's parameter schema is once per
+// parameter write.
+template <size_t Capacity>
+class Snapshot
+{
+private:
+  uint8_t buffers[2][Capacity];
+  size_t lengths[2] = {0, 0};
+  std::atomic<uint32_t> sequence{0};
+
+public:
+  // Writer side: the copy to fill before calling publish().
+  uint8_t *back()
+  {
+    return this->buffers[(this->sequence.load(std::memory_order_relaxed) + 1) & 1];
+  }
+
+  // Writer side: makes the `length` bytes filled into back() current.
+  void publish(size_t length)
+  {
+    uint32_t next = this->sequence.load(std::memory_order_relaxed) + 1;
+    this->lengths[next & 1] = length;
+    this->sequence.store(next, std::memory_order_release);
+  }
+
+  // Reader side: copies the current blob into `data`, which holds Capacity
+  // bytes, and returns its length.
+  size_t read(uint8_t *data) const
+  {
+    for (;;)
+    {
+      uint32_t sequence = this->sequence.load(std::memory_order_acquire);
+      size_t length = this->lengths[sequence & 1];
+      memcpy(data, this->buffers[sequence & 1], length);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (this->sequence.load(std::memory_order_relaxed) == sequence)
+      {
+        return length;
+      }
+    }
+  }
+};
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+
+// Pattern time, counted in steps of the pattern rate.
+//
+// A step is one pattern interval. Elapsed microseconds are turned into steps
+// with a 32-bit phase accumulator: `fraction` is the position within the
+// current step in 1/2^32ths, and every overflow of it adds a whole step. The
+// rate only sets how fast the accumulator moves, so changing it never moves
+// the position, and a step of any length down to a microsecond keeps full
+// precision instead of being rounded to whole milliseconds.
+//
+// Patterns take their position from this rather than counting update() calls,
+// so a frame that comes late shows where the pattern should be, not one tick
+// behind.
+class Timebase
+{
+private:
+  uint32_t whole = 0;        // completed steps
+  uint32_t fraction = 0;     // progress through the current step, 0.32 fixed point
+  uint32_t stepMicros = 50000;
+  uint64_t increment = 0;    // fraction gained per microsecond, 32.32; 2^32 at one-microsecond steps
+  uint32_t remainder = 0;    // 1/stepMicros parts of a fraction unit not yet added
+  unsigned long lastMicros = 0;
+  bool started = false;
+
+public:
+  Timebase()
+  {
+    this->setStep(this->stepMicros);
+  }
+
+  // Sets the length of one step. Position is kept; only the speed changes.
+  void setStep(uint32_t micros)
+  {
+    this->stepMicros = micros > 0 ? micros : 1;
+    this->increment = (1ULL << 32) / this->stepMicros;
+    this->remainder = 0;
+  }
+
+  uint32_t step() const
+  {
+    return this->stepMicros;
+  }
+
+  // Moves time on to `micros` (a micros() reading).
+  void advance(unsigned long micros)
+  {
+    if (!this->started)
+    {
+      this->lastMicros = micros;
+      this->started = true;
+      return;
+    }
+
+    uint32_t elapsed = micros - this->lastMicros;
+    this->lastMicros = micros;
+
+    // elapsed * 2^32 / stepMicros, split so nothing is lost to rounding: the
+    // quotient of the fixed increment, plus what the per-microsecond
+    // remainders add up to.
+    uint64_t extra = (uint64_t)elapsed * ((1ULL << 32) % this->stepMicros) + this->remainder;
+    this->remainder = extra % this->stepMicros;
+    uint64_t advance = (uint64_t)elapsed * this->increment + extra / this->stepMicros;
+
+    uint64_t total = (uint64_t)this->fraction + (uint32_t)advance;
+    this->fraction = (uint32_t)total;
+    this->whole += (uint32_t)(advance >> 32) + (uint32_t)(total >> 32);
+  }
+
+  uint32_t steps() const
+  {
+    return this->whole;
+  }
+
+  // Progress through the current step, 0-255.
+  uint8_t fraction8() const
+  {
+    return this->fraction >> 24;
+  }
+
+  // Steps as 16.16 fixed point; wraps every 65536 steps.
+  uint32_t phase16() const
+  {
+    return (this->whole << 16) | (this->fraction >> 16);
+  }
+
+  // Distance covered since step `origin` moving `rate` units per step, e.g.
+  // a noise coordinate. Wraps at 2^32 units.
+  uint32_t travel(uint16_t rate, uint32_t origin = 0) const
+  {
+    return (this->whole - origin) * rate + (((this->fraction >> 16) * rate) >> 16);
+  }
+
+  // Steps as a float, reduced modulo `period` first so the fraction keeps its
+  // precision however long the device has been running.
+  float stepsModulo(uint32_t period) const
+  {
+    return (this->whole % period) + this->fraction * (1.0f / 4294967296.0f);
+  }
+};
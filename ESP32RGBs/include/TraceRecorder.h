@@ -0,0 +1,162 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <atomic>
+
+#define TRACE_CAPACITY 256 // records, power of two
+#define TRACE_PAYLOAD 20   // bytes of each write kept
+
+enum TraceKind : uint8_t
+{
+  TRACE_WRITE,
+  TRACE_FRAME,
+  TRACE_CONNECT,
+  TRACE_DISCONNECT,
+  TRACE_LINK
+};
+
+struct TraceRecord
+{
+  uint32_t time; // millis()
+  uint8_t kind;
+  uint8_t characteristic; // TRACE_WRITE: index into the traced characteristic table
+  uint16_t connectionID;
+  uint16_t length; // TRACE_WRITE: full write length
+  uint8_t kept;    // TRACE_WRITE: bytes of payload held, 0 when redacted
+  uint8_t payload[TRACE_PAYLOAD];
+  uint32_t frame; // TRACE_FRAME: frames shown so far; TRACE_LINK: longest connection interval, 1.25 ms units
+  uint32_t hash;  // TRACE_FRAME: hash of the pixel buffer; TRACE_LINK: slave latency
+};
+
+// RAM ring of recent GATT writes, connection events, connection parameter
+// requests and periodic frame hashes, for reproducing field issues offline.
+//
+// Records are claimed with an atomic counter so the BLE task and the render
+// loop can both append without locking; the oldest records are overwritten.
+// Records are dumped as text lines:
+//   W <time> <connection> <characteristic> <length> <hex payload>
+//   F <time> <frame> <hash>
+//   C <time> <connection>
+//   D <time> <connection>
+//   L <time> <connection> <interval> <latency>
+class TraceRecorder
+{
+private:
+  TraceRecord records[TRACE_CAPACITY];
+  std::atomic<uint32_t> next{0};
+
+  TraceRecord &claim()
+  {
+    return this->records[this->next.fetch_add(1) & (TRACE_CAPACITY - 1)];
+  }
+
+public:
+  // Records a write; `redact` keeps the length but not the bytes.
+  void write(uint32_t time, uint8_t characteristic, uint16_t connectionID, const uint8_t *data, size_t length, bool redact)
+  {
+    TraceRecord &record = this->claim();
+    record.time = time;
+    record.kind = TRACE_WRITE;
+    record.characteristic = characteristic;
+    record.connectionID = connectionID;
+    record.length = length;
+    record.kept = redact ? 0 : (length < TRACE_PAYLOAD ? length : TRACE_PAYLOAD);
+    for (uint8_t i = 0; i < record.kept; i++)
+    {
+      record.payload[i] = data[i];
+    }
+  }
+
+  void event(uint32_t time, TraceKind kind, uint16_t connectionID)
+  {
+    TraceRecord &record = this->claim();
+    record.time = time;
+    record.kind = kind;
+    record.connectionID = connectionID;
+    record.length = 0;
+    record.kept = 0;
+  }
+
+  void frame(uint32_t time, uint32_t frame, uint32_t hash)
+  {
+    TraceRecord &record = this->claim();
+    record.time = time;
+    record.kind = TRACE_FRAME;
+    record.length = 0;
+    record.kept = 0;
+    record.frame = frame;
+    record.hash = hash;
+  }
+
+  void link(uint32_t time, uint16_t connectionID, uint16_t interval, uint16_t latency)
+  {
+    TraceRecord &record = this->claim();
+    record.time = time;
+    record.kind = TRACE_LINK;
+    record.connectionID = connectionID;
+    record.length = 0;
+    record.kept = 0;
+    record.frame = interval;
+    record.hash = latency;
+  }
+
+  // Sequence number of the next record to be written.
+  uint32_t end() const
+  {
+    return this->next.load();
+  }
+
+  // Sequence number of the oldest record still held.
+  uint32_t begin() const
+  {
+    uint32_t n = this->next.load();
+    return n > TRACE_CAPACITY ? n - TRACE_CAPACITY : 0;
+  }
+
+  // Formats record `sequence` as one text line, returning its length, or 0
+  // if the record has been overwritten or does not fit.
+  size_t format(uint32_t sequence, char *out, size_t capacity) const
+  {
+    if (sequence < this->begin() || sequence >= this->end())
+    {
+      return 0;
+    }
+
+    const TraceRecord &record = this->records[sequence & (TRACE_CAPACITY - 1)];
+    int length = 0;
+
+    switch (record.kind)
+    {
+    case TRACE_WRITE:
+    {
+      length = snprintf(out, capacity, "W %lu %u %u %u ", (unsigned long)record.time, record.connectionID, record.characteristic, record.length);
+      for (uint8_t i = 0; i < record.kept && length > 0 && (size_t)length + 3 < capacity; i++)
+      {
+        length += snprintf(out + length, capacity - length, "%02x", record.payload[i]);
+      }
+      break;
+    }
+    case TRACE_FRAME:
+      length = snprintf(out, capacity, "F %lu %lu %08lx", (unsigned long)record.time, (unsigned long)record.frame, (unsigned long)record.hash);
+      break;
+    case TRACE_CONNECT:
+    case TRACE_DISCONNECT:
+      length = snprintf(out, capacity, "%c %lu %u", record.kind == TRACE_CONNECT ? 'C' : 'D', (unsigned long)record.time, record.connectionID);
+      break;
+    case TRACE_LINK:
+      length = snprintf(out, capacity, "L %lu %u %lu %lu", (unsigned long)record.time, record.connectionID, (unsigned long)record.frame, (unsigned long)record.hash);
+      break;
+    }
+
+    if (length <= 0 || (size_t)length + 1 >= capacity)
+    {
+      return 0;
+    }
+
+    out[length++] = '\n';
+    out[length] = '\0';
+    return length;
+  }
+};
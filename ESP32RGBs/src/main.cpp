@@ -4,26 +4,626 @@
 #include <BLE2902.h>
 #include <BLEDescriptor.h>
 #include <Adafruit_NeoPixel.h>
-#include <unordered_set>
-#include <unordered_map>
+#include <Preferences.h>
+#include <esp_ota_ops.h>
+#include <esp_system.h>
+#include <atomic>
+#include <AudioFeatureBuffer.h>
+#include <CommandQueue.h>
+#include <DeltaPatch.h>
+#include <EventQueue.h>
+#include <FastRandom.h>
+#include <FrameCache.h>
+#include <FrameLayout.h>
+#include <FrameStats.h>
+#include <FrameStrip.h>
+#include <LinkTable.h>
+#include <Mailbox.h>
+#include <Noise.h>
+#include <Palette.h>
+#include <ParticleSystem.h>
+#include <PatternVM.h>
+#include <PixelOps.h>
+#include <SessionTable.h>
+#include <SessionTickets.h>
+#include <Sha256.h>
+#include <Snapshot.h>
+#include <Timebase.h>
+#include <TraceRecorder.h>
 
 #define LED_PIN D10
 #define POWER_PIN D0
 #define NUM_LEDS 132
 #define BRIGHTNESS 255
-
-Adafruit_NeoPixel strip(NUM_LEDS, LED_PIN, NEO_GRB + NEO_KHZ800);
+#ifndef MAX_CONNECTIONS
+#define MAX_CONNECTIONS 4 // Bluedroid's default ACL link limit
+#endif
+#define AUTHENTICATION_TIMEOUT 10000 // milliseconds
+#define DEVICE_NAME "M and M - Frame 1"
+#define DEVICE_SHORT_NAME "M&M Frame 1" // sent in the scan response next to the state
+
+// Connection parameters asked for while a client streams writes and while it
+// sits idle; intervals in 1.25 ms units, timeouts in 10 ms units. iOS refuses
+// requests outside Apple's accessory guidelines, checked below.
+#define LINK_FAST_MIN_INTERVAL 12 // 15 ms
+#define LINK_FAST_MAX_INTERVAL 24 // 30 ms
+#define LINK_FAST_LATENCY 0
+#define LINK_FAST_TIMEOUT 400
+#define LINK_IDLE_MIN_INTERVAL 80 // 100 ms
+#define LINK_IDLE_MAX_INTERVAL 100
+#define LINK_IDLE_LATENCY 4
+#define LINK_IDLE_TIMEOUT 600
+#define LINK_ALLOWED(min, max, latency, timeout)                                                 \
+  ((min) >= 12 && (min) + 12 <= (max) && (latency) <= 30 && (timeout) >= 200 && (timeout) <= 600 && \
+   (max) * ((latency) + 1) <= 1600 && (timeout) * 8 > (max) * ((latency) + 1) * 3)
+static_assert(LINK_ALLOWED(LINK_FAST_MIN_INTERVAL, LINK_FAST_MAX_INTERVAL, LINK_FAST_LATENCY, LINK_FAST_TIMEOUT),
+              "fast link parameters outside Apple's guidelines");
+static_assert(LINK_ALLOWED(LINK_IDLE_MIN_INTERVAL, LINK_IDLE_MAX_INTERVAL, LINK_IDLE_LATENCY, LINK_IDLE_TIMEOUT),
+              "idle link parameters outside Apple's guidelines");
+#define MAX_TICKETS 8
+#define TICKET_LIFETIME (24UL * 60 * 60 * 1000) // milliseconds a session ticket can be resumed for
+#define STORAGE_NAMESPACE "rgb"
+#define AUDIO_FRAME_INTERVAL 10 // milliseconds between audio-reactive frames
+#define OUTPUT_FRAME_INTERVAL 16 // milliseconds between interpolated frames while a pattern waits for its next step
+#define PATTERN_CATCH_UP 8       // most steps a particle pattern simulates in one update
+
+// Picture frame the strip runs around, in pixels per side.
+#define FRAME_WIDTH 40
+#define FRAME_HEIGHT 26
+#define FRAME_START 0 // pixels from the top-left corner to the first LED
+
+// Heap the active pattern may spend caching one cycle of its frames; 0 renders every frame live.
+#ifndef FRAME_CACHE_BUDGET
+#define FRAME_CACHE_BUDGET 8192
+#endif
+
+FrameStrip strip(NUM_LEDS, LED_PIN, NEO_GRB + NEO_KHZ800);
+FrameLayout<NUM_LEDS> layout;
+TraceRecorder trace;
+FrameStats frameStats;
+LinkTable<MAX_CONNECTIONS> links;
 
 // Create color service and characteristics
 #define COLOR_SERVICE_UUID "f9bbfc69-8184-4a4b-af62-f560441faf50"
 #define SECURITY_SERVICE_UUID "8a6ff27e-42f7-487c-892d-d4276e2b9438"
 #define PASSWORD "ba1109ee-352f-4c22-9c67-b9c5350a2dc8"
+#define OTA_KEY "bd3f7c1e-8a52-4f0b-9e61-2c47d0a95b18" // signs firmware deltas; tools/otadelta takes the same key
 
 #define AUTHENTICATE_CHARACTERISTIC_UUID "e2ded851-c0dd-4dca-b607-2cb0631bc549"
 #define COLOR_CHARACTERISTIC_UUID "6cb02075-6a70-4f34-a51f-15120e7e1e2f"
 #define COLOR_PATTERN_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a664"
 #define PATTERN_RATE_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a663"
 #define RAINBOW_MODE_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a665"
+#define PROGRAM_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a666"
+#define SHOW_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a667"
+#define AUDIO_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a668"
+#define PARAMETER_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a669"
+#define BRIGHTNESS_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a66a"
+#define TRACE_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a66b"
+#define OTA_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a66c"
+#define PALETTE_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a66d"
+#define PRESET_CHARACTERISTIC_UUID "ac1d5ac2-1641-4a96-9297-73a3fda2a66e"
+#define COLOR_SERVICE_HANDLES 64
+
+#define TRACE_HASH_INTERVAL 16 // frames between traced frame hashes
+#define COMMAND_DELAY_SIZE 4    // optional little-endian milliseconds after a colour, rate or brightness value
+
+// On dual-core chips the render loop runs in its own task pinned to
+// RENDER_TASK_CORE, away from the Bluedroid host and controller tasks, and
+// loop() only runs the link pass. Single-core builds leave it undefined and
+// run a render pass and then a link pass from loop().
+//
+// The link pass makes every call into the BLE stack that is not a reply from
+// a callback: session expiry, connection parameters, the OTA source check and
+// its replies, preset notifications and the scan response. The render loop
+// makes none.
+//
+// The BLE callbacks run in another task, and on dual-core chips on another
+// core, so state they share with the render loop or the link pass is handed
+// over:
+//   settings, show play/stop     CommandQueue (COMMAND_*)
+//   and preset recall
+//   applied preset recalls       DeviceSettings::recalls, render loop to link
+//                                pass
+//   pattern parameters           pendingParameters bits
+//   parameter schema             Snapshot, republished by the render loop
+//   program, show and palette    Mailbox, taken by the stores' update()
+//   uploads
+//   firmware updates             OtaCallbacks' phase
+//   sessions                     atomic state, deadline and connection ID;
+//                                the expiry check only reads them and asks
+//                                the stack to disconnect
+//   link opens and closes        LinkTable's EventQueue; writes are atomic
+//                                counts
+// The BLE task and the link pass only read settings back, and read the
+// pattern through patternIndex rather than the String the render loop
+// reassigns. No frame time has been measured on either kind of chip yet;
+// the 'S' serial command prints it.
+#ifdef RENDER_TASK_CORE
+#if defined(CONFIG_FREERTOS_UNICORE) && CONFIG_FREERTOS_UNICORE
+#error "RENDER_TASK_CORE needs a dual-core target"
+#endif
+#if defined(CONFIG_BT_BLUEDROID_PINNED_TO_CORE) && RENDER_TASK_CORE == CONFIG_BT_BLUEDROID_PINNED_TO_CORE
+#error "RENDER_TASK_CORE must differ from the core Bluedroid is pinned to"
+#endif
+#ifndef RENDER_TASK_PRIORITY
+#define RENDER_TASK_PRIORITY 1 // as Arduino's loop task
+#endif
+#define RENDER_TASK_STACK 8192 // bytes
+#define RENDER_TASK_PERIOD 1   // milliseconds from the start of one render pass to the next, at least one tick
+#define LINK_PASS_INTERVAL 5   // milliseconds loop() sleeps between link passes
+#endif
+
+#define MAX_PATTERN_PARAMETERS 8
+#define PARAMETER_SCHEMA_SIZE 192
+
+// Program upload commands, sent as the first byte of each write.
+#define PROGRAM_BEGIN 0x00  // [length lo, length hi]
+#define PROGRAM_DATA 0x01   // [offset lo, offset hi, bytes...]
+#define PROGRAM_COMMIT 0x02 // validate, store and activate
+
+// Challenge-response authentication, sent as the first byte of a write to the
+// authenticate characteristic; writing PASSWORD itself is still accepted.
+// Reading the characteristic before authenticating returns a fresh challenge
+// for that connection.
+#define AUTH_RESPONSE 0x01 // [client nonce (16), HMAC(PASSWORD, challenge | client nonce)]
+#define AUTH_RESUME 0x02   // [ticket ID (8), counter (4), HMAC(ticket key, "resume" | ticket ID | counter)]
+// A successful response is answered with [AUTH_TICKET, ticket ID (8)]. The
+// ticket key, HMAC(PASSWORD, "ticket" | challenge | client nonce), is never sent.
+#define AUTH_TICKET 0x03
+#define AUTH_NONCE_SIZE SESSION_CHALLENGE_SIZE
+#define ATT_DEFAULT_READ 22 // value bytes one read returns at the default 23-byte MTU
+
+// The challenge is set on the characteristic for the reader in onRead and
+// answered from there in the same event. A longer value would be read in
+// several requests, and another connection's read could replace it between
+// them.
+static_assert(AUTH_NONCE_SIZE <= ATT_DEFAULT_READ, "challenge does not fit in one read");
+
+// Show commands, sent as the first byte of each write.
+#define SHOW_UPLOAD 0x00 // [step count, steps...]
+#define SHOW_PLAY 0x01
+#define SHOW_STOP 0x02
+
+#define MAX_SHOW_STEPS 32
+#define SHOW_STEP_SIZE 11
+#define SHOW_DATA_SIZE (1 + MAX_SHOW_STEPS * SHOW_STEP_SIZE) // step count, then the steps
+
+// Preset writes are told apart by length:
+//   [index]                 recall the preset
+//   [index, command]        PRESET_CAPTURE stores the current state, PRESET_CLEAR empties the slot
+//   [index, preset record]  store the record
+// Once the render loop has applied a recall the link pass notifies
+// [index, record] back, the record read from the settings it left, and every
+// state characteristic.
+#define PRESET_CAPTURE 0x00
+#define PRESET_CLEAR 0x01
+#define PRESET_COMMANDS 7 // commands a recall queues at most
+#define PRESET_NOTICES 4  // applied recalls waiting to be notified, power of two
+
+#define MAX_PRESETS 16
+#define PRESET_SIZE 8 // pattern, flags, red, green, blue, interval (ms, 2), brightness
+#define PRESET_EMPTY 0xFF // pattern byte of an unused slot
+
+// Firmware update commands, sent as the first byte of each write.
+#define OTA_BEGIN 0x00  // [delta header]; answered once the running image is checked
+#define OTA_DATA 0x01   // [sequence lo, sequence hi, CRC-32 of the bytes (4), bytes...]
+#define OTA_COMMIT 0x02 // verify, boot the new image and restart
+#define OTA_ABORT 0x03
+
+// Firmware update replies, notified as [status, next sequence lo, hi, bytes written (4)].
+#define OTA_ACK 0x00   // everything before the next sequence is applied
+#define OTA_RESEND 0x01 // a chunk was lost or corrupt; resend from the next sequence
+#define OTA_DONE 0x02
+#define OTA_FAILED 0x03
+
+#define OTA_WINDOW 16          // data chunks the client may send before waiting for an ACK
+#define OTA_CHECK_STEP 16384   // bytes of the running image checked per render pass
+#define OTA_RESTART_DELAY 1000 // milliseconds between OTA_DONE and the restart
+
+// Characteristics by trace ID, as recorded in trace write records.
+const char *const TRACED_CHARACTERISTICS[] = {
+    AUTHENTICATE_CHARACTERISTIC_UUID, COLOR_CHARACTERISTIC_UUID, COLOR_PATTERN_CHARACTERISTIC_UUID,
+    PATTERN_RATE_CHARACTERISTIC_UUID, RAINBOW_MODE_CHARACTERISTIC_UUID, BRIGHTNESS_CHARACTERISTIC_UUID,
+    PROGRAM_CHARACTERISTIC_UUID, SHOW_CHARACTERISTIC_UUID, AUDIO_CHARACTERISTIC_UUID,
+    PARAMETER_CHARACTERISTIC_UUID, PALETTE_CHARACTERISTIC_UUID, PRESET_CHARACTERISTIC_UUID};
+const uint8_t TRACED_CHARACTERISTIC_COUNT = sizeof(TRACED_CHARACTERISTICS) / sizeof(TRACED_CHARACTERISTICS[0]);
+
+// Pattern names by ID, for compact records that refer to a pattern in one byte.
+const char *const PATTERN_NAMES[] = {
+    "flat", "glow", "pulse", "strobe", "fade", "rainbow", "cycle", "breathe", "wave", "fire",
+    "sparkle", "flash", "chase", "twinkle", "meteor", "scanner", "comet", "wipe", "larson",
+    "fireworks", "confetti", "ripple", "noise", "ily", "broken_neon", "apocalypse", "sine",
+    "blizzard", "custom", "audio_pulse", "audio_ripple", "audio_sparkle", "spin",
+    "noise_fire", "noise_field", "noise_blizzard", "palette"};
+const uint8_t PATTERN_COUNT = sizeof(PATTERN_NAMES) / sizeof(PATTERN_NAMES[0]);
+
+int patternID(const String &name)
+{
+  for (uint8_t i = 0; i < PATTERN_COUNT; i++)
+  {
+    if (name == PATTERN_NAMES[i])
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// The uploaded pattern program, persisted in NVS. The BLE task stores an
+// upload and posts it; the render loop picks it up in update().
+class PatternProgramStore
+{
+private:
+  Mailbox<PATTERN_VM_MAX_PROGRAM_SIZE> upload;
+
+public:
+  // Owned by the render loop.
+  uint8_t data[PATTERN_VM_MAX_PROGRAM_SIZE];
+  uint16_t length = 0;
+  uint16_t revision = 0; // bumped whenever the program changes
+
+  void load()
+  {
+    uint8_t program[PATTERN_VM_MAX_PROGRAM_SIZE];
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, true);
+    size_t stored = preferences.getBytesLength("program");
+    if (stored > 0 && stored <= sizeof(program))
+    {
+      this->upload.post(program, preferences.getBytes("program", program, sizeof(program)));
+    }
+    preferences.end();
+  }
+
+  // BLE task. False if the program is invalid or the last one is still
+  // waiting for the render loop.
+  bool save(const uint8_t *program, uint16_t programLength)
+  {
+    if (!PatternVM::validate(program, programLength) || !this->upload.post(program, programLength))
+    {
+      return false;
+    }
+
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, false);
+    preferences.putBytes("program", program, programLength);
+    preferences.end();
+    return true;
+  }
+
+  // BLE task: the program most recently stored.
+  const uint8_t *stored() const
+  {
+    return this->upload.data();
+  }
+
+  size_t storedLength() const
+  {
+    return this->upload.size();
+  }
+
+  // Render loop: takes over a stored program.
+  void update()
+  {
+    size_t taken;
+    if (this->upload.take(this->data, taken))
+    {
+      this->length = taken;
+      this->revision++;
+    }
+  }
+};
+
+// One timed entry of an on-device show. Encoded little-endian as
+// pattern, flags, red, green, blue, interval (ms), duration (100 ms units),
+// transition (ms).
+struct ShowStep
+{
+  uint8_t pattern;
+  uint8_t flags; // bit 0: rainbow mode
+  uint8_t red;
+  uint8_t green;
+  uint8_t blue;
+  uint16_t interval;
+  uint16_t duration;
+  uint16_t transition; // colour and rate blend from the previous step
+};
+
+// The uploaded show playlist and whether it is playing, persisted in NVS so a
+// show keeps running across power cycles without the app. The BLE task stores
+// an upload and posts it, and queues play and stop as COMMAND_SHOW; the render
+// loop picks both up.
+class ShowStore
+{
+private:
+  Mailbox<SHOW_DATA_SIZE> upload;
+  bool requested = false; // the play state last asked for, owned by the BLE task
+
+  static bool validate(const uint8_t *data, size_t length)
+  {
+    if (length < 1)
+    {
+      return false;
+    }
+
+    uint8_t stepCount = data[0];
+    if (stepCount == 0 || stepCount > MAX_SHOW_STEPS || length != 1u + stepCount * SHOW_STEP_SIZE)
+    {
+      return false;
+    }
+
+    // every step names a known pattern and has a non-zero interval and
+    // duration, as a preset record does
+    for (uint8_t i = 0; i < stepCount; i++)
+    {
+      const uint8_t *record = data + 1 + i * SHOW_STEP_SIZE;
+      if (record[0] >= PATTERN_COUNT || (record[5] | record[6]) == 0 || (record[7] | record[8]) == 0)
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void parse(const uint8_t *data)
+  {
+    uint8_t stepCount = data[0];
+    for (uint8_t i = 0; i < stepCount; i++)
+    {
+      const uint8_t *record = data + 1 + i * SHOW_STEP_SIZE;
+      ShowStep &step = this->steps[i];
+      step.pattern = record[0];
+      step.flags = record[1];
+      step.red = record[2];
+      step.green = record[3];
+      step.blue = record[4];
+      step.interval = record[5] | (record[6] << 8);
+      step.duration = record[7] | (record[8] << 8);
+      step.transition = record[9] | (record[10] << 8);
+    }
+    this->count = stepCount;
+  }
+
+public:
+  // Owned by the render loop.
+  ShowStep steps[MAX_SHOW_STEPS];
+  uint8_t count = 0;
+  bool playing = false;
+  uint16_t revision = 0; // bumped whenever the playlist or play state changes
+
+  void load()
+  {
+    uint8_t data[SHOW_DATA_SIZE];
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, true);
+    size_t length = preferences.getBytesLength("show");
+    if (length > 0 && length <= sizeof(data))
+    {
+      length = preferences.getBytes("show", data, sizeof(data));
+      if (validate(data, length))
+      {
+        this->upload.post(data, length);
+      }
+    }
+    this->requested = this->upload.size() > 0 && preferences.getUChar("showPlaying", 0) != 0;
+    this->playing = this->requested;
+    preferences.end();
+  }
+
+  // BLE task. False if the playlist is invalid or the last one is still
+  // waiting for the render loop.
+  bool save(const uint8_t *data, size_t length)
+  {
+    if (!validate(data, length) || !this->upload.post(data, length))
+    {
+      return false;
+    }
+
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, false);
+    preferences.putBytes("show", data, length);
+    preferences.end();
+    return true;
+  }
+
+  // BLE task: records the play state to queue, which is only playing if a
+  // show is stored.
+  bool requestPlaying(bool playing)
+  {
+    this->requested = playing && this->upload.size() > 0;
+
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, false);
+    preferences.putUChar("showPlaying", this->requested ? 1 : 0);
+    preferences.end();
+    return this->requested;
+  }
+
+  // BLE task: the stored show as the app sees it.
+  bool playRequested() const
+  {
+    return this->requested;
+  }
+
+  uint8_t storedCount() const
+  {
+    return this->upload.size() > 0 ? this->upload.data()[0] : 0;
+  }
+
+  // Render loop: takes over a stored playlist.
+  void update()
+  {
+    uint8_t data[SHOW_DATA_SIZE];
+    size_t length;
+    if (this->upload.take(data, length))
+    {
+      this->parse(data);
+      this->revision++;
+    }
+  }
+
+  // Render loop: applies a queued COMMAND_SHOW.
+  void play(bool playing)
+  {
+    this->playing = playing;
+    this->revision++;
+  }
+};
+
+// The uploaded gradient palette, persisted in NVS. Until one is uploaded the
+// palette is a rainbow. The BLE task stores an upload and posts it; the render
+// loop picks it up in update().
+class PaletteStore
+{
+private:
+  Mailbox<PALETTE_MAX_STOPS * PALETTE_STOP_SIZE> upload;
+
+public:
+  // Owned by the render loop.
+  GradientPalette gradient;
+  uint16_t revision = 0; // bumped whenever the gradient changes
+
+  void load()
+  {
+    static const uint8_t rainbow[] = {
+        0, 255, 0, 0,
+        42, 255, 255, 0,
+        85, 0, 255, 0,
+        128, 0, 255, 255,
+        170, 0, 0, 255,
+        212, 255, 0, 255,
+        255, 255, 0, 0};
+
+    uint8_t data[PALETTE_MAX_STOPS * PALETTE_STOP_SIZE];
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, true);
+    size_t length = preferences.getBytesLength("palette");
+    if (length > 0 && length <= sizeof(data))
+    {
+      length = preferences.getBytes("palette", data, sizeof(data));
+      if (GradientPalette::validate(data, length))
+      {
+        this->upload.post(data, length);
+      }
+    }
+    preferences.end();
+
+    if (this->upload.size() == 0)
+    {
+      this->upload.post(rainbow, sizeof(rainbow));
+    }
+  }
+
+  // BLE task. False if the gradient is invalid or the last one is still
+  // waiting for the render loop.
+  bool save(const uint8_t *data, size_t length)
+  {
+    if (!GradientPalette::validate(data, length) || !this->upload.post(data, length))
+    {
+      return false;
+    }
+
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, false);
+    preferences.putBytes("palette", data, length);
+    preferences.end();
+    return true;
+  }
+
+  // BLE task: the gradient most recently stored.
+  const uint8_t *stored() const
+  {
+    return this->upload.data();
+  }
+
+  size_t storedLength() const
+  {
+    return this->upload.size();
+  }
+
+  // Render loop: takes over a stored gradient.
+  void update()
+  {
+    uint8_t data[PALETTE_MAX_STOPS * PALETTE_STOP_SIZE];
+    size_t length;
+    if (this->upload.take(data, length) && this->gradient.parse(data, length))
+    {
+      this->revision++;
+    }
+  }
+};
+
+// A recall the render loop applied, as notified: [index, record].
+struct PresetNotice
+{
+  uint8_t value[1 + PRESET_SIZE];
+};
+
+// Fixed-size preset records, persisted in NVS as one blob so a recall is a
+// RAM copy and a store rewrites a single key.
+class PresetStore
+{
+public:
+  uint8_t records[MAX_PRESETS][PRESET_SIZE];
+
+  PresetStore()
+  {
+    memset(this->records, PRESET_EMPTY, sizeof(this->records));
+  }
+
+  // A record names a known pattern and a non-zero interval.
+  static bool isValid(const uint8_t *record)
+  {
+    return record[0] < PATTERN_COUNT && (record[5] | record[6]) != 0;
+  }
+
+  // Slots that do not hold a valid record, e.g. written by another firmware
+  // version, are loaded as empty.
+  void load()
+  {
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, true);
+    if (preferences.getBytesLength("presets") == sizeof(this->records))
+    {
+      preferences.getBytes("presets", this->records, sizeof(this->records));
+    }
+    preferences.end();
+
+    for (uint8_t index = 0; index < MAX_PRESETS; index++)
+    {
+      if (this->records[index][0] != PRESET_EMPTY && !isValid(this->records[index]))
+      {
+        memset(this->records[index], PRESET_EMPTY, PRESET_SIZE);
+      }
+    }
+  }
+
+  bool isStored(uint8_t index) const
+  {
+    return index < MAX_PRESETS && this->records[index][0] != PRESET_EMPTY;
+  }
+
+  // Stores `record`, or empties the slot if record is null.
+  bool save(uint8_t index, const uint8_t *record)
+  {
+    if (index >= MAX_PRESETS || (record && !isValid(record)))
+    {
+      return false;
+    }
+
+    if (record)
+      memcpy(this->records[index], record, PRESET_SIZE);
+    else
+      memset(this->records[index], PRESET_EMPTY, PRESET_SIZE);
+
+    Preferences preferences;
+    preferences.begin(STORAGE_NAMESPACE, false);
+    preferences.putBytes("presets", this->records, sizeof(this->records));
+    preferences.end();
+    return true;
+  }
+};
 
 class DeviceSettings
 {
@@ -32,371 +632,1649 @@ public:
   uint8_t red;
   uint8_t green;
   uint8_t blue;
-  uint16_t interval;
-  String pattern;
+  uint16_t interval; // milliseconds between pattern frames, rounded from timebase.step()
+  Timebase timebase;
+  std::atomic<uint32_t> stepMicros{50000}; // timebase.step(), for the BLE task to read
+  String pattern; // set only by the render loop, through setPattern()
+  std::atomic<uint8_t> patternIndex{0}; // the same pattern, for the BLE task to read
   bool rainbow;
+  uint8_t brightness; // applied at output, independent of the colour
+  unsigned long restartAt = 0; // millis() at which to restart into a new image, 0 for never
+
+  SessionTable<MAX_CONNECTIONS> sessions;
+  TicketTable<MAX_TICKETS> tickets;
+  CommandQueue<COMMAND_CAPACITY> commands;
+  EventQueue<PresetNotice, PRESET_NOTICES> recalls; // applied by the render loop, notified by the link pass
+  PatternProgramStore programs;
+  ShowStore show;
+  PaletteStore palettes;
+  PresetStore presets;
+  Palette palette; // the stored gradient expanded, rebuilt by the render loop
+  uint16_t paletteRevision = 0;
+  AudioFeatureBuffer audio;
+
+  // Parameter writes waiting for the render loop, one bit per parameter ID.
+  std::atomic<uint16_t> pendingParameters{0};
+  int16_t parameterValues[MAX_PATTERN_PARAMETERS];
+
+  // The active pattern's parameter schema, republished by the render loop.
+  Snapshot<PARAMETER_SCHEMA_SIZE> parameterSchema;
 
-  std::unordered_map<uint16_t, unsigned long> *devicesPendingAuthentication;
-  std::unordered_set<uint16_t> *authenticatedDeviceSet;
   DeviceSettings()
   {
     red = 125;
     green = 125;
     blue = 125;
-    pattern = "rainbow";
+    setPattern(patternID("rainbow"));
     interval = 50;
     rainbow = false;
-    devicesPendingAuthentication = new std::unordered_map<uint16_t, unsigned long>();
-    authenticatedDeviceSet = new std::unordered_set<uint16_t>();
+    brightness = BRIGHTNESS;
+  }
+
+  bool isAuthenticated(uint16_t connectionID)
+  {
+    return this->sessions.isAuthenticated(connectionID);
+  }
+
+  // Re-expands the palette table if a new gradient was stored.
+  void refreshPalette()
+  {
+    if (this->paletteRevision != this->palettes.revision)
+    {
+      this->paletteRevision = this->palettes.revision;
+      this->palette.load(this->palettes.gradient);
+    }
+  }
+
+  // Render loop: switches to a pattern by ID.
+  void setPattern(uint8_t id)
+  {
+    this->pattern = PATTERN_NAMES[id];
+    this->patternIndex.store(id, std::memory_order_relaxed);
+  }
+
+  // The current pattern's name, safe to read from the BLE task.
+  const char *patternName() const
+  {
+    return PATTERN_NAMES[this->patternIndex.load(std::memory_order_relaxed)];
+  }
+
+  // Sets the pattern rate as the length of one step in microseconds.
+  void setRate(uint32_t stepMicros)
+  {
+    this->timebase.setStep(stepMicros);
+    this->interval = min(stepMicros / 1000, (uint32_t)UINT16_MAX);
+    this->stepMicros.store(this->timebase.step(), std::memory_order_relaxed);
+  }
+
+  // The pattern rate as the pattern rate characteristic takes it: a
+  // little-endian double, the step length as a multiple of baseInterval.
+  void encodeRate(uint8_t *value) const
+  {
+    double rate = this->stepMicros.load(std::memory_order_relaxed) / (baseInterval * 1000.0);
+    memcpy(value, &rate, sizeof(rate));
+  }
+
+  // The current state as a preset record.
+  void capturePreset(uint8_t *record)
+  {
+    record[0] = this->patternIndex.load(std::memory_order_relaxed);
+    record[1] = this->rainbow ? 0x01 : 0x00;
+    record[2] = this->red;
+    record[3] = this->green;
+    record[4] = this->blue;
+    record[5] = this->interval & 0xFF;
+    record[6] = this->interval >> 8;
+    record[7] = this->brightness;
+  }
+
+  // BLE task: queues a record's settings for the render loop, stopping a
+  // playing show, and then COMMAND_PRESET so the recall is notified once they
+  // are applied. False, queuing nothing, if the record is not valid or the
+  // queue has no room for all of it.
+  bool recallPreset(uint8_t index, const uint8_t *record)
+  {
+    if (!PresetStore::isValid(record) || this->commands.space() < PRESET_COMMANDS)
+    {
+      return false;
+    }
+
+    unsigned long now = millis();
+    if (this->show.playRequested())
+    {
+      this->show.requestPlaying(false);
+      this->commands.push(COMMAND_SHOW, 0, now);
+    }
+    this->commands.push(COMMAND_PATTERN, record[0], now);
+    this->commands.push(COMMAND_RAINBOW, record[1] & 0x01, now);
+    this->commands.push(COMMAND_COLOR, ((uint32_t)record[2] << 16) | ((uint32_t)record[3] << 8) | record[4], now);
+    this->commands.push(COMMAND_RATE, (record[5] | (record[6] << 8)) * 1000UL, now);
+    this->commands.push(COMMAND_BRIGHTNESS, record[7], now);
+    this->commands.push(COMMAND_PRESET, index, now);
+    return true;
+  }
+
+  int generateHexCode()
+  {
+    return (this->red << 16) | (this->green << 8) | this->blue;
+  }
+
+  int rainbowMode()
+  {
+    return this->rainbow ? 1 : 0;
+  }
+};
+
+// The GATT interface of the server, recorded from its events: sending to a
+// single connection needs it, and the server does not expose it.
+std::atomic<esp_gatt_if_t> gattsInterface{ESP_GATT_IF_NONE};
+
+void recordGattsInterface(esp_gatts_cb_event_t event, esp_gatt_if_t gattsIf, esp_ble_gatts_cb_param_t *)
+{
+  if (event == ESP_GATTS_CONNECT_EVT)
+  {
+    gattsInterface.store(gattsIf, std::memory_order_relaxed);
+  }
+}
+
+// Notifies `value` on `characteristic` to one connection. The
+// characteristic's own value, which other connections read, is left alone.
+void notifyConnection(BLECharacteristic *characteristic, uint16_t connectionID, const uint8_t *value, size_t length)
+{
+  esp_ble_gatts_send_indicate(gattsInterface.load(std::memory_order_relaxed), connectionID, characteristic->getHandle(),
+                              length, (uint8_t *)value, false);
+}
+
+void notifyConnection(BLECharacteristic *characteristic, uint16_t connectionID, const char *value)
+{
+  notifyConnection(characteristic, connectionID, (const uint8_t *)value, strlen(value));
+}
+
+// Notifies one connection of every setting, on connect and after a preset
+// changes several at once.
+void notifyState(BLEServer *pServer, DeviceSettings *deviceSettings, uint16_t connectionID)
+{
+  BLEService *service = pServer->getServiceByUUID(COLOR_SERVICE_UUID);
+
+  // The current color setting.
+  auto colorCharacteristic = service->getCharacteristic(COLOR_CHARACTERISTIC_UUID);
+  if (colorCharacteristic != nullptr)
+  {
+    int color = deviceSettings->generateHexCode();
+    notifyConnection(colorCharacteristic, connectionID, (const uint8_t *)&color, sizeof(color));
+  }
+
+  // The current rainbow mode setting.
+  auto rainbowCharacteristic = service->getCharacteristic(RAINBOW_MODE_CHARACTERISTIC_UUID);
+  if (rainbowCharacteristic != nullptr)
+  {
+    int rainbowValue = deviceSettings->rainbowMode();
+    notifyConnection(rainbowCharacteristic, connectionID, (const uint8_t *)&rainbowValue, sizeof(rainbowValue));
+  }
+
+  // COLOR_PATTERN_CHARACTERISTIC_UUID
+  auto patternCharacteristic = service->getCharacteristic(COLOR_PATTERN_CHARACTERISTIC_UUID);
+  if (patternCharacteristic != nullptr)
+  {
+    notifyConnection(patternCharacteristic, connectionID, deviceSettings->patternName());
+  }
+
+  // BRIGHTNESS_CHARACTERISTIC_UUID
+  auto brightnessCharacteristic = service->getCharacteristic(BRIGHTNESS_CHARACTERISTIC_UUID);
+  if (brightnessCharacteristic != nullptr)
+  {
+    uint8_t brightness = deviceSettings->brightness;
+    notifyConnection(brightnessCharacteristic, connectionID, &brightness, 1);
+  }
+
+  // PATTERN_RATE_CHARACTERISTIC_UUID
+  auto patternRateCharacteristic = service->getCharacteristic(PATTERN_RATE_CHARACTERISTIC_UUID);
+  if (patternRateCharacteristic != nullptr)
+  {
+    uint8_t rate[sizeof(double)];
+    deviceSettings->encodeRate(rate);
+    notifyConnection(patternRateCharacteristic, connectionID, rate, sizeof(rate));
+  }
+}
+
+// Notifies every open link of a recalled preset as [index, record], the
+// record read back from the settings the recall left, and then of every
+// setting.
+void notifyPreset(BLEServer *pServer, DeviceSettings *deviceSettings, const PresetNotice &notice)
+{
+  auto presetCharacteristic = pServer->getServiceByUUID(COLOR_SERVICE_UUID)
+                                  ->getCharacteristic(PRESET_CHARACTERISTIC_UUID);
+  for (uint8_t i = 0; i < links.capacity(); i++)
+  {
+    const Link &link = links.at(i);
+    if (!link.used)
+    {
+      continue;
+    }
+    if (presetCharacteristic != nullptr)
+    {
+      notifyConnection(presetCharacteristic, link.connectionID, notice.value, sizeof(notice.value));
+    }
+    notifyState(pServer, deviceSettings, link.connectionID);
+  }
+}
+
+class ServerCallbacks : public BLEServerCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+
+public:
+  ServerCallbacks(DeviceSettings *deviceSettings)
+  {
+    this->deviceSettings = deviceSettings;
+  };
+
+  void onConnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) override
+  {
+    // Add the device ID for authentication.
+    auto connectionID = param->connect.conn_id;
+    trace.event(millis(), TRACE_CONNECT, connectionID);
+    if (this->deviceSettings->sessions.open(connectionID, millis() + AUTHENTICATION_TIMEOUT) == nullptr)
+    {
+      Serial.printf("No free session slot for connection ID: %d\n", connectionID);
+      pServer->disconnect(connectionID);
+      return;
+    }
+    links.open(connectionID, param->connect.remote_bda);
+
+    pServer->startAdvertising();
+    notifyState(pServer, this->deviceSettings, connectionID);
+
+    Serial.println("Client connected");
+    Serial.printf("Connected client count: %d\n", pServer->getConnectedCount());
+  };
+
+  void onDisconnect(BLEServer *pServer, esp_ble_gatts_cb_param_t *param) override
+  {
+    pServer->startAdvertising();
+
+    auto connectionID = param->disconnect.conn_id;
+    trace.event(millis(), TRACE_DISCONNECT, connectionID);
+    this->deviceSettings->sessions.close(connectionID);
+    links.close(connectionID);
+
+    Serial.println("Client disconnected");
+  }
+};
+
+// Records every write to the trace before handing it to the real callbacks.
+// Authentication payloads are never recorded.
+class TracingCallbacks : public BLECharacteristicCallbacks
+{
+private:
+  uint8_t characteristic;
+  BLECharacteristicCallbacks *inner;
+
+public:
+  TracingCallbacks(const char *uuid, BLECharacteristicCallbacks *inner)
+  {
+    this->characteristic = 0;
+    for (uint8_t i = 0; i < TRACED_CHARACTERISTIC_COUNT; i++)
+    {
+      if (strcmp(uuid, TRACED_CHARACTERISTICS[i]) == 0)
+      {
+        this->characteristic = i;
+      }
+    }
+    this->inner = inner;
+  }
+
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    trace.write(millis(), this->characteristic, param->write.conn_id, pCharacteristic->getData(), pCharacteristic->getLength(),
+                this->characteristic == 0);
+    links.write(param->write.conn_id);
+    this->inner->onWrite(pCharacteristic, param);
+  }
+
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    this->inner->onRead(pCharacteristic, param);
+  }
+};
+
+class AuthenticatedBLECharacteristicCallbacks : public BLECharacteristicCallbacks
+{
+
+protected:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+
+  AuthenticatedBLECharacteristicCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : BLECharacteristicCallbacks()
+  {
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
+  }
+
+  // Hands a setting change to the render loop, to apply `delay` milliseconds
+  // from now.
+  void queue(uint8_t field, uint32_t value, uint32_t delay = 0)
+  {
+    if (!this->deviceSettings->commands.push(field, value, millis() + delay))
+    {
+      Serial.println("Command queue full, write dropped.");
+    }
+  }
+
+  static uint32_t readDelay(const uint8_t *data)
+  {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+  }
+
+  bool isAuthenticated(uint16_t connectionID)
+  {
+    return this->deviceSettings->isAuthenticated(connectionID);
+  }
+
+public:
+  virtual ~AuthenticatedBLECharacteristicCallbacks() {}
+  virtual void onWrite(BLECharacteristic *characteristic, esp_ble_gatts_cb_param_t *param) = 0;
+  virtual void onRead(BLECharacteristic *characteristic, esp_ble_gatts_cb_param_t *param) = 0;
+};
+
+class RainbowModeCallbacks : public AuthenticatedBLECharacteristicCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+
+public:
+  RainbowModeCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  {
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
+  }
+
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->write.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to rainbow mode characteristic.");
+      return;
+    }
+
+    String value = pCharacteristic->getValue();
+
+    if (value.length() > 0)
+    {
+      this->queue(COMMAND_RAINBOW, value == "1" ? 1 : 0);
+      Serial.printf("Rainbow mode set to: %d\n", value == "1" ? 1 : 0);
+    }
+  }
+
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->read.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to rainbow mode characteristic.");
+      return;
+    }
+
+    int rainbowValue = this->deviceSettings->rainbowMode();
+    pCharacteristic->setValue(rainbowValue);
+    Serial.printf("Rainbow mode read as: %d\n", rainbowValue);
+  }
+};
+
+class AuthenticationCallbacks : public BLECharacteristicCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+
+  // Checks an AUTH_RESPONSE against the connection's challenge and issues a
+  // ticket; `reply` gets the AUTH_TICKET message.
+  bool respond(uint16_t connectionID, const uint8_t *data, size_t length, uint8_t *reply)
+  {
+    Session *session = this->deviceSettings->sessions.find(connectionID);
+    if (session == nullptr || !session->challenged || length != AUTH_NONCE_SIZE + SHA256_SIZE)
+    {
+      return false;
+    }
+    session->challenged = false; // each challenge can be answered once
+
+    const uint8_t *clientNonce = data;
+    uint8_t expected[SHA256_SIZE];
+    hmacSha256((const uint8_t *)PASSWORD, strlen(PASSWORD), session->challenge, AUTH_NONCE_SIZE,
+               clientNonce, AUTH_NONCE_SIZE, nullptr, 0, expected);
+    if (!macEqual(expected, data + AUTH_NONCE_SIZE, SHA256_SIZE))
+    {
+      return false;
+    }
+
+    static const uint8_t label[] = {'t', 'i', 'c', 'k', 'e', 't'};
+    uint8_t key[SHA256_SIZE];
+    hmacSha256((const uint8_t *)PASSWORD, strlen(PASSWORD), label, sizeof(label),
+               session->challenge, AUTH_NONCE_SIZE, clientNonce, AUTH_NONCE_SIZE, key);
+
+    reply[0] = AUTH_TICKET;
+    for (uint8_t i = 0; i < TICKET_ID_SIZE; i += 4)
+    {
+      uint32_t random = esp_random();
+      memcpy(reply + 1 + i, &random, 4);
+    }
+    this->deviceSettings->tickets.issue(reply + 1, key, millis());
+    return true;
+  }
+
+  bool resume(const uint8_t *data, size_t length)
+  {
+    if (length != TICKET_ID_SIZE + 4 + SHA256_SIZE)
+    {
+      return false;
+    }
+    uint32_t counter = data[8] | (data[9] << 8) | (data[10] << 16) | ((uint32_t)data[11] << 24);
+    return this->deviceSettings->tickets.resume(data, counter, data + TICKET_ID_SIZE + 4, millis(), TICKET_LIFETIME);
+  }
+
+  void accept(uint16_t connectionID)
+  {
+    Serial.printf("Authentication successful for connection ID: %d\n", connectionID);
+    this->deviceSettings->sessions.authenticate(connectionID);
+  }
+
+  void reject(uint16_t connectionID)
+  {
+    Serial.println("Authentication failed.");
+    this->pServer->disconnect(connectionID);
+    this->deviceSettings->sessions.close(connectionID);
+  }
+
+public:
+  AuthenticationCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer)
+  {
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
+  }
+
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    const uint8_t *data = pCharacteristic->getData();
+    size_t length = pCharacteristic->getLength();
+    auto connectionID = param->write.conn_id;
+
+    if (length > 0 && data[0] == AUTH_RESPONSE)
+    {
+      uint8_t reply[1 + TICKET_ID_SIZE];
+      if (!this->respond(connectionID, data + 1, length - 1, reply))
+      {
+        this->reject(connectionID);
+        return;
+      }
+      this->accept(connectionID);
+      notifyConnection(pCharacteristic, connectionID, reply, sizeof(reply));
+      return;
+    }
+
+    if (length > 0 && data[0] == AUTH_RESUME)
+    {
+      // A stale ticket is not an attack: leave the connection up so the
+      // client can fall back to the challenge.
+      bool ok = this->resume(data + 1, length - 1);
+      if (ok)
+      {
+        this->accept(connectionID);
+      }
+      notifyConnection(pCharacteristic, connectionID, ok ? "OK" : "ERR");
+      return;
+    }
+
+    String value = pCharacteristic->getValue();
+
+    Serial.printf("Attempting to authorize connection %d with a password\n", connectionID);
+
+    if (value.length() > 0 && value == PASSWORD)
+    {
+      this->accept(connectionID);
+      notifyConnection(pCharacteristic, connectionID, "OK");
+    }
+    else if (value == "OK")
+    {
+      return;
+    }
+    else
+    {
+      this->reject(connectionID);
+    }
+  }
+
+  // Hands a pending connection a new challenge. Reads are answered to the
+  // reader only, so the challenge is not broadcast like a notification.
+  // Anyone else reads nothing, not the last challenge or the last write.
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    Session *session = this->deviceSettings->sessions.find(param->read.conn_id);
+    if (session == nullptr || session->state != SessionState::Pending)
+    {
+      pCharacteristic->setValue((const uint8_t *)"", 0);
+      return;
+    }
+
+    for (uint8_t i = 0; i < AUTH_NONCE_SIZE; i += 4)
+    {
+      uint32_t random = esp_random();
+      memcpy(session->challenge + i, &random, 4);
+    }
+    session->challenged = true;
+    pCharacteristic->setValue(session->challenge, AUTH_NONCE_SIZE);
+  }
+};
+
+class PatternCallbacks : public AuthenticatedBLECharacteristicCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+
+public:
+  PatternCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  {
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
+  }
+
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->write.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to pattern characteristic.");
+      return;
+    }
+
+    String value = pCharacteristic->getValue();
+
+    if (value.length() > 0)
+    {
+      int id = patternID(value);
+      if (id < 0)
+      {
+        Serial.printf("Unknown pattern: %s\n", value.c_str());
+        return;
+      }
+      this->queue(COMMAND_PATTERN, id);
+      Serial.printf("Pattern set to: %s\n", value.c_str());
+    }
+  }
+
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->read.conn_id))
+    {
+      Serial.println("Unauthorized read attempt to pattern characteristic.");
+      return;
+    }
+
+    String pattern = deviceSettings->patternName();
+    pCharacteristic->setValue(pattern);
+    Serial.printf("Pattern read as: %s\n", pattern.c_str());
+  }
+};
+
+class PatternRateCallbacks : public AuthenticatedBLECharacteristicCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+
+public:
+  PatternRateCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  {
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
+  }
+
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->write.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to pattern rate characteristic.");
+      return;
+    }
+
+    String value = pCharacteristic->getValue();
+
+    if (value.length() == 8 || value.length() == 8 + COMMAND_DELAY_SIZE)
+    {
+      double receivedDouble;
+      memcpy(&receivedDouble, value.c_str(), sizeof(double));
+      if (receivedDouble >= 0 && receivedDouble * DeviceSettings::baseInterval <= UINT16_MAX)
+      {
+        uint32_t delay = value.length() > 8 ? readDelay(pCharacteristic->getData() + 8) : 0;
+        this->queue(COMMAND_RATE, lround(receivedDouble * DeviceSettings::baseInterval * 1000), delay);
+      }
+
+      Serial.print("Received double: ");
+      Serial.println(receivedDouble, 6);
+    }
+    else
+    {
+      Serial.println("Received data length mismatch!");
+    }
+  }
+
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->read.conn_id))
+    {
+      Serial.println("Unauthorized read attempt to pattern rate characteristic.");
+      return;
+    }
+
+    uint8_t rate[sizeof(double)];
+    deviceSettings->encodeRate(rate);
+    pCharacteristic->setValue(rate, sizeof(rate));
+    Serial.printf("Pattern rate read as: %lu us\n", (unsigned long)deviceSettings->stepMicros.load(std::memory_order_relaxed));
+  }
+};
+
+class ColorCharacteristicCallbacks : public AuthenticatedBLECharacteristicCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+
+public:
+  ColorCharacteristicCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  {
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
+  }
+
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->write.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to color characteristic.");
+      return;
+    }
+
+    String value = pCharacteristic->getValue();
+    if (value.length() == 3 || value.length() == 3 + COMMAND_DELAY_SIZE)
+    {
+      uint8_t red = value[0], green = value[1], blue = value[2];
+      uint32_t delay = value.length() > 3 ? readDelay(pCharacteristic->getData() + 3) : 0;
+      this->queue(COMMAND_COLOR, ((uint32_t)red << 16) | ((uint32_t)green << 8) | blue, delay);
+      Serial.printf("Color set to: R=%d, G=%d, B=%d\n", red, green, blue);
+    }
+  }
+
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->read.conn_id))
+    {
+      Serial.println("Unauthorized read attempt to color characteristic.");
+      return;
+    }
+
+    uint8_t colorValue[3] = {this->deviceSettings->red, this->deviceSettings->green, this->deviceSettings->blue};
+    pCharacteristic->setValue(colorValue, 3);
+    Serial.printf("Color read as: R=%d, G=%d, B=%d\n", this->deviceSettings->red, this->deviceSettings->green, this->deviceSettings->blue);
+  }
+};
+
+class BrightnessCallbacks : public AuthenticatedBLECharacteristicCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+
+public:
+  BrightnessCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  {
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
+  }
+
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->write.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to brightness characteristic.");
+      return;
+    }
+
+    size_t length = pCharacteristic->getLength();
+    if (length == 1 || length == 1 + COMMAND_DELAY_SIZE)
+    {
+      const uint8_t *data = pCharacteristic->getData();
+      this->queue(COMMAND_BRIGHTNESS, data[0], length > 1 ? readDelay(data + 1) : 0);
+      Serial.printf("Brightness set to: %d\n", data[0]);
+    }
+  }
+
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->read.conn_id))
+    {
+      Serial.println("Unauthorized read attempt to brightness characteristic.");
+      return;
+    }
+
+    uint8_t brightness = this->deviceSettings->brightness;
+    pCharacteristic->setValue(&brightness, 1);
   }
+};
 
-  bool isAuthenticated(uint16_t connectionID)
+// Dumps the trace as text. A write rewinds to the oldest record; each read
+// returns as many whole lines as fit, and an empty value once done.
+class TraceCallbacks : public AuthenticatedBLECharacteristicCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+  uint32_t cursor = 0;
+  char buffer[500];
+
+public:
+  TraceCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
   {
-    return this->authenticatedDeviceSet->find(connectionID) != this->authenticatedDeviceSet->end();
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
   }
 
-  int generateHexCode()
+  // Not wrapped in TracingCallbacks, so a rewind is not itself recorded;
+  // the write still counts towards the link's rate.
+  void onWrite(BLECharacteristic *, esp_ble_gatts_cb_param_t *param) override
   {
-    return (this->red << 16) | (this->green << 8) | this->blue;
+    links.write(param->write.conn_id);
+    if (!this->isAuthenticated(param->write.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to trace characteristic.");
+      return;
+    }
+
+    this->cursor = trace.begin();
   }
 
-  int rainbowMode()
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    return this->rainbow ? 1 : 0;
+    if (!this->isAuthenticated(param->read.conn_id))
+    {
+      Serial.println("Unauthorized read attempt to trace characteristic.");
+      return;
+    }
+
+    size_t length = 0;
+    this->cursor = max(this->cursor, trace.begin());
+    while (this->cursor < trace.end())
+    {
+      size_t line = trace.format(this->cursor, this->buffer + length, sizeof(this->buffer) - length);
+      if (line == 0)
+      {
+        break;
+      }
+      length += line;
+      this->cursor++;
+    }
+
+    pCharacteristic->setValue((uint8_t *)this->buffer, length);
   }
 };
 
-class ServerCallbacks : public BLEServerCallbacks
+class ProgramCallbacks : public AuthenticatedBLECharacteristicCallbacks
 {
 private:
   DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+  uint8_t staging[PATTERN_VM_MAX_PROGRAM_SIZE];
+  uint16_t expectedLength = 0;
+  uint16_t receivedLength = 0;
+
+  void reply(BLECharacteristic *pCharacteristic, const char *status)
+  {
+    pCharacteristic->setValue(status);
+    pCharacteristic->notify();
+  }
 
 public:
-  ServerCallbacks(DeviceSettings *deviceSettings)
+  ProgramCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
   {
     this->deviceSettings = deviceSettings;
-  };
+    this->pServer = pServer;
+  }
 
-  void onConnect(BLEServer *pServer)
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    // Add the device ID for authentication.
-    this->deviceSettings->devicesPendingAuthentication->insert({pServer->getConnId(), millis()});
+    if (!this->isAuthenticated(param->write.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to program characteristic.");
+      return;
+    }
 
-    pServer->startAdvertising();
-    auto colorCharacteristic = pServer->getServiceByUUID(COLOR_SERVICE_UUID)
-                                   ->getCharacteristic(COLOR_CHARACTERISTIC_UUID);
+    const uint8_t *value = pCharacteristic->getData();
+    size_t length = pCharacteristic->getLength();
+    if (length == 0)
+    {
+      return;
+    }
+
+    switch (value[0])
+    {
+    case PROGRAM_BEGIN:
+      if (length != 3)
+      {
+        break;
+      }
+      this->expectedLength = value[1] | (value[2] << 8);
+      this->receivedLength = 0;
+      if (this->expectedLength > sizeof(this->staging))
+      {
+        Serial.printf("Program of %d bytes is too large.\n", this->expectedLength);
+        this->expectedLength = 0;
+        this->reply(pCharacteristic, "ERR");
+      }
+      return;
+
+    case PROGRAM_DATA:
+    {
+      if (length < 3)
+      {
+        break;
+      }
+      uint16_t offset = value[1] | (value[2] << 8);
+      uint16_t chunk = length - 3;
+      if (offset != this->receivedLength || offset + chunk > this->expectedLength)
+      {
+        Serial.println("Out of order program chunk.");
+        this->expectedLength = 0;
+        this->receivedLength = 0;
+        this->reply(pCharacteristic, "ERR");
+        return;
+      }
+      memcpy(this->staging + offset, value + 3, chunk);
+      this->receivedLength += chunk;
+      return;
+    }
+
+    case PROGRAM_COMMIT:
+      if (this->expectedLength > 0 && this->receivedLength == this->expectedLength &&
+          this->deviceSettings->programs.save(this->staging, this->receivedLength))
+      {
+        Serial.printf("Program stored (%d bytes).\n", this->receivedLength);
+        this->expectedLength = 0;
+        this->reply(pCharacteristic, "OK");
+        return;
+      }
+      break;
+    }
+
+    Serial.println("Program upload rejected.");
+    this->expectedLength = 0;
+    this->receivedLength = 0;
+    this->reply(pCharacteristic, "ERR");
+  }
 
-    // Notify the newly connected client of the current color setting.
-    if (colorCharacteristic != nullptr)
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->read.conn_id))
     {
-      int color = this->deviceSettings->generateHexCode();
-      colorCharacteristic->setValue(color);
-      colorCharacteristic->notify();
+      Serial.println("Unauthorized read attempt to program characteristic.");
+      return;
     }
 
-    // Notify the newly connected client of the current rainbow mode setting.
-    auto rainbowCharacteristic = pServer->getServiceByUUID(COLOR_SERVICE_UUID)
-                                     ->getCharacteristic(RAINBOW_MODE_CHARACTERISTIC_UUID);
-    if (rainbowCharacteristic != nullptr)
+    pCharacteristic->setValue((uint8_t *)this->deviceSettings->programs.stored(), this->deviceSettings->programs.storedLength());
+  }
+};
+
+class ShowCallbacks : public AuthenticatedBLECharacteristicCallbacks
+{
+private:
+  DeviceSettings *deviceSettings;
+  BLEServer *pServer;
+
+public:
+  ShowCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  {
+    this->deviceSettings = deviceSettings;
+    this->pServer = pServer;
+  }
+
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->write.conn_id))
     {
-      int rainbowValue = deviceSettings->rainbowMode();
-      rainbowCharacteristic->setValue(rainbowValue);
-      rainbowCharacteristic->notify();
+      Serial.println("Unauthorized write attempt to show characteristic.");
+      return;
     }
 
-    // COLOR_PATTERN_CHARACTERISTIC_UUID
-    auto patternCharacteristic = pServer->getServiceByUUID(COLOR_SERVICE_UUID)
-                                     ->getCharacteristic(COLOR_PATTERN_CHARACTERISTIC_UUID);
-    if (patternCharacteristic != nullptr)
+    const uint8_t *value = pCharacteristic->getData();
+    size_t length = pCharacteristic->getLength();
+    if (length == 0)
     {
-      String pattern = deviceSettings->pattern;
-      patternCharacteristic->setValue(pattern);
-      patternCharacteristic->notify();
+      return;
     }
 
-    // PATTERN_RATE_CHARACTERISTIC_UUID
-    auto patternRateCharacteristic = pServer->getServiceByUUID(COLOR_SERVICE_UUID)
-                                         ->getCharacteristic(PATTERN_RATE_CHARACTERISTIC_UUID);
-    if (patternRateCharacteristic != nullptr)
+    bool ok = true;
+    switch (value[0])
     {
-      auto interval = deviceSettings->interval;
-      patternRateCharacteristic->setValue(interval);
-      patternRateCharacteristic->notify();
+    case SHOW_UPLOAD:
+      ok = this->deviceSettings->show.save(value + 1, length - 1);
+      Serial.printf("Show upload %s (%d steps).\n", ok ? "stored" : "rejected", this->deviceSettings->show.storedCount());
+      break;
+    case SHOW_PLAY:
+      ok = this->deviceSettings->show.requestPlaying(true);
+      this->queue(COMMAND_SHOW, ok ? 1 : 0);
+      break;
+    case SHOW_STOP:
+      this->deviceSettings->show.requestPlaying(false);
+      this->queue(COMMAND_SHOW, 0);
+      break;
+    default:
+      ok = false;
+      break;
     }
 
-    Serial.println("Client connected");
-    Serial.printf("Connected client count: %d\n", pServer->getConnectedCount());
-  };
+    pCharacteristic->setValue(ok ? "OK" : "ERR");
+    pCharacteristic->notify();
+  }
 
-  void onDisconnect(BLEServer *pServer)
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    pServer->startAdvertising();
-
-    auto connectionID = pServer->getConnId();
-    this->deviceSettings->devicesPendingAuthentication->erase(connectionID);
-    this->deviceSettings->authenticatedDeviceSet->erase(connectionID);
+    if (!this->isAuthenticated(param->read.conn_id))
+    {
+      Serial.println("Unauthorized read attempt to show characteristic.");
+      return;
+    }
 
-    Serial.println("Client disconnected");
+    uint8_t state[2] = {this->deviceSettings->show.storedCount(), (uint8_t)(this->deviceSettings->show.playRequested() ? 1 : 0)};
+    pCharacteristic->setValue(state, 2);
   }
 };
 
-class AuthenticatedBLECharacteristicCallbacks : public BLECharacteristicCallbacks
+class PaletteCallbacks : public AuthenticatedBLECharacteristicCallbacks
 {
-
-protected:
+private:
   DeviceSettings *deviceSettings;
   BLEServer *pServer;
 
-  AuthenticatedBLECharacteristicCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : BLECharacteristicCallbacks()
+public:
+  PaletteCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
   {
     this->deviceSettings = deviceSettings;
     this->pServer = pServer;
   }
 
-  bool isAuthenticated()
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    return this->deviceSettings->isAuthenticated(this->pServer->getConnId());
+    if (!this->isAuthenticated(param->write.conn_id))
+    {
+      Serial.println("Unauthorized write attempt to palette characteristic.");
+      return;
+    }
+
+    size_t length = pCharacteristic->getLength();
+    bool ok = this->deviceSettings->palettes.save(pCharacteristic->getData(), length);
+    Serial.printf("Palette upload %s (%d stops).\n", ok ? "stored" : "rejected", (int)(length / PALETTE_STOP_SIZE));
+
+    pCharacteristic->setValue(ok ? "OK" : "ERR");
+    pCharacteristic->notify();
   }
 
-public:
-  virtual ~AuthenticatedBLECharacteristicCallbacks() {}
-  virtual void onWrite(BLECharacteristic *characteristic) = 0;
-  virtual void onRead(BLECharacteristic *characteristic) = 0;
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->read.conn_id))
+    {
+      Serial.println("Unauthorized read attempt to palette characteristic.");
+      return;
+    }
+
+    pCharacteristic->setValue((uint8_t *)this->deviceSettings->palettes.stored(), this->deviceSettings->palettes.storedLength());
+  }
 };
 
-class RainbowModeCallbacks : public AuthenticatedBLECharacteristicCallbacks
+class PresetCallbacks : public AuthenticatedBLECharacteristicCallbacks
 {
 private:
   DeviceSettings *deviceSettings;
   BLEServer *pServer;
 
 public:
-  RainbowModeCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  PresetCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
   {
     this->deviceSettings = deviceSettings;
     this->pServer = pServer;
   }
 
-  void onWrite(BLECharacteristic *pCharacteristic) override
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    if (!this->isAuthenticated())
+    if (!this->isAuthenticated(param->write.conn_id))
     {
-      Serial.println("Unauthorized write attempt to rainbow mode characteristic.");
+      Serial.println("Unauthorized write attempt to preset characteristic.");
       return;
     }
 
-    String value = pCharacteristic->getValue();
+    const uint8_t *value = pCharacteristic->getData();
+    size_t length = pCharacteristic->getLength();
+    PresetStore &presets = this->deviceSettings->presets;
+    if (length == 0)
+    {
+      return;
+    }
 
-    if (value.length() > 0)
+    uint8_t index = value[0];
+    if (length == 1)
     {
-      this->deviceSettings->rainbow = (value == "1");
-      Serial.printf("Rainbow mode set to: %d\n", deviceSettings->rainbow ? 1 : 0);
+      // a recalled preset takes over from a playing show; the link pass
+      // notifies it once the render loop has applied it
+      if (!presets.isStored(index) || !this->deviceSettings->recallPreset(index, presets.records[index]))
+      {
+        pCharacteristic->setValue("ERR");
+        pCharacteristic->notify();
+        return;
+      }
+      Serial.printf("Preset %d recalled.\n", index);
+      return;
+    }
+
+    bool ok = false;
+    if (length == 2 && value[1] == PRESET_CAPTURE)
+    {
+      uint8_t record[PRESET_SIZE];
+      this->deviceSettings->capturePreset(record);
+      ok = presets.save(index, record);
+    }
+    else if (length == 2 && value[1] == PRESET_CLEAR)
+    {
+      ok = presets.save(index, nullptr);
+    }
+    else if (length == 1 + PRESET_SIZE)
+    {
+      ok = presets.save(index, value + 1);
     }
+    Serial.printf("Preset %d %s.\n", index, ok ? "stored" : "rejected");
+
+    pCharacteristic->setValue(ok ? "OK" : "ERR");
+    pCharacteristic->notify();
   }
 
-  void onRead(BLECharacteristic *pCharacteristic) override
+  // Reads return every slot, MAX_PRESETS records back to back.
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    if (!this->isAuthenticated())
+    if (!this->isAuthenticated(param->read.conn_id))
     {
-      Serial.println("Unauthorized write attempt to rainbow mode characteristic.");
+      Serial.println("Unauthorized read attempt to preset characteristic.");
       return;
     }
 
-    int rainbowValue = this->deviceSettings->rainbowMode();
-    pCharacteristic->setValue(rainbowValue);
-    Serial.printf("Rainbow mode read as: %d\n", rainbowValue);
+    pCharacteristic->setValue((uint8_t *)this->deviceSettings->presets.records, sizeof(this->deviceSettings->presets.records));
   }
 };
 
-class AuthenticationCallbacks : public BLECharacteristicCallbacks
+// Receives a firmware delta against the running image and streams the patched
+// image into the other OTA partition.
+//
+// OTA_BEGIN only hands the header over. Checking that the delta was made
+// against the running image reads the whole partition, so the link pass does
+// it OTA_CHECK_STEP bytes at a time in update() and answers with OTA_ACK or
+// OTA_FAILED; from then on the BLE task owns the transfer. Replies go to the
+// connection that last wrote, and never through the characteristic's value,
+// so the link pass can send them while the BLE task serves a read. A BEGIN that
+// arrives while a check is still being cancelled fails and can be retried.
+//
+// Chunks carry a sequence number and their own CRC and are applied strictly in
+// order. The client keeps up to OTA_WINDOW chunks in flight; every window is
+// acknowledged, and a gap or corrupt chunk is answered once with OTA_RESEND so
+// the client can go back to that sequence. Flash is written as the delta is
+// decoded, so the image is never held in RAM. Nothing is booted unless the
+// image matches the header and the header's MAC under OTA_KEY.
+class OtaCallbacks : public AuthenticatedBLECharacteristicCallbacks
 {
 private:
+  enum Phase : uint8_t
+  {
+    IDLE,
+    CHECKING,  // the link pass owns the header and the source check
+    CANCELLED, // the client dropped the check; the link pass settles it
+    RUNNING    // the BLE task owns the transfer
+  };
+
   DeviceSettings *deviceSettings;
   BLEServer *pServer;
+  BLECharacteristic *characteristic;
+  std::atomic<uint16_t> client{0}; // connection that last wrote, and gets the replies
+  std::atomic<uint8_t> phase{IDLE};
+  DeltaHeader header;
+  DeltaPatcher patcher;
+  const esp_partition_t *source = nullptr;
+  const esp_partition_t *target = nullptr;
+  esp_ota_handle_t handle = 0;
+  uint32_t checked = 0; // bytes of the running image checked so far
+  uint32_t sourceCRC = 0;
+  uint16_t nextSequence = 0;
+  bool resendRequested = false;
+
+  static bool readSource(void *context, uint32_t offset, uint8_t *data, size_t length)
+  {
+    return esp_partition_read(((OtaCallbacks *)context)->source, offset, data, length) == ESP_OK;
+  }
+
+  static bool writeTarget(void *context, const uint8_t *data, size_t length)
+  {
+    return esp_ota_write(((OtaCallbacks *)context)->handle, data, length) == ESP_OK;
+  }
+
+  void reply(uint8_t status)
+  {
+    uint32_t written = this->patcher.written();
+    uint8_t value[7] = {status, (uint8_t)this->nextSequence, (uint8_t)(this->nextSequence >> 8),
+                        (uint8_t)written, (uint8_t)(written >> 8), (uint8_t)(written >> 16), (uint8_t)(written >> 24)};
+    notifyConnection(this->characteristic, this->client.load(std::memory_order_relaxed), value, sizeof(value));
+  }
+
+  // BLE task: drops the transfer, or asks the link pass to drop the check.
+  void abort()
+  {
+    uint8_t phase = CHECKING;
+    if (this->phase.compare_exchange_strong(phase, CANCELLED) || phase != RUNNING)
+    {
+      return;
+    }
+    esp_ota_abort(this->handle);
+    this->phase.store(IDLE, std::memory_order_release);
+  }
+
+  bool begin(const uint8_t *value, size_t length)
+  {
+    this->abort();
+    if (this->phase.load(std::memory_order_acquire) != IDLE)
+    {
+      Serial.println("Firmware update check still being cancelled.");
+      return false;
+    }
+
+    if (!this->header.parse(value, length))
+    {
+      return false;
+    }
+
+    this->source = esp_ota_get_running_partition();
+    this->target = esp_ota_get_next_update_partition(nullptr);
+    if (this->target == nullptr || this->header.targetSize > this->target->size || this->header.sourceSize > this->source->size)
+    {
+      Serial.println("Firmware delta does not fit the partitions.");
+      return false;
+    }
+
+    this->checked = 0;
+    this->sourceCRC = 0;
+    this->phase.store(CHECKING, std::memory_order_release);
+    return true;
+  }
+
+  // Link pass: ends a check that failed, unless the client already dropped it.
+  void reject()
+  {
+    uint8_t phase = CHECKING;
+    bool current = this->phase.compare_exchange_strong(phase, IDLE);
+    this->phase.store(IDLE, std::memory_order_release);
+    if (current)
+    {
+      this->reply(OTA_FAILED);
+    }
+  }
+
+  void data(const uint8_t *value, size_t length)
+  {
+    if (this->phase.load(std::memory_order_acquire) != RUNNING || length < 7)
+    {
+      return;
+    }
+
+    uint16_t sequence = value[1] | (value[2] << 8);
+    uint32_t crc = readLE32(value + 3);
+    if (sequence != this->nextSequence || crc32(0, value + 7, length - 7) != crc)
+    {
+      // Later chunks of a broken window are dropped silently; one request is enough.
+      if (!this->resendRequested && (int16_t)(sequence - this->nextSequence) >= 0)
+      {
+        this->resendRequested = true;
+        this->reply(OTA_RESEND);
+      }
+      return;
+    }
+
+    if (!this->patcher.feed(value + 7, length - 7))
+    {
+      Serial.println("Firmware delta is corrupt.");
+      this->abort();
+      this->reply(OTA_FAILED);
+      return;
+    }
+
+    this->nextSequence++;
+    this->resendRequested = false;
+    if (this->nextSequence % OTA_WINDOW == 0)
+    {
+      this->reply(OTA_ACK);
+    }
+  }
+
+  bool commit()
+  {
+    if (this->phase.load(std::memory_order_acquire) != RUNNING)
+    {
+      return false;
+    }
+
+    this->phase.store(IDLE, std::memory_order_release);
+    if (!this->patcher.finish((const uint8_t *)OTA_KEY, strlen(OTA_KEY)))
+    {
+      Serial.println("Patched firmware failed verification.");
+      esp_ota_abort(this->handle);
+      return false;
+    }
+
+    if (esp_ota_end(this->handle) != ESP_OK || esp_ota_set_boot_partition(this->target) != ESP_OK)
+    {
+      return false;
+    }
+
+    Serial.printf("Firmware update complete (%u bytes), restarting.\n", this->patcher.written());
+    this->deviceSettings->restartAt = max(1UL, millis() + OTA_RESTART_DELAY);
+    return true;
+  }
 
 public:
-  AuthenticationCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer)
+  OtaCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer, BLECharacteristic *characteristic)
+      : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
   {
     this->deviceSettings = deviceSettings;
     this->pServer = pServer;
+    this->characteristic = characteristic;
   }
 
-  void onWrite(BLECharacteristic *pCharacteristic) override
+  // Link pass: checks the next part of the running image against a header
+  // handed over by OTA_BEGIN, and starts the transfer once all of it matches.
+  void update()
   {
-    String value = pCharacteristic->getValue();
+    uint8_t phase = this->phase.load(std::memory_order_acquire);
+    if (phase == CANCELLED)
+    {
+      this->phase.store(IDLE, std::memory_order_release);
+      return;
+    }
+    if (phase != CHECKING)
+    {
+      return;
+    }
+
+    uint8_t buffer[DELTA_BUFFER];
+    uint32_t end = min(this->header.sourceSize, this->checked + OTA_CHECK_STEP);
+    while (this->checked < end)
+    {
+      uint32_t chunk = min((uint32_t)sizeof(buffer), end - this->checked);
+      if (esp_partition_read(this->source, this->checked, buffer, chunk) != ESP_OK)
+      {
+        this->reject();
+        return;
+      }
+      this->sourceCRC = crc32(this->sourceCRC, buffer, chunk);
+      this->checked += chunk;
+    }
+    if (this->checked < this->header.sourceSize)
+    {
+      return;
+    }
 
-    auto connectionID = this->pServer->getConnId();
+    if (this->sourceCRC != this->header.sourceCRC)
+    {
+      Serial.println("Firmware delta does not apply to the running image.");
+      this->reject();
+      return;
+    }
+    if (esp_ota_begin(this->target, OTA_WITH_SEQUENTIAL_WRITES, &this->handle) != ESP_OK)
+    {
+      this->reject();
+      return;
+    }
 
-    Serial.printf("Attempting to authorize with password %s", value.c_str());
+    this->patcher.begin(this->header, readSource, writeTarget, this);
+    this->nextSequence = 0;
+    this->resendRequested = false;
+    phase = CHECKING;
+    if (!this->phase.compare_exchange_strong(phase, RUNNING, std::memory_order_acq_rel))
+    {
+      esp_ota_abort(this->handle);
+      this->phase.store(IDLE, std::memory_order_release);
+      return;
+    }
+    Serial.printf("Firmware update started: %u byte image into %s.\n", this->header.targetSize, this->target->label);
+    this->reply(OTA_ACK);
+  }
 
-    if (value.length() > 0 && value == PASSWORD)
+  // Not wrapped in TracingCallbacks, which would fill the trace with image
+  // chunks; the chunks still count towards the link's rate, so a transfer
+  // gets the fast connection parameters.
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    links.write(param->write.conn_id);
+    if (!this->isAuthenticated(param->write.conn_id))
     {
-      Serial.printf("Authentication successful for connection ID: %d\n", connectionID);
-      this->deviceSettings->authenticatedDeviceSet->insert(connectionID);
-      this->deviceSettings->devicesPendingAuthentication->erase(connectionID);
-      pCharacteristic->setValue("OK");
-      pCharacteristic->notify("OK");
+      Serial.println("Unauthorized write attempt to OTA characteristic.");
+      return;
     }
-    else if (value == "OK")
+
+    const uint8_t *value = pCharacteristic->getData();
+    size_t length = pCharacteristic->getLength();
+    if (length == 0)
     {
       return;
     }
-    else
+    this->client.store(param->write.conn_id, std::memory_order_relaxed);
+
+    switch (value[0])
+    {
+    case OTA_BEGIN:
+      // answered from update() once the running image has been checked
+      if (!this->begin(value + 1, length - 1))
+      {
+        this->reply(OTA_FAILED);
+      }
+      break;
+    case OTA_DATA:
+      this->data(value, length);
+      break;
+    case OTA_COMMIT:
+      this->reply(this->commit() ? OTA_DONE : OTA_FAILED);
+      break;
+    case OTA_ABORT:
+      this->abort();
+      this->reply(OTA_FAILED);
+      break;
+    }
+  }
+
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
+  {
+    if (!this->isAuthenticated(param->read.conn_id))
     {
-      Serial.println("Authentication failed.");
-      this->pServer->disconnect(connectionID);
-      this->deviceSettings->authenticatedDeviceSet->erase(connectionID);
-      this->deviceSettings->devicesPendingAuthentication->erase(connectionID);
+      Serial.println("Unauthorized read attempt to OTA characteristic.");
+      return;
     }
+
+    uint32_t written = this->patcher.written();
+    bool running = this->phase.load(std::memory_order_acquire) == RUNNING;
+    uint8_t value[7] = {(uint8_t)(running ? OTA_ACK : OTA_FAILED), (uint8_t)this->nextSequence, (uint8_t)(this->nextSequence >> 8),
+                        (uint8_t)written, (uint8_t)(written >> 8), (uint8_t)(written >> 16), (uint8_t)(written >> 24)};
+    pCharacteristic->setValue(value, sizeof(value));
   }
 };
 
-class PatternCallbacks : public AuthenticatedBLECharacteristicCallbacks
+// Receives audio features computed by the app. Write-without-response only,
+// so there is nothing to read back.
+class AudioCallbacks : public BLECharacteristicCallbacks
 {
 private:
   DeviceSettings *deviceSettings;
-  BLEServer *pServer;
 
 public:
-  PatternCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  AudioCallbacks(DeviceSettings *deviceSettings)
   {
     this->deviceSettings = deviceSettings;
-    this->pServer = pServer;
-  }
-
-  void onWrite(BLECharacteristic *pCharacteristic) override
-  {
-    if (!this->isAuthenticated())
-    {
-      Serial.println("Unauthorized write attempt to pattern characteristic.");
-      return;
-    }
-
-    String value = pCharacteristic->getValue();
-
-    if (value.length() > 0)
-    {
-      deviceSettings->pattern = value;
-      Serial.printf("Pattern set to: %s\n", deviceSettings->pattern.c_str());
-    }
   }
 
-  void onRead(BLECharacteristic *pCharacteristic) override
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    if (!this->isAuthenticated())
+    if (!this->deviceSettings->isAuthenticated(param->write.conn_id))
     {
-      Serial.println("Unauthorized read attempt to pattern characteristic.");
       return;
     }
 
-    pCharacteristic->setValue(deviceSettings->pattern);
-    Serial.printf("Pattern read as: %d\n", deviceSettings->pattern.c_str());
+    this->deviceSettings->audio.push(pCharacteristic->getData(), pCharacteristic->getLength(), millis());
   }
 };
 
-class PatternRateCallbacks : public AuthenticatedBLECharacteristicCallbacks
+class ParameterCallbacks : public AuthenticatedBLECharacteristicCallbacks
 {
 private:
   DeviceSettings *deviceSettings;
   BLEServer *pServer;
 
 public:
-  PatternRateCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
+  ParameterCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
   {
     this->deviceSettings = deviceSettings;
     this->pServer = pServer;
   }
 
-  void onWrite(BLECharacteristic *pCharacteristic) override
+  // Each write carries one or more [id, value lo, value hi] triples.
+  void onWrite(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    if (!this->isAuthenticated())
+    if (!this->isAuthenticated(param->write.conn_id))
     {
-      Serial.println("Unauthorized write attempt to pattern rate characteristic.");
+      Serial.println("Unauthorized write attempt to parameter characteristic.");
       return;
     }
 
-    String value = pCharacteristic->getValue();
-
-    if (value.length() == 8)
-    {
-      double receivedDouble;
-      memcpy(&receivedDouble, value.c_str(), sizeof(double));
-      this->deviceSettings->interval = static_cast<uint16_t>(receivedDouble * DeviceSettings::baseInterval);
+    const uint8_t *value = pCharacteristic->getData();
+    size_t length = pCharacteristic->getLength();
+    uint16_t written = 0;
 
-      Serial.print("Received double: ");
-      Serial.println(receivedDouble, 6);
-    }
-    else
+    for (size_t i = 0; i + 3 <= length; i += 3)
     {
-      Serial.println("Received data length mismatch!");
+      uint8_t id = value[i];
+      if (id >= MAX_PATTERN_PARAMETERS)
+      {
+        continue;
+      }
+      this->deviceSettings->parameterValues[id] = (int16_t)(value[i + 1] | (value[i + 2] << 8));
+      written |= 1 << id;
     }
+
+    this->deviceSettings->pendingParameters.fetch_or(written);
   }
 
-  void onRead(BLECharacteristic *pCharacteristic) override
+  void onRead(BLECharacteristic *pCharacteristic, esp_ble_gatts_cb_param_t *param) override
   {
-    if (!this->isAuthenticated())
+    if (!this->isAuthenticated(param->read.conn_id))
     {
-      Serial.println("Unauthorized read attempt to pattern rate characteristic.");
+      Serial.println("Unauthorized read attempt to parameter characteristic.");
       return;
     }
 
-    pCharacteristic->setValue(deviceSettings->interval);
-    Serial.printf("Pattern rate read as: %i\n", deviceSettings->interval);
+    uint8_t schema[PARAMETER_SCHEMA_SIZE];
+    size_t length = this->deviceSettings->parameterSchema.read(schema);
+    pCharacteristic->setValue(schema, length);
   }
 };
 
-class ColorCharacteristicCallbacks : public AuthenticatedBLECharacteristicCallbacks
+// PATTERNS
+enum PatternParameterType : uint8_t
+{
+  PARAM_INT,  // bound to an int, sent as is
+  PARAM_FLOAT // bound to a float, sent in thousandths
+};
+
+// A tunable value of a pattern. It points at the pattern member it controls,
+// so changes take effect on the next frame without rebuilding the pattern.
+// The type follows from the member it is bound to.
+struct PatternParameter
+{
+  uint8_t id;
+  PatternParameterType type;
+  const char *name;
+  int16_t minimum;
+  int16_t maximum;
+  int *integer = nullptr;
+  float *real = nullptr;
+
+  PatternParameter(uint8_t id, const char *name, int16_t minimum, int16_t maximum, int *value)
+      : id(id), type(PARAM_INT), name(name), minimum(minimum), maximum(maximum), integer(value) {}
+
+  PatternParameter(uint8_t id, const char *name, int16_t minimum, int16_t maximum, float *value)
+      : id(id), type(PARAM_FLOAT), name(name), minimum(minimum), maximum(maximum), real(value) {}
+};
+
+class Pattern
 {
 private:
-  DeviceSettings *deviceSettings;
-  BLEServer *pServer;
+  uint32_t lastStep = 0; // timebase step last drawn by nextStep()
+  bool stepped = false;
 
 public:
-  ColorCharacteristicCallbacks(DeviceSettings *deviceSettings, BLEServer *pServer) : AuthenticatedBLECharacteristicCallbacks(deviceSettings, pServer)
-  {
-    this->deviceSettings = deviceSettings;
-    this->pServer = pServer;
-  }
+  DeviceSettings *settings;
+  PatternParameter *parameters = nullptr;
+  uint8_t parameterCount = 0;
+  virtual void update() = 0;
+  virtual ~Pattern() {}
+
+  // Redraws the strip part way between the last step and the next one.
+  // Called at the output frame rate while the pattern waits for its next
+  // step; patterns that move things override it.
+  virtual void tween(unsigned long) {}
 
-  void onWrite(BLECharacteristic *pCharacteristic) override
+  bool setParameter(uint8_t id, int16_t value)
   {
-    if (!this->isAuthenticated())
+    for (uint8_t i = 0; i < parameterCount; i++)
     {
-      Serial.println("Unauthorized write attempt to color characteristic.");
-      return;
+      PatternParameter &parameter = parameters[i];
+      if (parameter.id != id)
+        continue;
+
+      value = constrain(value, parameter.minimum, parameter.maximum);
+      if (parameter.real)
+        *parameter.real = value / 1000.0f;
+      else
+        *parameter.integer = value;
+      return true;
     }
+    return false;
+  }
 
-    String value = pCharacteristic->getValue();
-    if (value.length() == 3)
+  int16_t getParameter(const PatternParameter &parameter)
+  {
+    if (parameter.real)
+      return (int16_t)lroundf(*parameter.real * 1000.0f);
+    return (int16_t)*parameter.integer;
+  }
+
+  // Serializes the schema as [count] followed by, per parameter,
+  // [id, type, min (2), max (2), value (2), name length, name...].
+  size_t describeParameters(uint8_t *out, size_t capacity)
+  {
+    size_t length = 1;
+    out[0] = 0;
+
+    for (uint8_t i = 0; i < parameterCount; i++)
     {
-      this->deviceSettings->red = (uint8_t)value[0];
-      this->deviceSettings->green = (uint8_t)value[1];
-      this->deviceSettings->blue = (uint8_t)value[2];
-      Serial.printf("Color set to: R=%d, G=%d, B=%d\n", this->deviceSettings->red, this->deviceSettings->green, this->deviceSettings->blue);
+      PatternParameter &parameter = parameters[i];
+      size_t nameLength = strlen(parameter.name);
+      if (length + 9 + nameLength > capacity)
+        break;
+
+      int16_t value = getParameter(parameter);
+      uint8_t *entry = out + length;
+      entry[0] = parameter.id;
+      entry[1] = parameter.type;
+      entry[2] = parameter.minimum & 0xFF;
+      entry[3] = parameter.minimum >> 8;
+      entry[4] = parameter.maximum & 0xFF;
+      entry[5] = parameter.maximum >> 8;
+      entry[6] = value & 0xFF;
+      entry[7] = value >> 8;
+      entry[8] = nameLength;
+      memcpy(entry + 9, parameter.name, nameLength);
+
+      length += 9 + nameLength;
+      out[0]++;
     }
+
+    return length;
+  }
+
+protected:
+  // The uploaded palette's colour at `index`, dimmed to brightness / 255.
+  uint32_t colorFromPalette(uint8_t index, uint8_t brightness = 255)
+  {
+    return settings->palette.color(index, brightness);
+  }
+
+  // Whether the timebase has moved on to a new step since this last returned
+  // true. A pattern draws once per step however short the step is, and a
+  // new pattern draws on its first update.
+  bool nextStep()
+  {
+    uint32_t steps = settings->timebase.steps();
+    if (stepped && steps == lastStep)
+      return false;
+    lastStep = steps;
+    stepped = true;
+    return true;
+  }
+
+  // Steps since `mark`, a timebase.steps() reading.
+  uint32_t stepsSince(uint32_t mark) const
+  {
+    return settings->timebase.steps() - mark;
+  }
+
+  // A level that rises from 0 to 1 over 65536 units of `distance` (a
+  // Timebase::travel() reading) and falls back over the next 65536.
+  static float triangle(uint32_t distance)
+  {
+    uint32_t phase = distance & 0x1FFFF;
+    return (phase <= 0x10000 ? phase : 0x20000 - phase) * (1.0f / 65536.0f);
   }
 
-  void onRead(BLECharacteristic *pCharacteristic) override
+  // A position that moves one pixel per step from 0 to `last` and back, in
+  // 256ths of a pixel, `steps` and `fraction` (0-255) into the movement.
+  static int32_t bounce(uint32_t steps, uint8_t fraction, int32_t last)
   {
-    if (!this->isAuthenticated())
+    if (last <= 0)
+      return 0;
+    int32_t phase = (steps % (2 * (uint32_t)last)) * 256 + fraction;
+    return phase <= last * 256 ? phase : 2 * last * 256 - phase;
+  }
+
+  // Lights [start, start + length), both in 256ths of a pixel, shading the
+  // pixels at either end by how much of them is covered.
+  static void drawSegment(uint32_t color, int32_t start, int32_t length, bool wrap)
+  {
+    int32_t n = strip.numPixels();
+    int32_t end = start + length;
+    for (int32_t pixel = start >> 8; pixel * 256 < end; pixel++)
     {
-      Serial.println("Unauthorized read attempt to color characteristic.");
-      return;
+      int32_t coverage = min(end, (pixel + 1) * 256) - max(start, pixel * 256);
+      int32_t index = wrap ? ((pixel % n) + n) % n : pixel;
+      if (coverage <= 0 || index < 0 || index >= n)
+        continue;
+      strip.setPixelColor(index, scalePixel(color, coverage));
     }
-
-    uint8_t colorValue[3] = {this->deviceSettings->red, this->deviceSettings->green, this->deviceSettings->blue};
-    pCharacteristic->setValue(colorValue, 3);
-    Serial.printf("Color read as: R=%d, G=%d, B=%d\n", this->deviceSettings->red, this->deviceSettings->green, this->deviceSettings->blue);
   }
 };
 
-// PATTERNS
-class Pattern
+// Base for patterns whose light comes entirely from a particle pool. Every
+// frame is rebuilt from scratch, so nothing is read back from the strip.
+template <uint16_t Capacity>
+class ParticlePattern : public Pattern
 {
+protected:
+  ParticleSystem<Capacity> particles;
+  uint32_t frame[NUM_LEDS];
+  uint32_t background = 0;
+
+  void present(uint32_t background, uint8_t fraction = 0)
+  {
+    uint16_t n = strip.numPixels();
+    this->background = background;
+    fillPixels(frame, n, background);
+    particles.render(frame, n, fraction);
+    writePixels(strip, frame, n);
+    strip.show();
+  }
+
 public:
-  DeviceSettings *settings;
-  virtual void update() = 0;
-  virtual ~Pattern() {}
+  // Particles carry on along their velocity between steps.
+  void tween(unsigned long) override
+  {
+    present(background, settings->timebase.fraction8());
+  }
 };
 
 class FlatPattern : public Pattern
@@ -415,25 +2293,24 @@ public:
 
 class GlowPattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  float brightness = 0;
-  float step = 0.02;
+  uint32_t origin;
+  float step = 0.02; // brightness gained or lost per step
+  PatternParameter schema[1] = {{0, "step", 1, 200, &step}};
 
 public:
   GlowPattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    parameters = schema;
+    parameterCount = 1;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    brightness += step;
-    if (brightness >= 1.0 || brightness <= 0.0)
-      step = -step;
+    float brightness = triangle(settings->timebase.travel(lroundf(step * 65536), origin));
     strip.fill(strip.Color(
         uint8_t(floor(settings->red * brightness) - 1),
         uint8_t(floor(settings->green * brightness) - 1),
@@ -444,25 +2321,21 @@ public:
 
 class PulsePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  float brightness = 0;
-  float step = 0.05;
+  uint32_t origin;
+  static const uint16_t rate = 3277; // brightness gained or lost per step, in 65536ths
 
 public:
   PulsePattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    brightness += step;
-    if (brightness >= 1.0 || brightness <= 0.0)
-      step = -step;
+    float brightness = triangle(settings->timebase.travel(rate, origin));
     strip.fill(strip.Color(
         uint8_t(settings->red * brightness),
         uint8_t(settings->green * brightness),
@@ -473,7 +2346,6 @@ public:
 
 class StrobePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
   bool on = false;
 
 public:
@@ -483,10 +2355,8 @@ public:
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
     on = !on;
     strip.fill(on ? strip.Color(settings->red, settings->green, settings->blue)
@@ -497,25 +2367,21 @@ public:
 
 class FadePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  float brightness = 0;
-  float step = 0.02;
+  uint32_t origin;
+  static const uint16_t rate = 1311; // brightness gained or lost per step, in 65536ths
 
 public:
   FadePattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    brightness += step;
-    if (brightness >= 1.0 || brightness <= 0.0)
-      step = -step;
+    float brightness = triangle(settings->timebase.travel(rate, origin));
     strip.fill(strip.Color(
         uint8_t(settings->red * brightness),
         uint8_t(settings->green * brightness),
@@ -526,8 +2392,7 @@ public:
 
 class RainbowPattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  int offset = 0;
+  FrameCache<NUM_LEDS> cache;
 
 public:
   RainbowPattern(DeviceSettings *settings)
@@ -536,65 +2401,86 @@ public:
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    for (int i = 0; i < strip.numPixels(); i++)
+    // the hue wheel turns 256 (of 65536) per step
+    uint16_t offset = settings->timebase.phase16() >> 8;
+
+    // Every frame is the first one with the hue wheel turned, so a single
+    // cached frame of hue indices covers the whole 256-frame cycle.
+    if (cache.prepare(1, 0, FRAME_CACHE_BUDGET))
+    {
+      if (!cache.cached())
+      {
+        cache.setPalette(0, [](uint16_t level)
+                         { return strip.ColorHSV(level << 8); });
+        uint8_t *hues = cache.frameLevels();
+        for (int i = 0; i < strip.numPixels(); i++)
+        {
+          hues[i] = (i * 65536L / strip.numPixels()) >> 8;
+        }
+      }
+      cache.render(strip, offset >> 8);
+    }
+    else
     {
-      strip.setPixelColor(i, strip.ColorHSV((i * 65536L / strip.numPixels() + offset)));
+      for (int i = 0; i < strip.numPixels(); i++)
+      {
+        strip.setPixelColor(i, strip.ColorHSV((i * 65536L / strip.numPixels() + offset)));
+      }
     }
     strip.show();
-    offset += 256;
   }
 };
 
 class CyclePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
+  uint32_t origin;
 
 public:
   CyclePattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
+    int position = (settings->timebase.steps() - origin) % strip.numPixels();
     strip.fill(strip.Color(0, 0, 0));
     strip.setPixelColor(position, strip.Color(settings->red, settings->green, settings->blue));
     strip.show();
-    position = (position + 1) % strip.numPixels();
+  }
+
+  void tween(unsigned long) override
+  {
+    int32_t head = ((settings->timebase.steps() - origin) % strip.numPixels()) * 256 + settings->timebase.fraction8();
+    strip.fill(strip.Color(0, 0, 0));
+    drawSegment(strip.Color(settings->red, settings->green, settings->blue), head, 256, true);
+    strip.show();
   }
 };
 
 class BreathePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  float brightness = 0;
-  float step = 0.02;
+  uint32_t origin;
+  static const uint16_t rate = 1311; // brightness gained or lost per step, in 65536ths
 
 public:
   BreathePattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    brightness += step;
-    if (brightness >= 1.0 || brightness <= 0.0)
-      step = -step;
+    float brightness = triangle(settings->timebase.travel(rate, origin));
     strip.fill(strip.Color(
         uint8_t(settings->red * brightness),
         uint8_t(settings->green * brightness),
@@ -605,37 +2491,67 @@ public:
 
 class WavePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
+  float frequency = 0.3;
+  int angle = 0;
+  FrameCache<NUM_LEDS> cache;
+  PatternParameter schema[2] = {
+      {0, "frequency", 10, 2000, &frequency},
+      {1, "angle", 0, 255, &angle}};
 
 public:
   WavePattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    parameters = schema;
+    parameterCount = 2;
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    for (int i = 0; i < strip.numPixels(); i++)
+    // travel across the frame rather than along the strip; linear() runs 0-255
+    // from edge to edge, so the frame is 64 wave units across
+    layout.direction(angle);
+
+    // One cycle is 2π / frequency frames; cached, the step is rounded so the
+    // cycle is a whole number of frames.
+    uint16_t period = lroundf(2 * (float)M_PI / frequency);
+    if (cache.prepare(period, angle | ((uint32_t)lroundf(frequency * 1000) << 8), FRAME_CACHE_BUDGET))
     {
-      float wave = sin((i + position) * 0.3) * 127 + 128;
-      strip.setPixelColor(i, strip.Color(
-                                 uint8_t(settings->red * wave / 255),
-                                 uint8_t(settings->green * wave / 255),
-                                 uint8_t(settings->blue * wave / 255)));
+      cache.seek(settings->timebase.steps() % period);
+      if (!cache.cached())
+      {
+        float shift = cache.frame() * 2 * (float)M_PI / period;
+        uint8_t *levels = cache.frameLevels();
+        for (int i = 0; i < strip.numPixels(); i++)
+        {
+          levels[i] = sin(layout.linear(i) * 0.25f * frequency - shift) * 127 + 128;
+        }
+      }
+      cache.setPalette(settings->generateHexCode(), [this](uint16_t level)
+                       { return strip.Color(settings->red * level / 255, settings->green * level / 255, settings->blue * level / 255); });
+      cache.render(strip);
+    }
+    else
+    {
+      float position = settings->timebase.stepsModulo(max(period, (uint16_t)1));
+      for (int i = 0; i < strip.numPixels(); i++)
+      {
+        float wave = sin((layout.linear(i) * 0.25f - position) * frequency) * 127 + 128;
+        strip.setPixelColor(i, strip.Color(
+                                   uint8_t(settings->red * wave / 255),
+                                   uint8_t(settings->green * wave / 255),
+                                   uint8_t(settings->blue * wave / 255)));
+      }
     }
     strip.show();
-    position += 1;
   }
 };
 
 class FirePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
+  FastRandom rng{0xF12E};
 
 public:
   FirePattern(DeviceSettings *settings)
@@ -644,14 +2560,12 @@ public:
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
     for (int i = 0; i < strip.numPixels(); i++)
     {
-      int flicker = random(0, 50);
+      int flicker = rng.below(50);
       int r = min(settings->red + flicker, 255);
       int g = min(settings->green + flicker / 2, 255);
       int b = 0;
@@ -663,7 +2577,6 @@ public:
 
 class SparklePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
 
 public:
   SparklePattern(DeviceSettings *settings)
@@ -672,10 +2585,8 @@ public:
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
     for (int i = 0; i < strip.numPixels(); i++)
     {
@@ -690,7 +2601,6 @@ public:
 
 class FlashPattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
   bool on = false;
 
 public:
@@ -700,10 +2610,8 @@ public:
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
     on = !on;
     strip.fill(on ? strip.Color(settings->red, settings->green, settings->blue)
@@ -714,31 +2622,36 @@ public:
 
 class ChasePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
+  uint32_t origin;
 
 public:
   ChasePattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
+    int position = (settings->timebase.steps() - origin) % strip.numPixels();
     strip.fill(strip.Color(0, 0, 0));
     strip.setPixelColor(position, strip.Color(settings->red, settings->green, settings->blue));
     strip.show();
-    position = (position + 1) % strip.numPixels();
+  }
+
+  void tween(unsigned long) override
+  {
+    int32_t head = ((settings->timebase.steps() - origin) % strip.numPixels()) * 256 + settings->timebase.fraction8();
+    strip.fill(strip.Color(0, 0, 0));
+    drawSegment(strip.Color(settings->red, settings->green, settings->blue), head, 256, true);
+    strip.show();
   }
 };
 
 class TwinklePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
 
 public:
   TwinklePattern(DeviceSettings *settings)
@@ -747,10 +2660,8 @@ public:
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
     int pos = random(strip.numPixels());
     strip.setPixelColor(pos, strip.Color(settings->red, settings->green, settings->blue));
@@ -758,263 +2669,318 @@ public:
   }
 };
 
-class MeteorPattern : public Pattern
+class MeteorPattern : public ParticlePattern<32>
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
+  uint32_t origin;
+  uint32_t simulated = 0; // the next step, counted from origin, to run the particles for
 
 public:
   MeteorPattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    particles.wrap = true;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    for (int i = 0; i < strip.numPixels(); i++)
+    // The head moves one pixel per step and sheds sparks that drift backwards
+    // and burn out at random rates. Steps passed since the last update are
+    // run too, up to PATTERN_CATCH_UP of them.
+    uint16_t n = strip.numPixels();
+    uint32_t steps = stepsSince(origin);
+    if (steps - simulated >= PATTERN_CATCH_UP)
+      simulated = steps - PATTERN_CATCH_UP + 1;
+    for (; (int32_t)(steps - simulated) >= 0; simulated++)
     {
-      strip.setPixelColor(i, strip.Color(
-                                 settings->red / 2, settings->green / 2, settings->blue / 2));
+      particles.step(n);
+      int32_t head = (int32_t)(simulated % n) * ParticleSystem<32>::ONE;
+      particles.spawn(head, -random(0, 64), settings->red, settings->green, settings->blue, 255, random(16, 64));
     }
-    strip.setPixelColor(position, strip.Color(settings->red, settings->green, settings->blue));
-    strip.show();
-    position = (position + 1) % strip.numPixels();
+
+    present(strip.Color(settings->red / 2, settings->green / 2, settings->blue / 2));
   }
 };
 
 class ScannerPattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
-  bool forward = true;
+  uint32_t origin;
 
 public:
   ScannerPattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
+    int position = bounce(settings->timebase.steps() - origin, 0, strip.numPixels() - 1) >> 8;
     strip.fill(strip.Color(0, 0, 0));
     strip.setPixelColor(position, strip.Color(settings->red, settings->green, settings->blue));
     strip.show();
-    if (forward)
-      position++;
-    else
-      position--;
-    if (position >= strip.numPixels())
-    {
-      position = strip.numPixels() - 1;
-      forward = false;
-    }
-    if (position < 0)
-    {
-      position = 0;
-      forward = true;
-    }
+  }
+
+  void tween(unsigned long) override
+  {
+    int32_t head = bounce(settings->timebase.steps() - origin, settings->timebase.fraction8(), strip.numPixels() - 1);
+    strip.fill(strip.Color(0, 0, 0));
+    drawSegment(strip.Color(settings->red, settings->green, settings->blue), head, 256, false);
+    strip.show();
   }
 };
 
-class CometPattern : public Pattern
+class CometPattern : public ParticlePattern<16>
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
+  uint32_t origin;
+  uint32_t simulated = 0; // the next step, counted from origin, to run the particles for
 
 public:
   CometPattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    for (int i = 0; i < strip.numPixels(); i++)
+    // Each step leaves a stationary ember where the head is; the fading embers
+    // form the tail. As for the meteor, missed steps are run too.
+    uint16_t n = strip.numPixels();
+    uint32_t steps = stepsSince(origin);
+    if (steps - simulated >= PATTERN_CATCH_UP)
+      simulated = steps - PATTERN_CATCH_UP + 1;
+    for (; (int32_t)(steps - simulated) >= 0; simulated++)
     {
-      uint32_t c = strip.getPixelColor(i);
-      strip.setPixelColor(i, (c >> 1) & 0x7F7F7F);
+      particles.step(n);
+      int32_t head = (int32_t)(simulated % n) * ParticleSystem<16>::ONE;
+      particles.spawn(head, 0, settings->red, settings->green, settings->blue, 255, 48);
     }
-    strip.setPixelColor(position, strip.Color(settings->red, settings->green, settings->blue));
-    strip.show();
-    position = (position + 1) % strip.numPixels();
+
+    present(0);
   }
 };
 
 class WipePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
+  uint32_t origin;
+
+  // Step i of each cycle lights pixels 0-i; the last step clears the strip.
+  // `fraction` fades in the pixel the next step will light.
+  void draw(uint8_t fraction)
+  {
+    uint16_t n = strip.numPixels();
+    uint16_t position = (settings->timebase.steps() - origin) % (n + 1);
+    uint32_t color = strip.Color(settings->red, settings->green, settings->blue);
+    strip.fill(strip.Color(0, 0, 0));
+    if (position < n)
+      strip.fill(color, 0, position + 1);
+    if (position + 1 < n)
+      strip.setPixelColor(position + 1, scalePixel(color, fraction));
+    strip.show();
+  }
 
 public:
   WipePattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    if (position < strip.numPixels())
-    {
-      strip.setPixelColor(position, strip.Color(settings->red, settings->green, settings->blue));
-      strip.show();
-      position++;
-    }
-    else
+    draw(0);
+  }
+
+  void tween(unsigned long) override
+  {
+    draw(settings->timebase.fraction8());
+  }
+};
+
+class LarsonPattern : public Pattern
+{
+  uint32_t origin;
+  int length = 5;
+  PatternParameter schema[1] = {{0, "length", 1, 32, &length}};
+
+public:
+  LarsonPattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+    origin = settings->timebase.steps();
+    parameters = schema;
+    parameterCount = 1;
+  }
+  void update() override
+  {
+    if (!nextStep())
+      return;
+
+    // the head runs one pixel past the end so the bar can leave the strip
+    int position = bounce(settings->timebase.steps() - origin, 0, strip.numPixels()) >> 8;
+    strip.fill(strip.Color(0, 0, 0));
+    for (int i = 0; i < length; i++)
     {
-      strip.fill(strip.Color(0, 0, 0));
-      strip.show();
-      position = 0;
+      int pos = position - i;
+      if (pos >= 0 && pos < strip.numPixels())
+      {
+        strip.setPixelColor(pos, strip.Color(settings->red, settings->green, settings->blue));
+      }
     }
+    strip.show();
+  }
+
+  void tween(unsigned long) override
+  {
+    // the bar covers [head - length + 1, head]
+    int32_t head = bounce(settings->timebase.steps() - origin, settings->timebase.fraction8(), strip.numPixels());
+    strip.fill(strip.Color(0, 0, 0));
+    drawSegment(strip.Color(settings->red, settings->green, settings->blue), head - (length - 1) * 256, length * 256, false);
+    strip.show();
   }
 };
 
-class LarsonPattern : public Pattern
+class FireworksPattern : public ParticlePattern<64>
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
-  int length = 5;
-  bool forward = true;
-
 public:
-  LarsonPattern(DeviceSettings *settings)
+  FireworksPattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    particles.drag = 224;
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    strip.fill(strip.Color(0, 0, 0));
-    for (int i = 0; i < length; i++)
+    uint16_t n = strip.numPixels();
+    particles.step(n);
+
+    if (random(255) < 50)
     {
-      int pos = position - i;
-      if (pos >= 0 && pos < strip.numPixels())
+      int32_t center = random(n) * ParticleSystem<64>::ONE;
+      int sparks = random(8, 16);
+      for (int i = 0; i < sparks; i++)
       {
-        strip.setPixelColor(pos, strip.Color(settings->red, settings->green, settings->blue));
+        particles.spawn(center, random(-384, 385), settings->red, settings->green, settings->blue, 255, random(12, 32));
       }
     }
-    strip.show();
-    if (forward)
-      position++;
-    else
-      position--;
-    if (position >= strip.numPixels())
-      forward = false;
-    if (position <= 0)
-      forward = true;
+
+    present(0);
   }
 };
 
-class FireworksPattern : public Pattern
+class ConfettiPattern : public ParticlePattern<32>
 {
-  unsigned long lastUpdate = 0;
-
 public:
-  FireworksPattern(DeviceSettings *settings)
+  ConfettiPattern(DeviceSettings *settings)
   {
     this->settings = settings;
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    for (int i = 0; i < strip.numPixels(); i++)
-    {
-      uint32_t c = strip.getPixelColor(i);
-      strip.setPixelColor(i, (c >> 1) & 0x7F7F7F);
-    }
-    if (random(255) < 50)
-    {
-      int pos = random(strip.numPixels());
-      strip.setPixelColor(pos, strip.Color(settings->red, settings->green, settings->blue));
-    }
-    strip.show();
+    uint16_t n = strip.numPixels();
+    particles.step(n);
+
+    int32_t position = random(n) * ParticleSystem<32>::ONE;
+    particles.spawn(position, random(-32, 33), settings->red, settings->green, settings->blue, 255, 40);
+
+    present(0);
   }
 };
 
-class ConfettiPattern : public Pattern
+class RipplePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
+  uint32_t origin;
+  int falloff = 50;
+  PatternParameter schema[1] = {{0, "falloff", 1, 255, &falloff}};
 
 public:
-  ConfettiPattern(DeviceSettings *settings)
+  RipplePattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    origin = settings->timebase.steps();
+    parameters = schema;
+    parameterCount = 1;
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
+
+    // rings spread out from the middle of the frame by ten radius units (about
+    // a pixel) a step. A ring is lit within `reach` of its radius, so it starts
+    // just inside the innermost pixels and ends once it has left the corners.
+    int reach = 2550 / falloff;
+    int first = layout.innerRadius() - reach;
+    uint32_t period = (255 + reach - first + 9) / 10;
+    int position = first + ((settings->timebase.steps() - origin) % period) * 10 + settings->timebase.fraction8() * 10 / 256;
 
     for (int i = 0; i < strip.numPixels(); i++)
     {
-      uint32_t c = strip.getPixelColor(i);
-      strip.setPixelColor(i, (c >> 1) & 0x7F7F7F);
+      int distance = abs(layout.radial(i) - position);
+      int brightness = max(0, 255 - distance * falloff / 10);
+      strip.setPixelColor(i, strip.Color(
+                                 settings->red * brightness / 255,
+                                 settings->green * brightness / 255,
+                                 settings->blue * brightness / 255));
     }
-    int pos = random(strip.numPixels());
-    strip.setPixelColor(pos, strip.Color(settings->red, settings->green, settings->blue));
     strip.show();
   }
 };
 
-class RipplePattern : public Pattern
+class SpinPattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  int position = 0;
+  uint32_t origin;
+  int width = 32;
+  PatternParameter schema[1] = {{0, "width", 1, 128, &width}};
 
 public:
-  RipplePattern(DeviceSettings *settings)
+  SpinPattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    parameters = schema;
+    parameterCount = 1;
+    origin = settings->timebase.steps();
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
+    // the beam turns 2 (of 256) per step
+    uint8_t rotation = settings->timebase.travel(2 << 8, origin) >> 8;
+
+    // a beam sweeping around the frame centre
     for (int i = 0; i < strip.numPixels(); i++)
     {
-      int distance = abs(i - position);
-      int brightness = max(0, 255 - distance * 50);
+      uint8_t offset = layout.angular(i, rotation);
+      int distance = min((int)offset, 256 - offset);
+      int brightness = max(0, 255 - distance * 255 / width);
       strip.setPixelColor(i, strip.Color(
                                  settings->red * brightness / 255,
                                  settings->green * brightness / 255,
                                  settings->blue * brightness / 255));
     }
     strip.show();
-    position = (position + 1) % strip.numPixels();
   }
 };
 
 class NoisePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
+  FastRandom rng{0x2015E};
 
 public:
   NoisePattern(DeviceSettings *settings)
@@ -1023,17 +2989,15 @@ public:
   }
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
     for (int i = 0; i < strip.numPixels(); i++)
     {
       strip.setPixelColor(i, strip.Color(
-                                 random(settings->red),
-                                 random(settings->green),
-                                 random(settings->blue)));
+                                 rng.below(settings->red),
+                                 rng.below(settings->green),
+                                 rng.below(settings->blue)));
     }
     strip.show();
   }
@@ -1041,7 +3005,7 @@ public:
 
 class ILYPattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
+  uint32_t mark; // step of the last change
   int burst = 0;
   bool burstOn = false;
   bool offPhase = false;
@@ -1050,27 +3014,26 @@ public:
   ILYPattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    mark = settings->timebase.steps() - 15; // draw on the first update
   }
 
   void update() override
   {
-    unsigned long now = millis();
-
     if (offPhase)
     {
-      if (now - lastUpdate < settings->interval * 40)
+      if (stepsSince(mark) < 40)
         return;
 
       offPhase = false;
       burstOn = false;
       burst = 0;
-      lastUpdate = now;
+      mark = settings->timebase.steps();
     }
 
-    if (now - lastUpdate < settings->interval * 15)
+    if (stepsSince(mark) < 15)
       return;
 
-    lastUpdate = now;
+    mark = settings->timebase.steps();
 
     if (burstOn)
     {
@@ -1098,24 +3061,24 @@ public:
 
 class BrokenNeonPattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  unsigned long nextChange = 0;
+  uint32_t nextChange; // step at which the tube next flips
   bool isOn = false;
+  FastRandom rng{0xE0E5};
 
 public:
   BrokenNeonPattern(DeviceSettings *settings)
   {
     this->settings = settings;
+    nextChange = settings->timebase.steps();
   }
 
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (!nextStep())
       return;
-    lastUpdate = now;
 
-    if (now < nextChange)
+    uint32_t steps = settings->timebase.steps();
+    if ((int32_t)(steps - nextChange) < 0)
       return; // wait until it's time
 
     if (isOn)
@@ -1126,15 +3089,14 @@ public:
       isOn = false;
 
       // long OFF gap, randomized
-      unsigned long offTime = random(25, 100) * settings->interval;
-      nextChange = now + offTime;
+      nextChange = steps + rng.range(25, 100);
     }
     else
     {
       // turn on with broken-neon flicker
       for (int i = 0; i < strip.numPixels(); i++)
       {
-        if (random(0, 100) < 70) // 70% chance pixel is ON
+        if (rng.below(100) < 70) // 70% chance pixel is ON
           strip.setPixelColor(i, strip.Color(settings->red, settings->green, settings->blue));
         else
           strip.setPixelColor(i, 0); // some pixels stay dark
@@ -1143,37 +3105,41 @@ public:
       isOn = true;
 
       // short ON burst, randomized
-      unsigned long onTime = random(10, 50) * settings->interval;
-      nextChange = now + onTime;
+      nextChange = steps + rng.range(10, 50);
     }
   }
 };
 
 class ApocalypseLightning : public Pattern
 {
-  unsigned long lastUpdate = 0;
+  uint32_t mark; // step of the last flash decision
   int phase = 0;        // 0 = waiting, 1 = flickering
   int flickerCount = 0; // how many flashes left
   int startPixel = 0;
   int segLength = 0;
+  int segmentPercent = 20;
+  FastRandom rng{0xA90C};
+  PatternParameter schema[1] = {{0, "segment", 1, 100, &segmentPercent}};
 
 public:
   ApocalypseLightning(DeviceSettings *settings)
   {
     this->settings = settings;
+    parameters = schema;
+    parameterCount = 1;
+    mark = settings->timebase.steps() - 5; // decide on the first update
   }
 
   void update() override
   {
-    unsigned long now = millis();
-    if (now - lastUpdate < settings->interval * 5)
+    if (stepsSince(mark) < 5)
       return;
-    lastUpdate = now;
+    mark = settings->timebase.steps();
 
     if (phase == 0)
     {
       // 80% chance to stay off (big gaps)
-      if (random(0, 100) < 80)
+      if (rng.below(100) < 80)
       {
         strip.fill(strip.Color(0, 0, 0));
         strip.show();
@@ -1181,9 +3147,9 @@ public:
       }
 
       // Start a flicker burst
-      startPixel = random(0, strip.numPixels());
-      segLength = max(1, strip.numPixels() / 5); // ~20%
-      flickerCount = random(3, 7);               // number of flashes
+      startPixel = rng.below(strip.numPixels());
+      segLength = max(1, strip.numPixels() * segmentPercent / 100);
+      flickerCount = rng.range(3, 7);            // number of flashes
       phase = 1;
     }
 
@@ -1204,9 +3170,9 @@ public:
         {
           int idx = (startPixel + i) % strip.numPixels();
           // shaky intensity
-          int r = random(settings->red / 2, settings->red);
-          int g = random(settings->green / 2, settings->green);
-          int b = random(settings->blue / 2, settings->blue);
+          int r = rng.range(settings->red / 2, settings->red);
+          int g = rng.range(settings->green / 2, settings->green);
+          int b = rng.range(settings->blue / 2, settings->blue);
           strip.setPixelColor(idx, strip.Color(r, g, b));
         }
       }
@@ -1222,61 +3188,426 @@ public:
 
 class SineWavePattern : public Pattern
 {
-  unsigned long lastUpdate = 0;
-  float phase = 0;
+  float frequency = 0.3f;
+  float speed = 0.2f;
+  FrameCache<NUM_LEDS> cache;
+  PatternParameter schema[2] = {
+      {0, "frequency", 10, 2000, &frequency},
+      {1, "speed", 10, 2000, &speed}};
 
 public:
   SineWavePattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+    parameters = schema;
+    parameterCount = 2;
+  }
+  void update() override
+  {
+    if (!nextStep())
+      return;
+
+    int n = strip.numPixels();
+
+    // One cycle is 2π / speed frames, rounded to a whole number when cached.
+    uint16_t period = lroundf(2 * (float)M_PI / speed);
+    if (cache.prepare(period, lroundf(frequency * 1000) | ((uint32_t)lroundf(speed * 1000) << 16), FRAME_CACHE_BUDGET))
+    {
+      cache.seek(settings->timebase.steps() % period);
+      if (!cache.cached())
+      {
+        float start = cache.frame() * 2 * (float)M_PI / period;
+        uint8_t *levels = cache.frameLevels();
+        for (int i = 0; i < n; i++)
+        {
+          levels[i] = (sin(start + (i * frequency)) + 1.0f) * 127.5f;
+        }
+      }
+      cache.setPalette(settings->generateHexCode(), [this](uint16_t level)
+                       { return strip.Color(settings->red * level / 255, settings->green * level / 255, settings->blue * level / 255); });
+      cache.render(strip);
+    }
+    else
+    {
+      float phase = settings->timebase.stepsModulo(max(period, (uint16_t)1)) * speed;
+      strip.clear();
+      for (int i = 0; i < n; i++)
+      {
+        float brightness = (sin(phase + (i * frequency)) + 1.0f) * 0.5f; // 0–1
+        int r = settings->red * brightness;
+        int g = settings->green * brightness;
+        int b = settings->blue * brightness;
+        strip.setPixelColor(i, strip.Color(r, g, b));
+      }
+    }
+    strip.show();
+  }
+};
+
+class BlizzardPattern : public Pattern
+{
+
+public:
+  BlizzardPattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+  }
+  void update() override
+  {
+    if (!nextStep())
+      return;
+
+    strip.clear();
+    int n = strip.numPixels();
+    int flicker = random(200, 256); // brightness variation
+    for (int i = 0; i < n; i++)
+    {
+      int r = (settings->red * flicker) / 255;
+      int g = (settings->green * flicker) / 255;
+      int b = (settings->blue * flicker) / 255;
+      strip.setPixelColor(i, strip.Color(r, g, b));
+    }
+    strip.show();
+  }
+};
+
+// Coherent counterparts of fire, noise and blizzard: instead of fresh random
+// values every frame, each pixel reads a noise field that drifts with the
+// timebase, so neighbouring pixels and frames change together. `scale` is the
+// field distance between pixels and `speed` how far it moves per step, both in
+// 1/256 of a noise cell.
+class NoiseFirePattern : public Pattern
+{
+  int scale = 40;
+  int speed = 48;
+  uint8_t heat[NUM_LEDS];
+  uint32_t frame[NUM_LEDS];
+  uint32_t palette[256];
+  int paletteColor = -1;
+  PatternParameter schema[2] = {
+      {0, "scale", 1, 1024, &scale},
+      {1, "speed", 1, 1024, &speed}};
+
+public:
+  NoiseFirePattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+    parameters = schema;
+    parameterCount = 2;
+  }
+  void update() override
+  {
+    if (!nextStep())
+      return;
+
+    // heat runs from black up to the colour, then on towards a white-hot core
+    if (paletteColor != settings->generateHexCode())
+    {
+      paletteColor = settings->generateHexCode();
+      uint32_t color = strip.Color(settings->red, settings->green, settings->blue);
+      for (int level = 0; level < 256; level++)
+      {
+        palette[level] = level < 160 ? scalePixel(color, level * 256 / 160)
+                                     : blendPixel(color, 0xFFD080, (level - 160) * 256 / 96);
+      }
+    }
+
+    int n = strip.numPixels();
+    uint32_t time = settings->timebase.travel(speed);
+    // the field also rises along the strip, twice as fast as it changes
+    fillNoise8(heat, n, -2 * time, scale, time, 2);
+    for (int i = 0; i < n; i++)
+    {
+      frame[i] = palette[noise::clamp8((heat[i] - 64) * 2)];
+    }
+    writePixels(strip, frame, n);
+    strip.show();
+  }
+};
+
+class NoiseFieldPattern : public Pattern
+{
+  int scale = 24;
+  int speed = 32;
+  uint8_t levels[3][NUM_LEDS];
+  uint32_t frame[NUM_LEDS];
+  PatternParameter schema[2] = {
+      {0, "scale", 1, 1024, &scale},
+      {1, "speed", 1, 1024, &speed}};
+
+public:
+  NoiseFieldPattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+    parameters = schema;
+    parameterCount = 2;
+  }
+  void update() override
+  {
+    if (!nextStep())
+      return;
+
+    // each channel reads its own, far apart, region of the field
+    int n = strip.numPixels();
+    uint32_t time = settings->timebase.travel(speed);
+    for (int channel = 0; channel < 3; channel++)
+    {
+      fillNoise8(levels[channel], n, channel * 0x550000, scale, time + channel * 0x2A0000, 1);
+    }
+    for (int i = 0; i < n; i++)
+    {
+      frame[i] = strip.Color(settings->red * levels[0][i] >> 8,
+                             settings->green * levels[1][i] >> 8,
+                             settings->blue * levels[2][i] >> 8);
+    }
+    writePixels(strip, frame, n);
+    strip.show();
+  }
+};
+
+class NoiseBlizzardPattern : public Pattern
+{
+  int scale = 32;
+  int speed = 40;
+  uint8_t gusts[NUM_LEDS];
+  uint8_t flakes[NUM_LEDS];
+  uint32_t frame[NUM_LEDS];
+  PatternParameter schema[2] = {
+      {0, "scale", 1, 1024, &scale},
+      {1, "speed", 1, 1024, &speed}};
+
+public:
+  NoiseBlizzardPattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+    parameters = schema;
+    parameterCount = 2;
+  }
+  void update() override
+  {
+    if (!nextStep())
+      return;
+
+    int n = strip.numPixels();
+    uint32_t time = settings->timebase.travel(speed);
+    uint32_t color = strip.Color(settings->red, settings->green, settings->blue);
+
+    // Gusts sweep along the strip dimming the colour to between 160 and 255;
+    // finer, faster noise makes the flakes.
+    fillNoise8(gusts, n, time * 3, scale, time, 2);
+    fillNoise8(flakes, n, time * 5, scale * 6, time * 4, 1);
+    for (int i = 0; i < n; i++)
+    {
+      uint32_t pixel = scalePixel(color, 160 + (gusts[i] * 96 >> 8));
+      if (flakes[i] > 200)
+      {
+        pixel = blendPixel(pixel, 0xFFFFFF, (flakes[i] - 200) * 4);
+      }
+      frame[i] = pixel;
+    }
+    writePixels(strip, frame, n);
+    strip.show();
+  }
+};
+
+// Spreads the uploaded palette along the strip `repeats` times and scrolls it
+// by `speed` 256ths of a palette entry per step.
+class PalettePattern : public Pattern
+{
+  int speed = 256;
+  int repeats = 1;
+  uint32_t frame[NUM_LEDS];
+  PatternParameter schema[2] = {
+      {0, "speed", 0, 2048, &speed},
+      {1, "repeats", 1, 16, &repeats}};
+
+public:
+  PalettePattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+    parameters = schema;
+    parameterCount = 2;
+  }
+  void update() override
+  {
+    if (!nextStep())
+      return;
+
+    int n = strip.numPixels();
+    uint32_t step = (repeats << 16) / n; // palette index per pixel, 8.8
+    uint32_t index = settings->timebase.travel(speed);
+    for (int i = 0; i < n; i++)
+    {
+      frame[i] = colorFromPalette(index >> 8);
+      index += step;
+    }
+    writePixels(strip, frame, n);
+    strip.show();
+  }
+};
+
+// Runs the program uploaded through the program characteristic. Time advances
+// one unit per pattern step so the app's rate control still applies.
+class ProgramPattern : public Pattern
+{
+  uint32_t origin = 0; // timebase steps when the pattern started
+  uint16_t revision = 0;
+  PatternVM vm;
+
+public:
+  ProgramPattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+    origin = settings->timebase.steps();
+  }
+  void update() override
+  {
+    if (!nextStep())
+      return;
+
+    if (revision != settings->programs.revision)
+    {
+      revision = settings->programs.revision;
+      vm.load(settings->programs.data, settings->programs.length);
+    }
+
+    if (!vm.isLoaded())
+    {
+      strip.fill(strip.Color(settings->red, settings->green, settings->blue));
+      strip.show();
+      return;
+    }
+
+    int32_t time = PatternVM::time(settings->timebase.steps() - origin, (uint16_t)settings->timebase.phase16());
+    int n = strip.numPixels();
+
+    vm.beginFrame(time, n, settings->red, settings->green, settings->blue);
+    for (int i = 0; i < n; i++)
+    {
+      uint8_t r, g, b;
+      vm.shade(i, r, g, b);
+      strip.setPixelColor(i, strip.Color(r, g, b));
+    }
+    strip.show();
+  }
+};
+
+// Audio-reactive patterns render at a fixed cadence rather than once a step
+// so features are shown as soon as they play out; the step length only
+// controls how fast the effects decay.
+class AudioPulsePattern : public Pattern
+{
+  unsigned long lastUpdate = 0;
+  uint8_t envelope = 0;
+
+public:
+  AudioPulsePattern(DeviceSettings *settings)
+  {
+    this->settings = settings;
+  }
+  void update() override
+  {
+    unsigned long now = millis();
+    if (now - lastUpdate < AUDIO_FRAME_INTERVAL)
+      return;
+    lastUpdate = now;
+
+    AudioFeatures features;
+    if (settings->audio.sample(now, features))
+    {
+      envelope = 255;
+    }
+    else
+    {
+      // fades out over five steps
+      int decay = max(1, (int)(255ULL * AUDIO_FRAME_INTERVAL * 1000 / max(1ULL, settings->timebase.step() * 5ULL)));
+      envelope = max(0, envelope - decay);
+    }
+
+    int level = max((int)envelope, (int)features.bands[0]);
+    strip.fill(strip.Color(
+        settings->red * level / 255,
+        settings->green * level / 255,
+        settings->blue * level / 255));
+    strip.show();
+  }
+};
+
+class AudioRipplePattern : public Pattern
+{
+  unsigned long lastUpdate = 0;
+  unsigned long beatAt = 0;
+  int center = 0;
+
+public:
+  AudioRipplePattern(DeviceSettings *settings)
   {
     this->settings = settings;
   }
   void update() override
   {
     unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (now - lastUpdate < AUDIO_FRAME_INTERVAL)
       return;
     lastUpdate = now;
 
-    strip.clear();
     int n = strip.numPixels();
+    AudioFeatures features;
+    if (settings->audio.sample(now, features))
+    {
+      center = random(n);
+      beatAt = now;
+    }
+
+    // the ring travels one pixel per fifth of a step and fades as it spreads
+    int radius = min((unsigned long)INT16_MAX, (now - beatAt) * 5000UL / max(1UL, (unsigned long)settings->timebase.step()));
+    int fade = max(0, 255 - radius * 4);
+    int floor = features.bands[1] / 4;
+
     for (int i = 0; i < n; i++)
     {
-      float brightness = (sin(phase + (i * 0.3f)) + 1.0f) * 0.5f; // 0–1
-      int r = settings->red * brightness;
-      int g = settings->green * brightness;
-      int b = settings->blue * brightness;
-      strip.setPixelColor(i, strip.Color(r, g, b));
+      int ring = abs(abs(i - center) - radius);
+      int brightness = max(floor, max(0, 255 - ring * 50) * fade / 255);
+      strip.setPixelColor(i, strip.Color(
+                                 settings->red * brightness / 255,
+                                 settings->green * brightness / 255,
+                                 settings->blue * brightness / 255));
     }
     strip.show();
-    phase += 0.2f;
   }
 };
 
-class BlizzardPattern : public Pattern
+class AudioSparklePattern : public Pattern
 {
   unsigned long lastUpdate = 0;
 
 public:
-  BlizzardPattern(DeviceSettings *settings)
+  AudioSparklePattern(DeviceSettings *settings)
   {
     this->settings = settings;
   }
   void update() override
   {
     unsigned long now = millis();
-    if (now - lastUpdate < settings->interval)
+    if (now - lastUpdate < AUDIO_FRAME_INTERVAL)
       return;
     lastUpdate = now;
 
-    strip.clear();
+    AudioFeatures features;
+    bool beat = settings->audio.sample(now, features);
+
+    // mids set the background, highs the sparkle density
     int n = strip.numPixels();
-    int flicker = random(200, 256); // brightness variation
-    for (int i = 0; i < n; i++)
+    int background = features.bands[3] / 2;
+    strip.fill(strip.Color(
+        settings->red * background / 255,
+        settings->green * background / 255,
+        settings->blue * background / 255));
+
+    int sparkles = (features.bands[6] + features.bands[7]) / 64 + (beat ? 8 : 0);
+    for (int i = 0; i < sparkles; i++)
     {
-      int r = (settings->red * flicker) / 255;
-      int g = (settings->green * flicker) / 255;
-      int b = (settings->blue * flicker) / 255;
-      strip.setPixelColor(i, strip.Color(r, g, b));
+      strip.setPixelColor(random(n), strip.Color(settings->red, settings->green, settings->blue));
     }
     strip.show();
   }
@@ -1285,9 +3616,7 @@ public:
 class RainbowModeHandler
 {
 private:
-  unsigned long lastUpdate = 0;
   DeviceSettings *settings;
-  int offset = 0;
 
   void hsvToRgb(uint16_t h, uint8_t s, uint8_t v, uint8_t &r, uint8_t &g, uint8_t &b)
   {
@@ -1347,14 +3676,9 @@ public:
       return;
     }
 
-    unsigned long now = millis();
-    if (now - lastUpdate < this->settings->interval / 2)
-    {
-      return;
-    }
-
-    static uint16_t hue = 0;
-    hue = (hue + 1) % 360;
+    // two degrees of hue per step, moving on every half step
+    const Timebase &timebase = this->settings->timebase;
+    uint16_t hue = (timebase.steps() % 180) * 2 + (timebase.fraction8() >> 7);
 
     uint8_t r, g, b;
     hsvToRgb(hue, 255, 255, r, g, b);
@@ -1362,10 +3686,97 @@ public:
     settings->red = r;
     settings->green = g;
     settings->blue = b;
+  }
+};
 
-    lastUpdate = now;
+// Plays the stored show by rewriting the device settings at step boundaries,
+// the same way a connected app would. Colour and rate are blended over each
+// step's transition time.
+class ShowSequencer
+{
+private:
+  DeviceSettings *settings;
+  uint16_t revision = 0;
+  bool playing = false;
+  uint8_t index = 0;
+  unsigned long stepStartedAt = 0;
+  bool settled = false;
+  uint8_t fromRed = 0;
+  uint8_t fromGreen = 0;
+  uint8_t fromBlue = 0;
+  uint16_t fromInterval = 0;
+
+  void enter(uint8_t step, unsigned long now)
+  {
+    const ShowStep &next = this->settings->show.steps[step];
+
+    this->index = step;
+    this->stepStartedAt = now;
+    this->settled = false;
+    this->fromRed = this->settings->red;
+    this->fromGreen = this->settings->green;
+    this->fromBlue = this->settings->blue;
+    this->fromInterval = this->settings->interval;
+
+    this->settings->setPattern(next.pattern);
+    this->settings->rainbow = next.flags & 0x01;
+  }
+
+  static uint16_t blend(uint16_t from, uint16_t to, uint16_t amount)
+  {
+    return from + (((int32_t)to - from) * amount >> 8);
+  }
+
+public:
+  ShowSequencer(DeviceSettings *settings)
+  {
+    this->settings = settings;
+  }
+
+  void update()
+  {
+    ShowStore &show = this->settings->show;
+    unsigned long now = millis();
 
-    offset += 256;
+    if (this->revision != show.revision)
+    {
+      this->revision = show.revision;
+      this->playing = show.playing && show.count > 0;
+      if (this->playing)
+      {
+        this->enter(0, now);
+      }
+    }
+
+    if (!this->playing)
+    {
+      return;
+    }
+
+    const ShowStep &step = show.steps[this->index];
+    unsigned long elapsed = now - this->stepStartedAt;
+
+    if (elapsed < step.transition)
+    {
+      uint16_t amount = elapsed * 256 / step.transition;
+      this->settings->red = blend(this->fromRed, step.red, amount);
+      this->settings->green = blend(this->fromGreen, step.green, amount);
+      this->settings->blue = blend(this->fromBlue, step.blue, amount);
+      this->settings->setRate(blend(this->fromInterval, step.interval, amount) * 1000UL);
+    }
+    else if (!this->settled)
+    {
+      this->settings->red = step.red;
+      this->settings->green = step.green;
+      this->settings->blue = step.blue;
+      this->settings->setRate(step.interval * 1000UL);
+      this->settled = true;
+    }
+
+    if (elapsed >= step.duration * 100UL)
+    {
+      this->enter((this->index + 1) % show.count, now);
+    }
   }
 };
 
@@ -1374,7 +3785,6 @@ class SecurityService
 private:
   DeviceSettings *settings;
   BLEServer *server;
-  const ulong timeout = 10000;
 
 public:
   SecurityService(DeviceSettings *settings, BLEServer *server)
@@ -1383,44 +3793,174 @@ public:
     this->server = server;
   }
 
+  // Asks the stack to drop devices that have not authenticated within the
+  // timeout; their sessions are freed when the disconnect comes back.
   void verifyDevices()
   {
     auto now = millis();
 
-    std::unordered_set<uint16_t> toRemove = std::unordered_set<uint16_t>();
-
-    // iterate over connected devices and disconnect those that are not authenticated if time has elapsed longer than timeout
-    for (auto it = settings->devicesPendingAuthentication->begin(); it != settings->devicesPendingAuthentication->end();)
+    // nothing to do until the earliest pending deadline passes
+    if (!settings->sessions.deadlineDue(now))
     {
-      auto connId = it->first;
-      auto connectedAt = it->second;
+      return;
+    }
+
+    settings->sessions.expire(now, [this](uint16_t connectionID)
+                              {
+                                Serial.printf("Disconnecting unauthenticated device with connection ID: %d\n", connectionID);
+                                this->server->disconnect(connectionID);
+                              });
+  }
+};
+
+// State carried in the scan response, so a scan shows what every frame is
+// doing without connecting to it. Manufacturer data, little endian:
+//   [company ID (2), format, state version (2), pattern ID, red, green, blue, brightness, flags]
+// The state version counts published changes and wraps; it restarts at 0
+// after a reboot.
+#define STATE_COMPANY_ID 0xFFFF // reserved for testing; no company ID has been assigned
+#define STATE_FORMAT 1
+#define STATE_SIZE 11
+#define STATE_INTERVAL 250 // fewest milliseconds between scan response updates
+#define STATE_FLAG_RAINBOW 0x01
+#define STATE_FLAG_SHOW 0x02
+#define STATE_FLAG_DARK 0x04
+#define STATE_FLAG_FULL 0x08 // no free connection slot
+
+// Each field takes a length and a type byte; the scan response holds 31 bytes.
+static_assert((2 + sizeof(DEVICE_SHORT_NAME) - 1) + (2 + STATE_SIZE) <= 31, "scan response does not fit in 31 bytes");
+
+// Keeps the scan response in step with the device state.
+//
+// The state is compared every link pass and republished when it differs, at most
+// once per STATE_INTERVAL so a client streaming colours does not keep the
+// controller busy. While rainbow mode or a show is moving the colour, only the
+// colour is left out of the comparison; it is sent as it stood at the last
+// update.
+class StateAdvertiser
+{
+private:
+  DeviceSettings *settings;
+  BLEServer *server;
+  uint8_t state[STATE_SIZE];
+  uint16_t version = 0;
+  bool published = false;
+  unsigned long publishedAt = 0;
 
-      // Remove devices that are authenticated from the pending authentication list.
-      if (settings->authenticatedDeviceSet->find(connId) != settings->authenticatedDeviceSet->end())
+  void capture(uint8_t *state)
+  {
+    uint8_t pattern = this->settings->patternIndex.load(std::memory_order_relaxed);
+    auto peak = max(this->settings->red, max(this->settings->green, this->settings->blue));
+    uint8_t flags = 0;
+    if (this->settings->rainbow)
+      flags |= STATE_FLAG_RAINBOW;
+    if (this->settings->show.playing)
+      flags |= STATE_FLAG_SHOW;
+    if (this->settings->brightness <= 3 || peak <= 3)
+      flags |= STATE_FLAG_DARK;
+    if (links.count() >= MAX_CONNECTIONS)
+      flags |= STATE_FLAG_FULL;
+
+    state[0] = (uint8_t)STATE_COMPANY_ID;
+    state[1] = (uint8_t)(STATE_COMPANY_ID >> 8);
+    state[2] = STATE_FORMAT;
+    state[3] = (uint8_t)this->version;
+    state[4] = (uint8_t)(this->version >> 8);
+    state[5] = pattern;
+    state[6] = this->settings->red;
+    state[7] = this->settings->green;
+    state[8] = this->settings->blue;
+    state[9] = this->settings->brightness;
+    state[10] = flags;
+  }
+
+  bool changed(const uint8_t *current)
+  {
+    bool moving = current[10] & (STATE_FLAG_RAINBOW | STATE_FLAG_SHOW);
+    for (uint8_t i = 5; i < STATE_SIZE; i++)
+    {
+      if (moving && i >= 6 && i <= 8)
       {
-        // already authenticated → remove from pending
-        toRemove.insert(connId);
-        ++it;
         continue;
       }
-
-      // not authenticated in time
-      if (now - connectedAt > timeout)
+      if (current[i] != this->state[i])
       {
-        Serial.printf("Disconnecting unauthenticated device with connection ID: %d\n", connId);
-        server->disconnect(connId);
-        toRemove.insert(connId);
+        return true;
       }
+    }
+    return false;
+  }
+
+public:
+  StateAdvertiser(DeviceSettings *settings, BLEServer *server)
+  {
+    this->settings = settings;
+    this->server = server;
+  }
+
+  void update()
+  {
+    auto now = millis();
+    if (this->published && now - this->publishedAt < STATE_INTERVAL)
+    {
+      return;
+    }
 
-      ++it;
+    uint8_t current[STATE_SIZE];
+    this->capture(current);
+    if (this->published && !this->changed(current))
+    {
+      return;
     }
 
-    // remove collected devices from pending authentication
-    for (auto connId : toRemove)
+    if (this->published)
     {
-      settings->devicesPendingAuthentication->erase(connId);
-      Serial.printf("Removed device with connection ID: %d from pending authentication list.\n", connId);
+      this->version++;
+      current[3] = (uint8_t)this->version;
+      current[4] = (uint8_t)(this->version >> 8);
     }
+    memcpy(this->state, current, STATE_SIZE);
+    this->published = true;
+    this->publishedAt = now;
+
+    BLEAdvertisementData response;
+    response.setShortName(DEVICE_SHORT_NAME);
+    response.setManufacturerData(String(this->state, STATE_SIZE));
+    this->server->getAdvertising()->setScanResponseData(response);
+  }
+};
+
+// Asks each central for connection parameters that suit how the link is used.
+class LinkTuner
+{
+private:
+  BLEServer *server;
+
+  void retune(const Link &link)
+  {
+    bool fast = link.mode == LinkMode::Fast;
+    uint16_t minInterval = fast ? LINK_FAST_MIN_INTERVAL : LINK_IDLE_MIN_INTERVAL;
+    uint16_t maxInterval = fast ? LINK_FAST_MAX_INTERVAL : LINK_IDLE_MAX_INTERVAL;
+    uint16_t latency = fast ? LINK_FAST_LATENCY : LINK_IDLE_LATENCY;
+    uint16_t timeout = fast ? LINK_FAST_TIMEOUT : LINK_IDLE_TIMEOUT;
+
+    uint8_t address[6]; // updateConnParams takes a mutable address
+    memcpy(address, link.address, sizeof(address));
+    this->server->updateConnParams(address, minInterval, maxInterval, latency, timeout);
+    trace.link(millis(), link.connectionID, maxInterval, latency);
+    Serial.printf("Connection %d at %d writes/s, requesting %s parameters\n", link.connectionID, link.rate, fast ? "fast" : "idle");
+  }
+
+public:
+  LinkTuner(BLEServer *server)
+  {
+    this->server = server;
+  }
+
+  void update()
+  {
+    links.review(millis(), [this](const Link &link)
+                 { this->retune(link); });
   }
 };
 
@@ -1482,15 +4022,112 @@ Pattern *createPattern(String name, DeviceSettings *settings)
     return new SineWavePattern(settings);
   if (name == "blizzard")
     return new BlizzardPattern(settings);
+  if (name == "custom")
+    return new ProgramPattern(settings);
+  if (name == "audio_pulse")
+    return new AudioPulsePattern(settings);
+  if (name == "audio_ripple")
+    return new AudioRipplePattern(settings);
+  if (name == "audio_sparkle")
+    return new AudioSparklePattern(settings);
+  if (name == "spin")
+    return new SpinPattern(settings);
+  if (name == "noise_fire")
+    return new NoiseFirePattern(settings);
+  if (name == "noise_field")
+    return new NoiseFieldPattern(settings);
+  if (name == "noise_blizzard")
+    return new NoiseBlizzardPattern(settings);
+  if (name == "palette")
+    return new PalettePattern(settings);
 
   return nullptr;
 }
 
+// Republishes the schema of `pattern`, or an empty one for none, for the BLE
+// task to read.
+void publishParameters(Pattern *pattern, DeviceSettings *settings)
+{
+  uint8_t *schema = settings->parameterSchema.back();
+  settings->parameterSchema.publish(pattern ? pattern->describeParameters(schema, PARAMETER_SCHEMA_SIZE) : 0);
+}
+
+// Applies parameter writes received since the last frame and republishes the
+// schema so reads reflect the live values.
+void applyPatternParameters(Pattern *pattern, DeviceSettings *settings)
+{
+  uint16_t pending = settings->pendingParameters.exchange(0);
+  if (pending == 0)
+    return;
+
+  for (uint8_t id = 0; id < MAX_PATTERN_PARAMETERS; id++)
+  {
+    if (pending & (1 << id))
+      pattern->setParameter(id, settings->parameterValues[id]);
+  }
+
+  publishParameters(pattern, settings);
+}
+
+// Applies the setting changes queued by the BLE task that are due, at most
+// the newest one per setting.
+void applyCommands(DeviceSettings *settings)
+{
+  auto now = millis();
+  settings->commands.collect();
+
+  Command command;
+  for (uint8_t field = 0; field < COMMAND_FIELDS; field++)
+  {
+    if (!settings->commands.take(field, now, command))
+      continue;
+
+    switch (field)
+    {
+    case COMMAND_COLOR:
+      settings->red = command.value >> 16;
+      settings->green = command.value >> 8;
+      settings->blue = command.value;
+      break;
+    case COMMAND_PATTERN:
+      settings->setPattern(command.value);
+      break;
+    case COMMAND_RATE:
+      settings->setRate(command.value);
+      break;
+    case COMMAND_RAINBOW:
+      settings->rainbow = command.value != 0;
+      break;
+    case COMMAND_BRIGHTNESS:
+      settings->brightness = command.value;
+      break;
+    case COMMAND_SHOW:
+      settings->show.play(command.value != 0);
+      break;
+    case COMMAND_PRESET:
+    {
+      PresetNotice notice = {{(uint8_t)command.value}};
+      settings->capturePreset(notice.value + 1);
+      settings->recalls.push(notice);
+      break;
+    }
+    }
+  }
+}
+
 // PATTERNS END
 BLEServer *pServer = nullptr;
 DeviceSettings *deviceSettings = nullptr;
 RainbowModeHandler *rainbowModeHandler = nullptr;
+ShowSequencer *showSequencer = nullptr;
 SecurityService *authenticationtimeoutHandler = nullptr;
+LinkTuner *linkTuner = nullptr;
+OtaCallbacks *otaCallbacks = nullptr;
+StateAdvertiser *stateAdvertiser = nullptr;
+
+#ifdef RENDER_TASK_CORE
+void renderTask(void *);
+#endif
 
 void setup()
 {
@@ -1499,12 +4136,23 @@ void setup()
   pinMode(D0, OUTPUT);
   digitalWrite(D0, LOW);
 
-  BLEDevice::init("M and M - Frame 1");
+  layout.perimeter(FRAME_WIDTH, FRAME_HEIGHT, FRAME_START, false);
+
+  BLEDevice::init(DEVICE_NAME);
+  BLEDevice::setCustomGattsHandler(recordGattsInterface);
+  BLEDevice::setMTU(517);
 
   deviceSettings = new DeviceSettings();
+  deviceSettings->programs.load();
+  deviceSettings->show.load();
+  deviceSettings->palettes.load();
+  deviceSettings->presets.load();
   rainbowModeHandler = new RainbowModeHandler(deviceSettings);
+  showSequencer = new ShowSequencer(deviceSettings);
   pServer = BLEDevice::createServer();
   authenticationtimeoutHandler = new SecurityService(deviceSettings, pServer);
+  linkTuner = new LinkTuner(pServer);
+  stateAdvertiser = new StateAdvertiser(deviceSettings, pServer);
 
   pServer->setCallbacks(new ServerCallbacks(deviceSettings));
 
@@ -1512,13 +4160,14 @@ void setup()
   BLEService *pSecurityService = pServer->createService(SECURITY_SERVICE_UUID);
 
   auto pAuthenticateChar = pSecurityService->createCharacteristic(
-      AUTHENTICATE_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_WRITE);
+      AUTHENTICATE_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
 
-  pAuthenticateChar->setCallbacks(new AuthenticationCallbacks(deviceSettings, pServer));
+  pAuthenticateChar->setCallbacks(new TracingCallbacks(AUTHENTICATE_CHARACTERISTIC_UUID, new AuthenticationCallbacks(deviceSettings, pServer)));
 
   //! SECTION Security
 
-  BLEService *pColorService = pServer->createService(COLOR_SERVICE_UUID);
+  // Every notifying characteristic takes four handles (declaration, value, 0x2901, 0x2902).
+  BLEService *pColorService = pServer->createService(BLEUUID(COLOR_SERVICE_UUID), COLOR_SERVICE_HANDLES);
 
   auto pColorModeChar = pColorService->createCharacteristic(
       COLOR_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
@@ -1528,7 +4177,7 @@ void setup()
 
   pColorModeChar->addDescriptor(pColorModeCharDescriptor);
   pColorModeChar->addDescriptor(new BLE2902());
-  pColorModeChar->setCallbacks(new ColorCharacteristicCallbacks(deviceSettings, pServer));
+  pColorModeChar->setCallbacks(new TracingCallbacks(COLOR_CHARACTERISTIC_UUID, new ColorCharacteristicCallbacks(deviceSettings, pServer)));
 
   BLEDescriptor *pRainbowModeCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
   pRainbowModeCharDescriptor->setValue("Rainbow mode enabled/disabled bit characteristic.");
@@ -1538,7 +4187,7 @@ void setup()
 
   pRainbowModeChar->addDescriptor(pRainbowModeCharDescriptor);
   pRainbowModeChar->addDescriptor(new BLE2902());
-  pRainbowModeChar->setCallbacks(new RainbowModeCallbacks(deviceSettings, pServer));
+  pRainbowModeChar->setCallbacks(new TracingCallbacks(RAINBOW_MODE_CHARACTERISTIC_UUID, new RainbowModeCallbacks(deviceSettings, pServer)));
 
   BLEDescriptor *pPatternCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
   pPatternCharDescriptor->setValue("The active color pattern.");
@@ -1548,7 +4197,7 @@ void setup()
 
   pPatternModeChar->addDescriptor(pPatternCharDescriptor);
   pPatternModeChar->addDescriptor(new BLE2902());
-  pPatternModeChar->setCallbacks(new PatternCallbacks(deviceSettings, pServer));
+  pPatternModeChar->setCallbacks(new TracingCallbacks(COLOR_PATTERN_CHARACTERISTIC_UUID, new PatternCallbacks(deviceSettings, pServer)));
 
   // SECTION Pattern Rate Characteristic
 
@@ -1560,7 +4209,131 @@ void setup()
 
   pPatternRateChar->addDescriptor(pPatternRateCharDescriptor);
   pPatternRateChar->addDescriptor(new BLE2902());
-  pPatternRateChar->setCallbacks(new PatternRateCallbacks(deviceSettings, pServer));
+  pPatternRateChar->setCallbacks(new TracingCallbacks(PATTERN_RATE_CHARACTERISTIC_UUID, new PatternRateCallbacks(deviceSettings, pServer)));
+
+  // !SECTION
+
+  // SECTION Brightness Characteristic
+
+  BLEDescriptor *pBrightnessCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pBrightnessCharDescriptor->setValue("Global brightness, independent of the color.");
+
+  auto pBrightnessChar = pColorService->createCharacteristic(
+      BRIGHTNESS_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+
+  pBrightnessChar->addDescriptor(pBrightnessCharDescriptor);
+  pBrightnessChar->addDescriptor(new BLE2902());
+  pBrightnessChar->setCallbacks(new TracingCallbacks(BRIGHTNESS_CHARACTERISTIC_UUID, new BrightnessCallbacks(deviceSettings, pServer)));
+
+  // !SECTION
+
+  // SECTION Program Characteristic
+
+  BLEDescriptor *pProgramCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pProgramCharDescriptor->setValue("Uploaded bytecode for the custom pattern.");
+
+  auto pProgramChar = pColorService->createCharacteristic(
+      PROGRAM_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+
+  pProgramChar->addDescriptor(pProgramCharDescriptor);
+  pProgramChar->addDescriptor(new BLE2902());
+  pProgramChar->setCallbacks(new TracingCallbacks(PROGRAM_CHARACTERISTIC_UUID, new ProgramCallbacks(deviceSettings, pServer)));
+
+  // !SECTION
+
+  // SECTION Show Characteristic
+
+  BLEDescriptor *pShowCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pShowCharDescriptor->setValue("On-device show playlist upload and playback control.");
+
+  auto pShowChar = pColorService->createCharacteristic(
+      SHOW_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+
+  pShowChar->addDescriptor(pShowCharDescriptor);
+  pShowChar->addDescriptor(new BLE2902());
+  pShowChar->setCallbacks(new TracingCallbacks(SHOW_CHARACTERISTIC_UUID, new ShowCallbacks(deviceSettings, pServer)));
+
+  // !SECTION
+
+  // SECTION Audio Characteristic
+
+  BLEDescriptor *pAudioCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pAudioCharDescriptor->setValue("Audio features: timestamp, beat flag and band energies.");
+
+  auto pAudioChar = pColorService->createCharacteristic(
+      AUDIO_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_WRITE_NR);
+
+  pAudioChar->addDescriptor(pAudioCharDescriptor);
+  pAudioChar->setCallbacks(new TracingCallbacks(AUDIO_CHARACTERISTIC_UUID, new AudioCallbacks(deviceSettings)));
+
+  // !SECTION
+
+  // SECTION Parameter Characteristic
+
+  BLEDescriptor *pParameterCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pParameterCharDescriptor->setValue("Tunable parameters of the active pattern.");
+
+  auto pParameterChar = pColorService->createCharacteristic(
+      PARAMETER_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+
+  pParameterChar->addDescriptor(pParameterCharDescriptor);
+  pParameterChar->setCallbacks(new TracingCallbacks(PARAMETER_CHARACTERISTIC_UUID, new ParameterCallbacks(deviceSettings, pServer)));
+
+  // !SECTION
+
+  // SECTION Palette Characteristic
+
+  BLEDescriptor *pPaletteCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pPaletteCharDescriptor->setValue("Gradient palette: up to 16 stops of position, red, green, blue.");
+
+  auto pPaletteChar = pColorService->createCharacteristic(
+      PALETTE_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+
+  pPaletteChar->addDescriptor(pPaletteCharDescriptor);
+  pPaletteChar->addDescriptor(new BLE2902());
+  pPaletteChar->setCallbacks(new TracingCallbacks(PALETTE_CHARACTERISTIC_UUID, new PaletteCallbacks(deviceSettings, pServer)));
+
+  // !SECTION
+
+  // SECTION Preset Characteristic
+
+  BLEDescriptor *pPresetCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pPresetCharDescriptor->setValue("Presets stored on the device; write an index to recall one.");
+
+  auto pPresetChar = pColorService->createCharacteristic(
+      PRESET_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+
+  pPresetChar->addDescriptor(pPresetCharDescriptor);
+  pPresetChar->addDescriptor(new BLE2902());
+  pPresetChar->setCallbacks(new TracingCallbacks(PRESET_CHARACTERISTIC_UUID, new PresetCallbacks(deviceSettings, pServer)));
+
+  // !SECTION
+
+  // SECTION OTA Characteristic
+
+  BLEDescriptor *pOtaCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pOtaCharDescriptor->setValue("Firmware update as a delta against the running image.");
+
+  auto pOtaChar = pColorService->createCharacteristic(
+      OTA_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR | BLECharacteristic::PROPERTY_NOTIFY);
+
+  pOtaChar->addDescriptor(pOtaCharDescriptor);
+  pOtaChar->addDescriptor(new BLE2902());
+  otaCallbacks = new OtaCallbacks(deviceSettings, pServer, pOtaChar);
+  pOtaChar->setCallbacks(otaCallbacks);
+
+  // !SECTION
+
+  // SECTION Trace Characteristic
+
+  BLEDescriptor *pTraceCharDescriptor = new BLEDescriptor((uint16_t)0x2901);
+  pTraceCharDescriptor->setValue("Recent command trace; write to rewind, read repeatedly to dump.");
+
+  auto pTraceChar = pColorService->createCharacteristic(
+      TRACE_CHARACTERISTIC_UUID, BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE);
+
+  pTraceChar->addDescriptor(pTraceCharDescriptor);
+  pTraceChar->setCallbacks(new TraceCallbacks(deviceSettings, pServer));
 
   // !SECTION
 
@@ -1571,26 +4344,82 @@ void setup()
   advertisement->addServiceUUID(COLOR_SERVICE_UUID);
   advertisement->setScanResponse(true);
   advertisement->setMinPreferred(0x06); // functions that help with iPhone connections issue
+  stateAdvertiser->update();
 
   advertisement->start();
 
   Serial.printf("Server initialized with appId: %d\n", pServer->m_appId);
+
+#ifdef RENDER_TASK_CORE
+  xTaskCreatePinnedToCore(renderTask, "render", RENDER_TASK_STACK, nullptr, RENDER_TASK_PRIORITY, nullptr, RENDER_TASK_CORE);
+#endif
+}
+
+// Prints the trace over serial when a 'T' is received.
+void dumpTrace()
+{
+  char line[96];
+  for (uint32_t sequence = trace.begin(); sequence < trace.end(); sequence++)
+  {
+    if (trace.format(sequence, line, sizeof(line)) > 0)
+    {
+      Serial.print(line);
+    }
+  }
+}
+
+// Prints the frame statistics over serial when an 'S' is received, and starts
+// a new measurement.
+void dumpFrameStats()
+{
+  char line[96];
+  if (frameStats.format(line, sizeof(line)) > 0)
+  {
+    Serial.print(line);
+  }
+  frameStats.reset();
+  Serial.printf("commands coalesced %lu dropped %lu\n", (unsigned long)deviceSettings->commands.coalesced,
+                (unsigned long)deviceSettings->commands.dropped.load());
 }
 
 Pattern *activePattern = nullptr;
 String currentPattern = "";
 bool isOff = false;
-void loop()
+uint32_t tracedFrame = 0;
+unsigned long lastOutputFrame = 0;
+void render()
 {
-  if (pServer->getConnectedCount() > 0)
+  if (Serial.available() > 0)
+  {
+    switch (Serial.read())
+    {
+    case 'T':
+      dumpTrace();
+      break;
+    case 'S':
+      dumpFrameStats();
+      break;
+    }
+  }
+
+  if (deviceSettings->restartAt != 0 && (long)(millis() - deviceSettings->restartAt) >= 0)
   {
-    authenticationtimeoutHandler->verifyDevices();
+    esp_restart();
   }
 
-  auto brightness = (deviceSettings->red + deviceSettings->green + deviceSettings->blue) / 3;
-  strip.setBrightness(brightness);
+  deviceSettings->programs.update();
+  deviceSettings->show.update();
+  deviceSettings->palettes.update();
+  applyCommands(deviceSettings);
+  showSequencer->update();
 
-  if (brightness <= 3 && !isOff)
+  // Brightness is applied by strip.show() on the way out, so the pixel buffer
+  // always holds full-scale colours. Power down for zero brightness or black.
+  strip.setOutputBrightness(deviceSettings->brightness);
+  auto peak = max(deviceSettings->red, max(deviceSettings->green, deviceSettings->blue));
+  bool dark = deviceSettings->brightness <= 3 || peak <= 3;
+
+  if (dark && !isOff)
   {
     strip.fill(strip.Color(0, 0, 0));
     strip.show();
@@ -1599,7 +4428,7 @@ void loop()
     digitalWrite(D10, LOW);
     isOff = true;
   }
-  else if (brightness > 3 && isOff)
+  else if (!dark && isOff)
   {
     isOff = false;
     digitalWrite(D0, HIGH);
@@ -1620,11 +4449,102 @@ void loop()
       delete activePattern;
     }
     activePattern = createPattern(currentPattern, deviceSettings);
+    // writes meant for the old pattern's parameters must not reach the new one's
+    deviceSettings->pendingParameters.store(0);
+    publishParameters(activePattern, deviceSettings);
   }
 
   if (activePattern)
   {
+    applyPatternParameters(activePattern, deviceSettings);
+    deviceSettings->refreshPalette();
     rainbowModeHandler->update();
+    deviceSettings->timebase.advance(micros());
+
+    uint32_t shown = strip.frames;
     activePattern->update();
+
+    // Slow patterns only draw once a step; in between, draw interpolated
+    // frames at the output rate so motion stays smooth.
+    unsigned long now = millis();
+    if (strip.frames != shown)
+    {
+      lastOutputFrame = now;
+    }
+    else if (deviceSettings->timebase.step() > OUTPUT_FRAME_INTERVAL * 1000UL && now - lastOutputFrame >= OUTPUT_FRAME_INTERVAL)
+    {
+      lastOutputFrame = now;
+      activePattern->tween(now);
+    }
+  }
+
+  if (strip.frames != tracedFrame && strip.frames % TRACE_HASH_INTERVAL == 0)
+  {
+    tracedFrame = strip.frames;
+    trace.frame(millis(), strip.frames, strip.hash());
+  }
+}
+
+// One pass of the render loop, timed if it showed a frame.
+void renderPass()
+{
+  uint32_t shown = strip.frames;
+  unsigned long start = micros();
+  render();
+  if (strip.frames != shown)
+  {
+    frameStats.record(start, micros());
+  }
+}
+
+#ifdef RENDER_TASK_CORE
+// Starts a pass every RENDER_TASK_PERIOD. A pass that overruns is not caught
+// up on: the next one still waits for a tick, so the idle task on this core
+// always gets to run.
+void renderTask(void *)
+{
+  const TickType_t period = max((TickType_t)1, (TickType_t)pdMS_TO_TICKS(RENDER_TASK_PERIOD));
+  TickType_t wake = xTaskGetTickCount();
+  for (;;)
+  {
+    renderPass();
+    TickType_t now = xTaskGetTickCount();
+    if ((TickType_t)(now - wake) >= period)
+    {
+      wake = now;
+    }
+    vTaskDelayUntil(&wake, period);
+  }
+}
+#endif
+
+// Everything that calls into the BLE stack, kept out of the render loop.
+// Characteristic values belong to the BLE task, which sets them in its read
+// callbacks; notifications from here go straight to each connection with
+// esp_ble_gatts_send_indicate and never touch them.
+void linkPass()
+{
+  links.collect();
+  authenticationtimeoutHandler->verifyDevices();
+  linkTuner->update();
+  otaCallbacks->update();
+
+  PresetNotice notice;
+  while (deviceSettings->recalls.pop(notice))
+  {
+    notifyPreset(pServer, deviceSettings, notice);
   }
+
+  stateAdvertiser->update();
+}
+
+void loop()
+{
+#ifdef RENDER_TASK_CORE
+  linkPass(); // rendering runs in renderTask
+  delay(LINK_PASS_INTERVAL);
+#else
+  renderPass();
+  linkPass();
+#endif
 }
@@ -0,0 +1,233 @@
+// otadelta - builds a firmware delta for the OTA characteristic.
+//
+// Build and run on the host:
+//   g++ -std=c++17 -O2 -I include tools/otadelta.cpp -o otadelta
+//   ./otadelta key old.bin new.bin update.delta [link bytes per second]
+//
+// old.bin must be the image running on the device; new.bin is the image to
+// install (both as produced by the build, .pio/build/<env>/firmware.bin).
+// key is the device's OTA_KEY; the header is signed with it, and the device
+// refuses a delta whose signature does not match.
+//
+// The delta is a list of copies from the old image and literal inserts
+// (see DeltaPatch.h). Matches are found with a hash of every 8-byte run of the
+// old image, preferring the region just after the previous copy so code that
+// only shifted a little stays one long copy.
+//
+// Before writing anything the delta is applied with the device's DeltaPatcher,
+// fed in randomly sized pieces, and the result compared with new.bin. The
+// estimated transfer time over BLE is printed for the delta and for the full
+// image.
+
+#include <DeltaPatch.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+  const size_t MIN_MATCH = 12;  // shorter matches cost more as a copy than as literals
+  const size_t OTA_CHUNK = 507; // bytes of delta per write at a 517-byte MTU
+
+  std::vector<uint8_t> readFile(const char *path)
+  {
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+      fprintf(stderr, "%s: cannot open\n", path);
+      exit(1);
+    }
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+  }
+
+  void put32(std::vector<uint8_t> &out, uint32_t value)
+  {
+    for (int shift = 0; shift < 32; shift += 8)
+    {
+      out.push_back((value >> shift) & 0xFF);
+    }
+  }
+
+  uint64_t key(const std::vector<uint8_t> &data, size_t at)
+  {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+    {
+      value |= (uint64_t)data[at + i] << (8 * i);
+    }
+    return value;
+  }
+
+  size_t matchLength(const std::vector<uint8_t> &source, size_t from, const std::vector<uint8_t> &target, size_t at)
+  {
+    size_t length = 0;
+    while (from + length < source.size() && at + length < target.size() && source[from + length] == target[at + length])
+    {
+      length++;
+    }
+    return length;
+  }
+
+  std::vector<uint8_t> diff(const std::vector<uint8_t> &source, const std::vector<uint8_t> &target, const char *signingKey)
+  {
+    std::vector<uint8_t> delta = {'P', 'D', DELTA_VERSION, 0};
+    put32(delta, source.size());
+    put32(delta, crc32(0, source.data(), source.size()));
+    put32(delta, target.size());
+    put32(delta, crc32(0, target.data(), target.size()));
+
+    Sha256 hash;
+    hash.update(target.data(), target.size());
+    uint8_t digest[SHA256_SIZE];
+    uint8_t mac[SHA256_SIZE];
+    hash.finish(digest);
+    deltaMac((const uint8_t *)signingKey, strlen(signingKey), delta.data(), digest, mac);
+    delta.insert(delta.end(), mac, mac + SHA256_SIZE);
+
+    std::unordered_map<uint64_t, uint32_t> index;
+    for (size_t i = 0; i + 8 <= source.size(); i++)
+    {
+      index.emplace(key(source, i), i);
+    }
+
+    std::vector<uint8_t> literal;
+    auto flushLiteral = [&]()
+    {
+      if (literal.empty())
+        return;
+      delta.push_back(DELTA_INSERT);
+      put32(delta, literal.size());
+      delta.insert(delta.end(), literal.begin(), literal.end());
+      literal.clear();
+    };
+
+    size_t expected = 0; // where the old image would continue after the last copy
+    size_t at = 0;
+    while (at < target.size())
+    {
+      size_t bestFrom = 0;
+      size_t bestLength = 0;
+
+      if (expected < source.size())
+      {
+        bestFrom = expected;
+        bestLength = matchLength(source, expected, target, at);
+      }
+      if (bestLength < MIN_MATCH && at + 8 <= target.size())
+      {
+        auto found = index.find(key(target, at));
+        if (found != index.end())
+        {
+          size_t length = matchLength(source, found->second, target, at);
+          if (length > bestLength)
+          {
+            bestFrom = found->second;
+            bestLength = length;
+          }
+        }
+      }
+
+      if (bestLength >= MIN_MATCH)
+      {
+        flushLiteral();
+        delta.push_back(DELTA_COPY);
+        put32(delta, bestFrom);
+        put32(delta, bestLength);
+        at += bestLength;
+        expected = bestFrom + bestLength;
+      }
+      else
+      {
+        literal.push_back(target[at++]);
+        expected++;
+      }
+    }
+    flushLiteral();
+    return delta;
+  }
+
+  struct Patch
+  {
+    const std::vector<uint8_t> *source;
+    std::vector<uint8_t> output;
+  };
+
+  bool readSource(void *context, uint32_t offset, uint8_t *data, size_t length)
+  {
+    const std::vector<uint8_t> &source = *((Patch *)context)->source;
+    if (offset + length > source.size())
+      return false;
+    std::copy(source.begin() + offset, source.begin() + offset + length, data);
+    return true;
+  }
+
+  bool writeTarget(void *context, const uint8_t *data, size_t length)
+  {
+    std::vector<uint8_t> &output = ((Patch *)context)->output;
+    output.insert(output.end(), data, data + length);
+    return true;
+  }
+
+  // Applies the delta the way the device does, in pieces of random size.
+  bool verify(const std::vector<uint8_t> &source, const std::vector<uint8_t> &target, const std::vector<uint8_t> &delta, const char *key)
+  {
+    DeltaHeader header;
+    if (!header.parse(delta.data(), DELTA_HEADER_SIZE))
+      return false;
+
+    Patch patch = {&source, {}};
+    DeltaPatcher patcher;
+    patcher.begin(header, readSource, writeTarget, &patch);
+
+    std::mt19937 random(1);
+    size_t at = DELTA_HEADER_SIZE;
+    while (at < delta.size())
+    {
+      size_t piece = std::min<size_t>(1 + random() % OTA_CHUNK, delta.size() - at);
+      if (!patcher.feed(delta.data() + at, piece))
+        return false;
+      at += piece;
+    }
+    return patcher.finish((const uint8_t *)key, strlen(key)) && patch.output == target;
+  }
+
+  double transferSeconds(size_t bytes, double rate)
+  {
+    size_t chunks = (bytes + OTA_CHUNK - 1) / OTA_CHUNK;
+    return (bytes + chunks * 10.0) / rate; // 3 ATT + 7 chunk header bytes per write
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 5)
+  {
+    fprintf(stderr, "usage: %s <key> <old.bin> <new.bin> <update.delta> [link bytes per second]\n", argv[0]);
+    return 2;
+  }
+
+  const char *key = argv[1];
+  std::vector<uint8_t> source = readFile(argv[2]);
+  std::vector<uint8_t> target = readFile(argv[3]);
+  double rate = argc > 5 ? atof(argv[5]) : 20000;
+
+  std::vector<uint8_t> delta = diff(source, target, key);
+  if (!verify(source, target, delta, key))
+  {
+    fprintf(stderr, "internal error: delta does not reproduce %s\n", argv[3]);
+    return 1;
+  }
+
+  std::ofstream output(argv[4], std::ios::binary);
+  output.write((const char *)delta.data(), delta.size());
+
+  printf("%zu byte image, %zu byte delta (%.1f%%), verified\n", target.size(), delta.size(), 100.0 * delta.size() / target.size());
+  printf("at %.0f B/s: delta %.1f s, full image %.1f s\n", rate, transferSeconds(delta.size(), rate), transferSeconds(target.size(), rate));
+  return 0;
+}
@@ -0,0 +1,482 @@
+// patternc - compiles the custom pattern language into PatternVM bytecode.
+//
+// Build and run on the host:
+//   g++ -std=c++17 -O2 -I include tools/patternc.cpp -o patternc
+//   ./patternc wave.pat wave.bin
+//
+// A source file is a list of `name = expression` statements, one per line,
+// split into a per-frame section and a per-pixel section:
+//
+//   frame:
+//   speed = t * 0.25
+//   pixel:
+//   v = sin(x * 3 + speed) * 0.5 + 0.5
+//   r = r * v
+//   g = g * v
+//   b = b * v
+//
+// Statements before any section header belong to the pixel section. `#`
+// starts a comment.
+//
+// Built-ins: r g b (colour in and out, 0-255), i (pixel index), x (0-1 along
+// the strip), n (pixel count), t (time in pattern rate ticks since the pattern
+// started, wrapping back to 0 every 32768 ticks).
+// Functions: sin cos (argument in turns), abs floor frac min max.
+// Operators: + - * / % < > and unary minus.
+
+#include <PatternVM.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+  struct CompileError
+  {
+    std::string message;
+  };
+
+  class Compiler
+  {
+  public:
+    std::vector<int32_t> constants;
+    std::vector<uint32_t> prologue;
+    std::vector<uint32_t> kernel;
+
+    void compileLine(const std::string &line)
+    {
+      this->source = line;
+      this->cursor = 0;
+
+      std::string name = this->identifier();
+      if (name.empty())
+      {
+        throw CompileError{"expected a variable name"};
+      }
+
+      if (this->accept(':'))
+      {
+        this->expectEnd();
+        if (name == "frame")
+        {
+          this->code = &this->prologue;
+          this->inPixel = false;
+        }
+        else if (name == "pixel")
+        {
+          this->code = &this->kernel;
+          this->inPixel = true;
+        }
+        else
+        {
+          throw CompileError{"unknown section '" + name + "'"};
+        }
+        return;
+      }
+
+      if (name == "i" || name == "x" || name == "n" || name == "t")
+      {
+        throw CompileError{"'" + name + "' is read-only"};
+      }
+
+      this->expect('=');
+      uint8_t value = this->expression();
+      this->expectEnd();
+
+      uint8_t target = this->variable(name, true);
+      if (value != target)
+      {
+        this->emit(OP_MOV, target, value, 0);
+      }
+      this->temporaries = 0;
+    }
+
+  private:
+    std::string source;
+    size_t cursor = 0;
+    std::vector<uint32_t> *code = &kernel;
+    bool inPixel = true;
+    std::map<std::string, uint8_t> variables = {
+        {"r", REG_RED}, {"g", REG_GREEN}, {"b", REG_BLUE}, {"i", REG_INDEX}, {"x", REG_X}, {"n", REG_PIXELS}, {"t", REG_TIME}};
+    uint16_t allocated = (1 << REG_FIRST_FREE) - 1; // registers owned by variables
+    uint16_t temporaries = 0;                       // registers live within the current statement
+
+    void skipSpace()
+    {
+      while (this->cursor < this->source.size() && isspace((unsigned char)this->source[this->cursor]))
+      {
+        this->cursor++;
+      }
+    }
+
+    bool accept(char c)
+    {
+      this->skipSpace();
+      if (this->cursor < this->source.size() && this->source[this->cursor] == c)
+      {
+        this->cursor++;
+        return true;
+      }
+      return false;
+    }
+
+    void expect(char c)
+    {
+      if (!this->accept(c))
+      {
+        throw CompileError{std::string("expected '") + c + "'"};
+      }
+    }
+
+    void expectEnd()
+    {
+      this->skipSpace();
+      if (this->cursor != this->source.size())
+      {
+        throw CompileError{"unexpected '" + this->source.substr(this->cursor) + "'"};
+      }
+    }
+
+    std::string identifier()
+    {
+      this->skipSpace();
+      size_t start = this->cursor;
+      while (this->cursor < this->source.size() &&
+             (isalnum((unsigned char)this->source[this->cursor]) || this->source[this->cursor] == '_'))
+      {
+        this->cursor++;
+      }
+      return this->source.substr(start, this->cursor - start);
+    }
+
+    void emit(uint8_t op, uint8_t dst, uint8_t a, uint8_t b)
+    {
+      this->code->push_back(op | (dst << 8) | (a << 16) | ((uint32_t)b << 24));
+    }
+
+    uint8_t temporary()
+    {
+      for (int reg = PATTERN_VM_REGISTERS - 1; reg >= REG_FIRST_FREE; reg--)
+      {
+        uint16_t bit = 1 << reg;
+        if (!(this->allocated & bit) && !(this->temporaries & bit))
+        {
+          this->temporaries |= bit;
+          return reg;
+        }
+      }
+      throw CompileError{"expression needs too many registers"};
+    }
+
+    void release(uint8_t reg)
+    {
+      this->temporaries &= ~(1 << reg);
+    }
+
+    bool isTemporary(uint8_t reg) const
+    {
+      return this->temporaries & (1 << reg);
+    }
+
+    uint8_t variable(const std::string &name, bool create)
+    {
+      auto it = this->variables.find(name);
+      if (it != this->variables.end())
+      {
+        if (!this->inPixel && (it->second == REG_INDEX || it->second == REG_X))
+        {
+          throw CompileError{"'" + name + "' is only available in the pixel section"};
+        }
+        return it->second;
+      }
+
+      if (!create)
+      {
+        throw CompileError{"unknown variable '" + name + "'"};
+      }
+
+      for (uint8_t reg = REG_FIRST_FREE; reg < PATTERN_VM_REGISTERS; reg++)
+      {
+        uint16_t bit = 1 << reg;
+        if (!(this->allocated & bit) && !(this->temporaries & bit))
+        {
+          this->allocated |= bit;
+          this->variables[name] = reg;
+          return reg;
+        }
+      }
+      throw CompileError{"too many variables"};
+    }
+
+    uint8_t constant(double value)
+    {
+      int32_t fixed = (int32_t)lround(value * PatternVM::ONE);
+      size_t index = 0;
+      while (index < this->constants.size() && this->constants[index] != fixed)
+      {
+        index++;
+      }
+      if (index == this->constants.size())
+      {
+        if (index >= PATTERN_VM_MAX_CONSTANTS)
+        {
+          throw CompileError{"too many constants"};
+        }
+        this->constants.push_back(fixed);
+      }
+
+      uint8_t reg = this->temporary();
+      this->emit(OP_LOADK, reg, index & 0xFF, index >> 8);
+      return reg;
+    }
+
+    // Emits `op a b` into a register, reusing an operand temporary when possible.
+    uint8_t binary(uint8_t op, uint8_t a, uint8_t b)
+    {
+      uint8_t dst = this->isTemporary(a) ? a : this->isTemporary(b) ? b
+                                                                     : this->temporary();
+      this->emit(op, dst, a, b);
+      if (b != dst && this->isTemporary(b))
+      {
+        this->release(b);
+      }
+      if (a != dst && this->isTemporary(a))
+      {
+        this->release(a);
+      }
+      return dst;
+    }
+
+    uint8_t expression()
+    {
+      uint8_t left = this->additive();
+      while (true)
+      {
+        if (this->accept('<'))
+        {
+          left = this->binary(OP_LT, left, this->additive());
+        }
+        else if (this->accept('>'))
+        {
+          uint8_t right = this->additive();
+          left = this->binary(OP_LT, right, left);
+        }
+        else
+        {
+          return left;
+        }
+      }
+    }
+
+    uint8_t additive()
+    {
+      uint8_t left = this->term();
+      while (true)
+      {
+        if (this->accept('+'))
+        {
+          left = this->binary(OP_ADD, left, this->term());
+        }
+        else if (this->accept('-'))
+        {
+          left = this->binary(OP_SUB, left, this->term());
+        }
+        else
+        {
+          return left;
+        }
+      }
+    }
+
+    uint8_t term()
+    {
+      uint8_t left = this->unary();
+      while (true)
+      {
+        if (this->accept('*'))
+        {
+          left = this->binary(OP_MUL, left, this->unary());
+        }
+        else if (this->accept('/'))
+        {
+          left = this->binary(OP_DIV, left, this->unary());
+        }
+        else if (this->accept('%'))
+        {
+          left = this->binary(OP_MOD, left, this->unary());
+        }
+        else
+        {
+          return left;
+        }
+      }
+    }
+
+    uint8_t unary()
+    {
+      if (this->accept('-'))
+      {
+        uint8_t value = this->unary();
+        uint8_t dst = this->isTemporary(value) ? value : this->temporary();
+        this->emit(OP_NEG, dst, value, 0);
+        return dst;
+      }
+      return this->primary();
+    }
+
+    uint8_t primary()
+    {
+      if (this->accept('('))
+      {
+        uint8_t value = this->expression();
+        this->expect(')');
+        return value;
+      }
+
+      this->skipSpace();
+      if (this->cursor < this->source.size() &&
+          (isdigit((unsigned char)this->source[this->cursor]) || this->source[this->cursor] == '.'))
+      {
+        const char *start = this->source.c_str() + this->cursor;
+        char *end = nullptr;
+        double value = strtod(start, &end);
+        this->cursor += end - start;
+        return this->constant(value);
+      }
+
+      std::string name = this->identifier();
+      if (name.empty())
+      {
+        throw CompileError{"expected an expression"};
+      }
+
+      if (!this->accept('('))
+      {
+        return this->variable(name, false);
+      }
+
+      static const std::map<std::string, uint8_t> unaryFunctions = {
+          {"sin", OP_SIN}, {"cos", OP_COS}, {"abs", OP_ABS}, {"floor", OP_FLOOR}, {"frac", OP_FRAC}};
+      static const std::map<std::string, uint8_t> binaryFunctions = {{"min", OP_MIN}, {"max", OP_MAX}};
+
+      auto single = unaryFunctions.find(name);
+      if (single != unaryFunctions.end())
+      {
+        uint8_t value = this->expression();
+        this->expect(')');
+        uint8_t dst = this->isTemporary(value) ? value : this->temporary();
+        this->emit(single->second, dst, value, 0);
+        return dst;
+      }
+
+      auto pair = binaryFunctions.find(name);
+      if (pair != binaryFunctions.end())
+      {
+        uint8_t a = this->expression();
+        this->expect(',');
+        uint8_t b = this->expression();
+        this->expect(')');
+        return this->binary(pair->second, a, b);
+      }
+
+      throw CompileError{"unknown function '" + name + "'"};
+    }
+  };
+
+  std::vector<uint8_t> assemble(const Compiler &compiler)
+  {
+    std::vector<uint8_t> image = {'P', 'V', PATTERN_VM_VERSION,
+                                  (uint8_t)compiler.constants.size(),
+                                  (uint8_t)compiler.prologue.size(),
+                                  (uint8_t)compiler.kernel.size()};
+
+    auto word = [&image](uint32_t value)
+    {
+      for (int shift = 0; shift < 32; shift += 8)
+      {
+        image.push_back((value >> shift) & 0xFF);
+      }
+    };
+
+    for (int32_t constant : compiler.constants)
+    {
+      word((uint32_t)constant);
+    }
+    for (uint32_t instruction : compiler.prologue)
+    {
+      word(instruction);
+    }
+    for (uint32_t instruction : compiler.kernel)
+    {
+      word(instruction);
+    }
+    return image;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: %s <source.pat> <output.bin>\n", argv[0]);
+    return 2;
+  }
+
+  std::ifstream input(argv[1]);
+  if (!input)
+  {
+    fprintf(stderr, "%s: cannot open\n", argv[1]);
+    return 1;
+  }
+
+  Compiler compiler;
+  std::string line;
+  int lineNumber = 0;
+  while (std::getline(input, line))
+  {
+    lineNumber++;
+    line = line.substr(0, line.find('#'));
+    if (line.find_first_not_of(" \t\r") == std::string::npos)
+    {
+      continue;
+    }
+
+    try
+    {
+      compiler.compileLine(line);
+    }
+    catch (const CompileError &error)
+    {
+      fprintf(stderr, "%s:%d: %s\n", argv[1], lineNumber, error.message.c_str());
+      return 1;
+    }
+  }
+
+  std::vector<uint8_t> image = assemble(compiler);
+  if (!PatternVM::validate(image.data(), image.size()))
+  {
+    fprintf(stderr, "%s: program exceeds the VM limits (%zu frame, %zu pixel instructions; max %d total, %d per pixel)\n",
+            argv[1], compiler.prologue.size(), compiler.kernel.size(), PATTERN_VM_MAX_CODE, PATTERN_VM_MAX_KERNEL);
+    return 1;
+  }
+
+  std::ofstream output(argv[2], std::ios::binary);
+  output.write((const char *)image.data(), image.size());
+
+  PatternVM vm;
+  vm.load(image.data(), image.size());
+  printf("%zu bytes, %zu constants, %zu frame + %zu pixel instructions, %u per frame at 132 pixels\n",
+         image.size(), compiler.constants.size(), compiler.prologue.size(), compiler.kernel.size(), vm.frameCost(132));
+  for (uint8_t byte : image)
+  {
+    printf("%02x", byte);
+  }
+  printf("\n");
+  return 0;
+}